@@ -0,0 +1,233 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Huge page arena for AVL tree items
+ * ==================================
+ *
+ * A lookup in a tree of hundreds of millions of items touches a different 4
+ * KiB page at almost every level, and the TLB holds far fewer entries than
+ * that.  An arena hands out item memory from chunks of whole 2 MiB pages,
+ * advised to the kernel as huge page candidates (or taken from the explicitly
+ * reserved huge page pool), so the same descent needs a handful of TLB
+ * entries.  Chunks can also be bound to one NUMA node, so that a tree used by
+ * the threads of one socket does not live on the other.
+ *
+ * Items are allocated by bumping a pointer and are never freed one at a time;
+ * the whole arena goes away at once.  That suits trees which are built in bulk
+ * (avl_tree_build_sorted() over items allocated here) or compacted
+ * periodically (avl_tree_compact() with avl_arena_relocate()), and then torn
+ * down together.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+#include "avl_arena.h"
+
+/* Alignment of every allocation  */
+#define AVL_ARENA_ALIGN		16
+
+/* Highest NUMA node number avl_arena_bind() can express, plus one  */
+#define AVL_ARENA_MAX_NODES	1024
+
+/* Header at the start of each mapping  */
+struct avl_arena_chunk {
+	struct avl_arena_chunk *next;
+	size_t size;
+};
+
+/* Size of the header, rounded up to keep allocations aligned  */
+#define AVL_ARENA_HEADER_SIZE \
+	((sizeof(struct avl_arena_chunk) + AVL_ARENA_ALIGN - 1) & \
+	 ~(size_t)(AVL_ARENA_ALIGN - 1))
+
+/*
+ * Initializes an empty arena.  No memory is mapped until the first
+ * allocation.
+ *
+ * @chunk_size
+ *	Size of each mapping, rounded up to a multiple of
+ *	AVL_ARENA_HUGE_PAGE_SIZE.  Larger requests get a chunk of their own.
+ *
+ * @numa_node
+ *	NUMA node to bind the memory to, or -1 to leave it to the kernel's
+ *	policy.
+ *
+ * @flags
+ *	Bitwise OR of AVL_ARENA_* flags.
+ */
+void
+avl_arena_init(struct avl_arena *arena, size_t chunk_size, int numa_node,
+	       unsigned int flags)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+	arena->numa_node = numa_node;
+	arena->flags = flags;
+}
+
+/* Binds a fresh mapping to a NUMA node.  Returns 0 or -1.  */
+static int
+avl_arena_bind(void *addr, size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[AVL_ARENA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= AVL_ARENA_MAX_NODES) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(mask[0]))] |=
+		1UL << (node % (8 * sizeof(mask[0])));
+
+	/* 2 is MPOL_BIND.  The kernel wants the mask size plus one.  */
+	return syscall(SYS_mbind, addr, size, 2, mask,
+		       (unsigned long)AVL_ARENA_MAX_NODES + 1, 0) ? -1 : 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Maps a chunk with room for at least @size bytes after its header.  */
+static struct avl_arena_chunk *
+avl_arena_map(struct avl_arena *arena, size_t size)
+{
+	const size_t page = AVL_ARENA_HUGE_PAGE_SIZE;
+	struct avl_arena_chunk *chunk = MAP_FAILED;
+
+	if (size > SIZE_MAX - page - AVL_ARENA_HEADER_SIZE ||
+	    arena->chunk_size > SIZE_MAX - page)
+		return NULL;
+	size += AVL_ARENA_HEADER_SIZE;
+	if (size < arena->chunk_size)
+		size = arena->chunk_size;
+	size = (size + page - 1) & ~(page - 1);
+
+#ifdef MAP_HUGETLB
+	if (arena->flags & AVL_ARENA_HUGETLB)
+		chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (chunk == MAP_FAILED) {
+		/* Fall back to normal pages, asking for them to be backed
+		 * by transparent huge pages.  */
+		chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(chunk, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	/* The policy must be set before any page is touched.  */
+	if (arena->numa_node >= 0 &&
+	    avl_arena_bind(chunk, size, arena->numa_node)) {
+		munmap(chunk, size);
+		return NULL;
+	}
+
+	chunk->next = arena->chunks;
+	chunk->size = size;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+/*
+ * Makes sure that the next allocations, up to @size bytes in total counting
+ * alignment, come from a single mapping and so cannot fail.  Returns 0, or -1
+ * if memory could not be mapped.
+ */
+int
+avl_arena_reserve(struct avl_arena *arena, size_t size)
+{
+	struct avl_arena_chunk *chunk;
+
+	if (size <= arena->left)
+		return 0;
+	chunk = avl_arena_map(arena, size);
+	if (!chunk)
+		return -1;
+
+	/* The rest of the previous chunk is abandoned.  */
+	arena->next = (char *)chunk + AVL_ARENA_HEADER_SIZE;
+	arena->left = chunk->size - AVL_ARENA_HEADER_SIZE;
+	return 0;
+}
+
+/* Returns @size bytes of memory aligned to 16 bytes, or NULL if memory could
+ * not be mapped.  */
+void *
+avl_arena_alloc(struct avl_arena *arena, size_t size)
+{
+	void *p;
+
+	if (size > SIZE_MAX - AVL_ARENA_ALIGN)
+		return NULL;
+	size = (size + AVL_ARENA_ALIGN - 1) & ~(size_t)(AVL_ARENA_ALIGN - 1);
+	if (avl_arena_reserve(arena, size))
+		return NULL;
+	p = arena->next;
+	arena->next += size;
+	arena->left -= size;
+	return p;
+}
+
+/*
+ * Relocation callback for avl_tree_compact(), with the arena as context:
+ * copies the item containing @node into the arena and returns the node of the
+ * copy.  The item size and node offset must have been set with
+ * AVL_ARENA_ITEMS(), and room for the whole tree reserved with
+ * avl_arena_reserve(), since the callback may not fail.
+ */
+struct avl_tree_node *
+avl_arena_relocate(struct avl_tree_node *node, void *arena)
+{
+	struct avl_arena *a = arena;
+	char *item = avl_arena_alloc(a, a->item_size);
+
+	memcpy(item, (char *)node - a->node_offset, a->item_size);
+	return (struct avl_tree_node *)(item + a->node_offset);
+}
+
+/* Unmaps all memory of the arena, which is left empty.  */
+void
+avl_arena_destroy(struct avl_arena *arena)
+{
+	struct avl_arena_chunk *chunk = arena->chunks;
+
+	while (chunk) {
+		struct avl_arena_chunk *next = chunk->next;
+
+		munmap(chunk, chunk->size);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+	arena->next = NULL;
+	arena->left = 0;
+}
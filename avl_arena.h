@@ -0,0 +1,82 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Huge page arena for AVL tree items
+ * ==================================
+ */
+
+#ifndef _AVL_ARENA_H
+#define _AVL_ARENA_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the huge pages chunks are rounded to  */
+#define AVL_ARENA_HUGE_PAGE_SIZE	((size_t)2 << 20)
+
+/* Flags for avl_arena_init()  */
+#define AVL_ARENA_HUGETLB	0x1	/* map explicitly reserved huge pages
+					   (MAP_HUGETLB) when there are any  */
+
+struct avl_arena_chunk;
+
+/* Bump allocator over large anonymous mappings.  Memory is only given back
+ * all at once, by avl_arena_destroy().  */
+struct avl_arena {
+	struct avl_arena_chunk *chunks;
+	char *next;
+	size_t left;
+
+	size_t chunk_size;
+	int numa_node;			/* -1 for no binding  */
+	unsigned int flags;
+
+	/* Size of each item and offset of its `struct avl_tree_node', for
+	 * avl_arena_relocate()  */
+	size_t item_size;
+	size_t node_offset;
+};
+
+#define AVL_ARENA_ITEMS(arena, type, member) \
+	((arena)->item_size = sizeof(type), \
+	 (arena)->node_offset = offsetof(type, member))
+
+void
+avl_arena_init(struct avl_arena *arena, size_t chunk_size, int numa_node,
+               unsigned int flags);
+
+int
+avl_arena_reserve(struct avl_arena *arena, size_t size);
+
+void *
+avl_arena_alloc(struct avl_arena *arena, size_t size);
+
+struct avl_tree_node *
+avl_arena_relocate(struct avl_tree_node *node, void *arena);
+
+void
+avl_arena_destroy(struct avl_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_ARENA_H */
@@ -0,0 +1,343 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree of sorted key blocks
+ * =============================
+ *
+ * With one key per node, a lookup in a tree of n keys follows about log2(n)
+ * pointers, each usually a cache miss.  Here every node of the AVL tree holds
+ * a sorted block of up to AVL_BLOCK_KEYS keys with their values, and blocks
+ * cover disjoint key ranges.  The tree is AVL_BLOCK_KEYS / 2 to
+ * AVL_BLOCK_KEYS times smaller, so lookups touch correspondingly fewer nodes;
+ * inside a block the keys are contiguous and are scanned without branches.
+ *
+ * Blocks are split in halves when they overflow and merged with a neighbour
+ * when they fall below a quarter full.  The blocks themselves are linked and
+ * rebalanced with the ordinary avl_tree_link_node() and avl_tree_remove(),
+ * minus their trace hooks, since blocks are not items of the application.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_block.h"
+#include "avl_traversal.h"
+
+#define AVL_BLOCK(__node)  avl_tree_entry((__node), struct avl_block, node)
+
+/* Returns the number of keys in @block that are less than @key.  The loop has
+ * a fixed trip count and no branches, so the compiler can vectorize it when
+ * the target has 64-bit vector compares (e.g. -mavx2); unused slots hold
+ * ULONG_MAX and are never counted.  */
+static AVL_INLINE unsigned int
+avl_block_rank(const struct avl_block *block, unsigned long key)
+{
+	unsigned int rank = 0;
+
+	for (unsigned int i = 0; i < AVL_BLOCK_KEYS; i++)
+		rank += block->keys[i] < key;
+	return rank;
+}
+
+/* Returns the block whose key range contains @key or, if there is none, the
+ * block @key belongs in.  Returns NULL only if the tree is empty.  */
+static struct avl_block *
+avl_block_find(const struct avl_block_tree *tree, unsigned long key)
+{
+	const struct avl_tree_node *cur = tree->root.avl_tree_node;
+	const struct avl_block *block = NULL;
+
+	while (cur) {
+		block = AVL_BLOCK(cur);
+		if (key < block->keys[0])
+			cur = cur->left;
+		else if (key > block->keys[block->count - 1])
+			cur = cur->right;
+		else
+			break;
+	}
+
+	return (struct avl_block *)block;
+}
+
+static struct avl_block *
+avl_block_alloc(void)
+{
+	struct avl_block *block;
+	void *p;
+
+	if (posix_memalign(&p, 64, sizeof(*block)))
+		return NULL;
+
+	block = p;
+	block->count = 0;
+	for (unsigned int i = 0; i < AVL_BLOCK_KEYS; i++)
+		block->keys[i] = ULONG_MAX;
+	return block;
+}
+
+/* Moves the upper half of the full @block to a new block, which is linked
+ * into the tree as its in-order successor.  Returns the new block, or NULL if
+ * it could not be allocated.  */
+static struct avl_block *
+avl_block_split(struct avl_block_tree *tree, struct avl_block *block)
+{
+	const unsigned int half = AVL_BLOCK_KEYS / 2;
+	struct avl_block *upper;
+	struct avl_tree_link link;
+
+	upper = avl_block_alloc();
+	if (!upper)
+		return NULL;
+
+	memcpy(upper->keys, &block->keys[half], half * sizeof(block->keys[0]));
+	memcpy(upper->values, &block->values[half],
+	       half * sizeof(block->values[0]));
+	upper->count = half;
+
+	for (unsigned int i = half; i < AVL_BLOCK_KEYS; i++)
+		block->keys[i] = ULONG_MAX;
+	block->count = half;
+
+	if (!block->node.right) {
+		link.parent = &block->node;
+		link.node = &block->node.right;
+	} else {
+		link.parent = block->node.right;
+		while (link.parent->left)
+			link.parent = link.parent->left;
+		link.node = &link.parent->left;
+	}
+	avl_tree_link_node_untraced(&tree->root, &link, &upper->node);
+
+	return upper;
+}
+
+/* If @block and one of its neighbours fit together in three quarters of a
+ * block, moves the keys of the upper one into the lower one and frees the
+ * upper one.  */
+static void
+avl_block_try_merge(struct avl_block_tree *tree, struct avl_block *block)
+{
+	const unsigned int limit = AVL_BLOCK_KEYS / 4 * 3;
+	struct avl_tree_node *neighbour;
+	struct avl_block *lower, *upper;
+
+	neighbour = avl_tree_next_in_order(&block->node);
+	if (neighbour && AVL_BLOCK(neighbour)->count + block->count <= limit) {
+		lower = block;
+		upper = AVL_BLOCK(neighbour);
+	} else {
+		neighbour = avl_tree_prev_in_order(&block->node);
+		if (!neighbour ||
+		    AVL_BLOCK(neighbour)->count + block->count > limit)
+			return;
+		lower = AVL_BLOCK(neighbour);
+		upper = block;
+	}
+
+	memcpy(&lower->keys[lower->count], upper->keys,
+	       upper->count * sizeof(upper->keys[0]));
+	memcpy(&lower->values[lower->count], upper->values,
+	       upper->count * sizeof(upper->values[0]));
+	lower->count += upper->count;
+
+	avl_tree_remove_untraced(&tree->root, &upper->node);
+	free(upper);
+}
+
+/*
+ * Looks up a key in a block tree.
+ *
+ * Returns a pointer to the value stored with @key, through which the value may
+ * also be changed, or NULL if @key is not in the tree.  The pointer is valid
+ * until the tree is next modified.
+ */
+void **
+avl_block_lookup(const struct avl_block_tree *tree, unsigned long key)
+{
+	struct avl_block *block = avl_block_find(tree, key);
+	unsigned int rank;
+
+	if (!block)
+		return NULL;
+
+	rank = avl_block_rank(block, key);
+	if (rank < block->count && block->keys[rank] == key)
+		return &block->values[rank];
+	return NULL;
+}
+
+/*
+ * Inserts a key and its value into a block tree.
+ *
+ * Returns 0 if the key was inserted, 1 if it was already in the tree (in which
+ * case nothing is changed), or -1 if a new block was needed but could not be
+ * allocated.
+ */
+int
+avl_block_insert(struct avl_block_tree *tree, unsigned long key, void *value)
+{
+	struct avl_block *block = avl_block_find(tree, key);
+	unsigned int rank;
+
+	if (!block) {
+		struct avl_tree_link link = {
+			.parent = NULL,
+			.node = &tree->root.avl_tree_node,
+		};
+
+		block = avl_block_alloc();
+		if (!block)
+			return -1;
+		avl_tree_link_node_untraced(&tree->root, &link, &block->node);
+	}
+
+	rank = avl_block_rank(block, key);
+	if (rank < block->count && block->keys[rank] == key)
+		return 1;
+
+	if (block->count == AVL_BLOCK_KEYS) {
+		struct avl_block *upper = avl_block_split(tree, block);
+
+		if (!upper)
+			return -1;
+		if (rank > AVL_BLOCK_KEYS / 2) {
+			block = upper;
+			rank -= AVL_BLOCK_KEYS / 2;
+		}
+	}
+
+	memmove(&block->keys[rank + 1], &block->keys[rank],
+		(block->count - rank) * sizeof(block->keys[0]));
+	memmove(&block->values[rank + 1], &block->values[rank],
+		(block->count - rank) * sizeof(block->values[0]));
+	block->keys[rank] = key;
+	block->values[rank] = value;
+	block->count++;
+	tree->count++;
+	return 0;
+}
+
+/*
+ * Removes a key from a block tree.
+ *
+ * Returns true and sets *@value_ret (if @value_ret is not NULL) to the value
+ * that was stored with @key, or returns false if @key is not in the tree.
+ */
+bool
+avl_block_remove(struct avl_block_tree *tree, unsigned long key,
+		 void **value_ret)
+{
+	struct avl_block *block = avl_block_find(tree, key);
+	unsigned int rank;
+
+	if (!block)
+		return false;
+
+	rank = avl_block_rank(block, key);
+	if (rank >= block->count || block->keys[rank] != key)
+		return false;
+
+	if (value_ret)
+		*value_ret = block->values[rank];
+
+	block->count--;
+	memmove(&block->keys[rank], &block->keys[rank + 1],
+		(block->count - rank) * sizeof(block->keys[0]));
+	memmove(&block->values[rank], &block->values[rank + 1],
+		(block->count - rank) * sizeof(block->values[0]));
+	block->keys[block->count] = ULONG_MAX;
+	tree->count--;
+
+	if (block->count == 0) {
+		avl_tree_remove_untraced(&tree->root, &block->node);
+		free(block);
+	} else if (block->count < AVL_BLOCK_KEYS / 4) {
+		avl_block_try_merge(tree, block);
+	}
+	return true;
+}
+
+/* Frees all blocks of a block tree and leaves it empty.  */
+void
+avl_block_destroy(struct avl_block_tree *tree)
+{
+	struct avl_tree_node *cur, *parent;
+
+	for (cur = avl_tree_first_in_postorder(&tree->root); cur;
+	     cur = avl_tree_next_in_postorder(cur, parent)) {
+		parent = avl_get_parent(cur);
+		free(AVL_BLOCK(cur));
+	}
+	*tree = AVL_BLOCK_TREE;
+}
+
+/* Positions @cursor on the smallest key of a block tree.  Returns false if the
+ * tree is empty.  */
+bool
+avl_block_first(const struct avl_block_tree *tree,
+		struct avl_block_cursor *cursor)
+{
+	struct avl_tree_node *first = avl_tree_first_in_order(&tree->root);
+
+	cursor->block = first ? AVL_BLOCK(first) : NULL;
+	cursor->idx = 0;
+	return first != NULL;
+}
+
+/* Positions @cursor on the smallest key of a block tree which is not less than
+ * @key.  Returns false if there is no such key.  */
+bool
+avl_block_seek(const struct avl_block_tree *tree, unsigned long key,
+	       struct avl_block_cursor *cursor)
+{
+	struct avl_block *block = avl_block_find(tree, key);
+
+	cursor->block = block;
+	if (!block)
+		return false;
+
+	cursor->idx = avl_block_rank(block, key);
+	if (cursor->idx < block->count)
+		return true;
+
+	/* All keys of @block are less than @key, so the next block's keys are
+	 * all greater than it.  */
+	cursor->idx = block->count - 1;
+	return avl_block_next(cursor);
+}
+
+/* Advances @cursor to the next key in sorted order.  Returns false, leaving
+ * the cursor invalid, if there are no more keys.  */
+bool
+avl_block_next(struct avl_block_cursor *cursor)
+{
+	struct avl_tree_node *next;
+
+	if (++cursor->idx < cursor->block->count)
+		return true;
+
+	next = avl_tree_next_in_order(&cursor->block->node);
+	cursor->block = next ? AVL_BLOCK(next) : NULL;
+	cursor->idx = 0;
+	return next != NULL;
+}
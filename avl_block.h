@@ -0,0 +1,96 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree of sorted key blocks
+ * =============================
+ */
+
+#ifndef _AVL_BLOCK_H
+#define _AVL_BLOCK_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of keys per block.  Must be even.  32 keys of 8 bytes span four
+ * 64-byte cache lines.  */
+#ifndef AVL_BLOCK_KEYS
+#  define AVL_BLOCK_KEYS 32
+#endif
+
+/* Node of a block tree: a sorted run of keys with their values.  Unused key
+ * slots hold ULONG_MAX so that searches can scan the whole array.  */
+struct avl_block {
+	unsigned long keys[AVL_BLOCK_KEYS];
+	void *values[AVL_BLOCK_KEYS];
+	struct avl_tree_node node;
+	unsigned int count;
+};
+
+struct avl_block_tree {
+	struct avl_tree_root root;
+
+	/* Number of keys in the tree  */
+	size_t count;
+};
+
+#define AVL_BLOCK_TREE  (struct avl_block_tree) {{NULL, }, 0}
+
+/* Position of a key in a block tree.  */
+struct avl_block_cursor {
+	struct avl_block *block;
+	unsigned int idx;
+};
+
+#define avl_block_cursor_key(cursor) \
+	((cursor)->block->keys[(cursor)->idx])
+
+#define avl_block_cursor_value(cursor) \
+	((cursor)->block->values[(cursor)->idx])
+
+void **
+avl_block_lookup(const struct avl_block_tree *tree, unsigned long key);
+
+int
+avl_block_insert(struct avl_block_tree *tree, unsigned long key, void *value);
+
+bool
+avl_block_remove(struct avl_block_tree *tree, unsigned long key,
+                 void **value_ret);
+
+void
+avl_block_destroy(struct avl_block_tree *tree);
+
+bool
+avl_block_first(const struct avl_block_tree *tree,
+                struct avl_block_cursor *cursor);
+
+bool
+avl_block_seek(const struct avl_block_tree *tree, unsigned long key,
+               struct avl_block_cursor *cursor);
+
+bool
+avl_block_next(struct avl_block_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_BLOCK_H */
@@ -0,0 +1,510 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree bulk construction
+ * ==========================
+ *
+ * Building a tree from n items with avl_tree_insert() costs n searches and n
+ * rebalances.  When all the items are known up front it is cheaper to sort
+ * them once and link them directly into a perfectly balanced shape.
+ *
+ * The recursion below only goes as deep as the resulting tree is high, so
+ * unlike a recursive insertion it cannot overflow the stack.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_build.h"
+#include "avl_cursor.h"
+#include "avl_traversal.h"
+
+/* Ranges smaller than this are never handed to another thread; starting a
+ * thread costs more than sorting or linking them.  */
+#define AVL_BUILD_PARALLEL_MIN	8192
+
+/* Runs no longer than this are sorted by insertion sort.  */
+#define AVL_BUILD_INSERTION_MAX	16
+
+typedef int (*avl_build_cmp_t)(const struct avl_tree_node *,
+			       const struct avl_tree_node *);
+
+/* Returns the height of the tree avl_build_range() makes from @n nodes.  */
+static AVL_INLINE int
+avl_build_height(size_t n)
+{
+	int height = 0;
+
+	while (n) {
+		height++;
+		n >>= 1;
+	}
+	return height;
+}
+
+/* Returns the number of levels of a binary split needed to keep @nthreads
+ * threads busy.  */
+static AVL_INLINE int
+avl_build_split_depth(unsigned int nthreads)
+{
+	int depth = 0;
+
+	while (depth < 16 && (2u << depth) <= nthreads)
+		depth++;
+	return depth;
+}
+
+struct avl_build_job {
+	struct avl_tree_node * const *nodes;
+	size_t n;
+	struct avl_tree_node *parent;
+	int depth;
+	struct avl_tree_node *result;
+};
+
+static void *avl_build_thread(void *arg);
+
+/* Links nodes[0..n-1], which must be sorted, into a perfectly balanced subtree
+ * under @parent and returns its root.  The middle node becomes the root, so
+ * the left subtree is never smaller than the right one.  The left subtree is
+ * built by a new thread for the first @depth levels.  */
+static struct avl_tree_node *
+avl_build_range(struct avl_tree_node * const *nodes, size_t n,
+		struct avl_tree_node *parent, int depth)
+{
+	struct avl_tree_node *node;
+	size_t mid;
+
+	if (n == 0)
+		return NULL;
+
+	mid = n / 2;
+	node = nodes[mid];
+	node->parent = parent;
+	node->balance = avl_build_height(n - mid - 1) - avl_build_height(mid);
+
+	if (depth > 0 && n >= AVL_BUILD_PARALLEL_MIN) {
+		struct avl_build_job job = {
+			.nodes = nodes,
+			.n = mid,
+			.parent = node,
+			.depth = depth - 1,
+		};
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, avl_build_thread, &job)) {
+			node->left = avl_build_range(nodes, mid, node,
+						     depth - 1);
+		} else {
+			node->right = avl_build_range(nodes + mid + 1,
+						      n - mid - 1, node,
+						      depth - 1);
+			pthread_join(thread, NULL);
+			node->left = job.result;
+			return node;
+		}
+	} else {
+		node->left = avl_build_range(nodes, mid, node, 0);
+	}
+	node->right = avl_build_range(nodes + mid + 1, n - mid - 1, node,
+				      depth > 0 ? depth - 1 : 0);
+	return node;
+}
+
+static void *
+avl_build_thread(void *arg)
+{
+	struct avl_build_job *job = arg;
+
+	job->result = avl_build_range(job->nodes, job->n, job->parent,
+				      job->depth);
+	return NULL;
+}
+
+/*
+ * Builds an AVL tree from an array of items which are already sorted.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.  The tree must be empty.
+ *
+ * @nodes
+ *	Pointers to the `struct avl_tree_node' embedded in each item, in
+ *	strictly increasing order.  No members in the nodes need be
+ *	pre-initialized.
+ *
+ * @n
+ *	Number of entries in @nodes.
+ *
+ * The resulting tree is perfectly balanced, and building it takes O(n) time
+ * with no comparisons and no rotations.
+ */
+void
+avl_tree_build_sorted(struct avl_tree_root *root,
+		      struct avl_tree_node * const *nodes, size_t n)
+{
+	root->avl_tree_node = avl_build_range(nodes, n, NULL, 0);
+}
+
+struct avl_sort_job {
+	struct avl_tree_node **a;
+	struct avl_tree_node **tmp;
+	size_t n;
+	avl_build_cmp_t cmp;
+	int depth;
+};
+
+static void *avl_sort_thread(void *arg);
+
+/* Stable merge sort of a[0..n-1], using tmp[0..n-1] as scratch space.  The
+ * first half is sorted by a new thread for the first @depth levels.  */
+static void
+avl_merge_sort(struct avl_tree_node **a, struct avl_tree_node **tmp, size_t n,
+	       avl_build_cmp_t cmp, int depth)
+{
+	size_t half, i, j, k;
+
+	if (n <= AVL_BUILD_INSERTION_MAX) {
+		for (i = 1; i < n; i++) {
+			struct avl_tree_node *x = a[i];
+
+			for (j = i; j > 0 && (*cmp)(a[j - 1], x) > 0; j--)
+				a[j] = a[j - 1];
+			a[j] = x;
+		}
+		return;
+	}
+
+	half = n / 2;
+
+	if (depth > 0 && n >= AVL_BUILD_PARALLEL_MIN) {
+		struct avl_sort_job job = {
+			.a = a,
+			.tmp = tmp,
+			.n = half,
+			.cmp = cmp,
+			.depth = depth - 1,
+		};
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, avl_sort_thread, &job)) {
+			avl_merge_sort(a, tmp, half, cmp, depth - 1);
+		} else {
+			avl_merge_sort(a + half, tmp + half, n - half, cmp,
+				       depth - 1);
+			pthread_join(thread, NULL);
+			goto merge;
+		}
+	} else {
+		avl_merge_sort(a, tmp, half, cmp, 0);
+	}
+	avl_merge_sort(a + half, tmp + half, n - half, cmp,
+		       depth > 0 ? depth - 1 : 0);
+merge:
+	/* Already in order?  Common for nearly sorted input.  */
+	if ((*cmp)(a[half - 1], a[half]) <= 0)
+		return;
+
+	for (i = 0, j = half, k = 0; i < half && j < n; k++) {
+		if ((*cmp)(a[i], a[j]) <= 0)
+			tmp[k] = a[i++];
+		else
+			tmp[k] = a[j++];
+	}
+	while (i < half)
+		tmp[k++] = a[i++];
+	memcpy(a, tmp, j * sizeof(a[0]));
+}
+
+static void *
+avl_sort_thread(void *arg)
+{
+	struct avl_sort_job *job = arg;
+
+	avl_merge_sort(job->a, job->tmp, job->n, job->cmp, job->depth);
+	return NULL;
+}
+
+/* Moves every item of the sorted array a[0..n-1] that compares equal to its
+ * predecessor to the end of the array, keeping both parts in order.  Returns
+ * the number of unique items.  */
+static size_t
+avl_build_unique(struct avl_tree_node **a, struct avl_tree_node **tmp,
+		 size_t n, avl_build_cmp_t cmp)
+{
+	size_t kept = 0, dups = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (kept && (*cmp)(a[kept - 1], a[i]) == 0)
+			tmp[dups++] = a[i];
+		else
+			a[kept++] = a[i];
+	}
+	memcpy(a + kept, tmp, dups * sizeof(a[0]));
+	return kept;
+}
+
+/*
+ * Builds an AVL tree from an array of items in any order, using several
+ * threads.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.  The tree must be empty.
+ *
+ * @nodes
+ *	Pointers to the `struct avl_tree_node' embedded in each item.  The
+ *	array is reordered (see below).  As with avl_tree_insert(), members in
+ *	the containing structures should be initialized so that @cmp can use
+ *	them.
+ *
+ * @n
+ *	Number of entries in @nodes.
+ *
+ * @cmp
+ *	Comparison callback, as for avl_tree_insert().  It is called from
+ *	several threads at once.
+ *
+ * @nthreads
+ *	Maximum number of threads to use, including the calling one.  0 and 1
+ *	both mean that no threads are started.
+ *
+ * The items are merge sorted and then linked with avl_tree_build_sorted(),
+ * both phases splitting their work in halves across threads.  Of several items
+ * which compare equal, only the first one in @nodes is linked.
+ *
+ * Returns the number of items linked into the tree, k.  On return,
+ * nodes[0..k-1] holds those items in sorted order, and nodes[k..n-1] the
+ * duplicates which were left out, also in sorted order.  If memory for the sort cannot be
+ * allocated, returns (size_t)-1 and leaves the tree empty.
+ */
+size_t
+avl_tree_build_parallel(struct avl_tree_root *root,
+			struct avl_tree_node **nodes, size_t n,
+			int (*cmp)(const struct avl_tree_node *,
+				   const struct avl_tree_node *),
+			unsigned int nthreads)
+{
+	const int depth = avl_build_split_depth(nthreads);
+	struct avl_tree_node **tmp;
+	size_t unique;
+
+	tmp = malloc((n ? n : 1) * sizeof(tmp[0]));
+	if (!tmp)
+		return (size_t)-1;
+
+	avl_merge_sort(nodes, tmp, n, cmp, depth);
+	unique = avl_build_unique(nodes, tmp, n, cmp);
+	free(tmp);
+
+	root->avl_tree_node = avl_build_range(nodes, unique, NULL, depth);
+	return unique;
+}
+
+/* Returns the relocated copy of @node, whose left pointer avl_tree_compact()
+ * has turned into a forwarding pointer, and releases @node.  */
+static AVL_INLINE struct avl_tree_node *
+avl_compact_forward(struct avl_tree_node *node,
+		    void (*release)(struct avl_tree_node *, void *), void *ctx)
+{
+	struct avl_tree_node *new_node;
+
+	if (!node)
+		return NULL;
+	new_node = node->left;
+	if (release)
+		(*release)(node, ctx);
+	return new_node;
+}
+
+/*
+ * Moves every item of an AVL tree to new memory, in sorted order, and links
+ * the copies into a tree of the same shape.  After much churn, the items of a
+ * long-lived tree end up scattered over the heap; relocating them into one
+ * contiguous region (an arena) makes in-order scans sequential again, and
+ * lookups touch fewer pages, without comparing or rebalancing anything.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.  On return it points to the
+ *	relocated root.
+ *
+ * @relocate
+ *	Called on each node in sorted order, with @ctx.  It must allocate memory
+ *	for the containing item, copy the item there and return a pointer to
+ *	the `struct avl_tree_node' of the copy.  It must not fail: reserve the
+ *	memory beforehand, e.g. by sizing the arena for the whole tree.
+ *
+ * @release
+ *	If not NULL, called on each old node, with @ctx, once nothing refers to
+ *	it anymore.  The contents of the old node itself are garbage by then,
+ *	but the rest of the item is left as it was.
+ *
+ * The links of the copies are filled in by this function, so @relocate need
+ * not copy the node itself.  Takes O(n) time and O(1) extra memory: while
+ * walking the old tree, the left pointer of each node already visited, which
+ * the walk does not read again, is used to forward to its copy.
+ */
+void
+avl_tree_compact(struct avl_tree_root *root,
+		 struct avl_tree_node *(*relocate)(struct avl_tree_node *,
+						   void *),
+		 void (*release)(struct avl_tree_node *, void *),
+		 void *ctx)
+{
+	struct avl_tree_node *node, *next;
+
+	/* Copy the nodes in order, leaving the copies linked to the old
+	 * nodes.  */
+	for (node = avl_tree_first_in_order(root); node; node = next) {
+		struct avl_tree_node *new_node = (*relocate)(node, ctx);
+
+		next = avl_tree_next_in_order(node);
+		*new_node = *node;
+		node->left = new_node;
+	}
+
+	/* Walk the copies in preorder, translating the links of each one before
+	 * descending to its children.  */
+	node = avl_compact_forward(root->avl_tree_node, release, ctx);
+	root->avl_tree_node = node;
+	if (node)
+		node->parent = NULL;
+	while (node) {
+		node->left = avl_compact_forward(node->left, release, ctx);
+		node->right = avl_compact_forward(node->right, release, ctx);
+		if (node->left)
+			node->left->parent = node;
+		if (node->right)
+			node->right->parent = node;
+
+		if (node->left) {
+			node = node->left;
+		} else if (node->right) {
+			node = node->right;
+		} else {
+			/* Climb to the first ancestor with a right subtree
+			 * which has not been walked yet.  */
+			for (next = node->parent;
+			     next && (node == next->right || !next->right);
+			     node = next, next = next->parent)
+				;
+			node = next ? next->right : NULL;
+		}
+	}
+}
+
+/*
+ * Removes from an AVL tree all items which do not satisfy a predicate.
+ * Dropping a large share of a tree with avl_tree_remove() rebalances once per
+ * item; this relinks the survivors into a new tree instead, in O(n) time
+ * however many items go.
+ *
+ * @keep
+ *	Called on each node in order, with @ctx; returns true to keep the item
+ *	in the tree.
+ *
+ * @drop
+ *	If not NULL, called with @ctx on each node @keep rejected, right after
+ *	it.  The node is no longer linked into anything then, so it may be
+ *	freed, but neither callback may access the tree.
+ *
+ * Returns the number of items left, which make a tree of minimum height.
+ *
+ * A tree with relaxed changes pending (see avl_tree.c) is rebalanced first
+ * with avl_tree_rebalance_pending(), since the walk below keeps its path on
+ * a stack of AVL_TREE_MAX_HEIGHT nodes.
+ *
+ * The tree is walked once, with a stack instead of parent pointers, so that
+ * each survivor can be linked into the new tree as soon as it is visited,
+ * while it is still in the cache.  Numbering the survivors from 1, survivor k
+ * goes at height h = ctz(k) of a perfect tree, with survivor k - 2^(h-1) as
+ * its left child; it is the right child of survivor k - 2^h if bit h + 1 of k
+ * is set, and otherwise the left child of a survivor yet to come.  Once the
+ * walk is over, the last survivor at each height h for which bit h of the
+ * count is set still lacks a parent: together with its left subtree it makes
+ * a piece of 2^h items, and the pieces are joined, smallest first.
+ */
+size_t
+avl_tree_filter(struct avl_tree_root *root,
+		bool (*keep)(const struct avl_tree_node *, void *),
+		void (*drop)(struct avl_tree_node *, void *),
+		void *ctx)
+{
+	struct avl_tree_node *last[AVL_TREE_MAX_HEIGHT];
+	struct avl_tree_stack_cursor cursor;
+	struct avl_tree_node *node, *next;
+	struct avl_tree_root piece;
+	size_t count = 0;
+	unsigned int h;
+
+	avl_tree_rebalance_pending(root);
+	for (node = avl_tree_stack_cursor_first(&cursor, root); node;
+	     node = next) {
+		/* Advancing reads the right pointer of @node, which is about
+		 * to change.  */
+		next = avl_tree_stack_cursor_next(&cursor);
+
+		if (!(*keep)(node, ctx)) {
+			if (drop)
+				(*drop)(node, ctx);
+			continue;
+		}
+
+		count++;
+		for (h = 0; !((count >> h) & 1); h++)
+			;
+		node->left = NULL;
+		node->right = NULL;
+		node->balance = 0;
+		if (h) {
+			node->left = last[h - 1];
+			node->left->parent = node;
+		}
+		if ((count >> (h + 1)) & 1) {
+			node->parent = last[h + 1];
+			last[h + 1]->right = node;
+		}
+		last[h] = node;
+	}
+
+	root->avl_tree_node = NULL;
+	for (h = 0; count >> h; h++) {
+		if ((count >> h) & 1) {
+			piece.avl_tree_node = last[h]->left;
+			avl_tree_join(root, &piece, last[h], root);
+		}
+	}
+	return count;
+}
+
+/* Empties an AVL tree without rebalancing, calling @release, if not NULL, on
+ * each node in postorder, so that it may free the node.  Takes O(n) time.  */
+void
+avl_tree_clear(struct avl_tree_root *root,
+	       void (*release)(struct avl_tree_node *))
+{
+	struct avl_tree_node *node, *next;
+
+	for (node = avl_tree_first_in_postorder(root); node; node = next) {
+		next = avl_tree_next_in_postorder(node, avl_get_parent(node));
+		if (release)
+			(*release)(node);
+	}
+	root->avl_tree_node = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree bulk construction
+ * ==========================
+ */
+
+#ifndef _AVL_BUILD_H
+#define _AVL_BUILD_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+avl_tree_build_sorted(struct avl_tree_root *root,
+                      struct avl_tree_node * const *nodes, size_t n);
+
+size_t
+avl_tree_build_parallel(struct avl_tree_root *root,
+                        struct avl_tree_node **nodes, size_t n,
+                        int (*cmp)(const struct avl_tree_node *,
+                                   const struct avl_tree_node *),
+                        unsigned int nthreads);
+
+void
+avl_tree_compact(struct avl_tree_root *root,
+                 struct avl_tree_node *(*relocate)(struct avl_tree_node *,
+                                                   void *),
+                 void (*release)(struct avl_tree_node *, void *),
+                 void *ctx);
+
+size_t
+avl_tree_filter(struct avl_tree_root *root,
+                bool (*keep)(const struct avl_tree_node *, void *),
+                void (*drop)(struct avl_tree_node *, void *),
+                void *ctx);
+
+void
+avl_tree_clear(struct avl_tree_root *root,
+               void (*release)(struct avl_tree_node *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_BUILD_H */
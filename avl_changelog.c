@@ -0,0 +1,300 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Change log of AVL tree updates
+ * ==============================
+ *
+ * Shipping a tree to a replica, or persisting it, by walking every item costs
+ * O(n) however little has changed.  A change log records each insertion,
+ * removal and replacement made through the avl_changelog_*() wrappers, tagged
+ * with the current epoch.  avl_tree_changes_since() then produces the net
+ * effect of all updates from a given epoch on, one entry per key in key order,
+ * in O(c log c) time for c records.
+ *
+ * A typical replication loop:
+ *
+ *	e = avl_changelog_advance(&log);
+ *	send a full copy of the tree (it includes every change before e)
+ *	...
+ *	next = avl_changelog_advance(&log);
+ *	avl_tree_changes_since(&log, e, cmp, send_change, ctx);
+ *	avl_changelog_trim(&log, next);
+ *	e = next;
+ *
+ * The log keeps pointers to the items, not copies.  An item which is removed
+ * or replaced must therefore stay readable, with its key unchanged, until its
+ * records are trimmed from the log.  Keys in the tree must be unique.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_changelog.h"
+
+#define AVL_CHANGELOG_MIN_CAPACITY	64
+
+typedef int (*avl_changelog_cmp_t)(const struct avl_tree_node *,
+				   const struct avl_tree_node *);
+
+/* Appends a record for the current epoch.  Returns false if memory could not
+ * be allocated, in which case the log is unchanged.  */
+static bool
+avl_changelog_append(struct avl_changelog *log, enum avl_change_op op,
+		     struct avl_tree_node *node, struct avl_tree_node *old)
+{
+	struct avl_change *c;
+
+	if (log->count == log->capacity) {
+		const size_t capacity = log->capacity ?
+					log->capacity * 2 :
+					AVL_CHANGELOG_MIN_CAPACITY;
+
+		c = realloc(log->changes, capacity * sizeof(c[0]));
+		if (!c)
+			return false;
+		log->changes = c;
+		log->capacity = capacity;
+	}
+
+	c = &log->changes[log->count++];
+	c->epoch = log->epoch;
+	c->op = op;
+	c->node = node;
+	c->old = old;
+	return true;
+}
+
+/*
+ * Frees the memory used by a change log.  The log can be reused after
+ * assigning AVL_CHANGELOG to it.
+ */
+void
+avl_changelog_destroy(struct avl_changelog *log)
+{
+	free(log->changes);
+	log->changes = NULL;
+	log->count = 0;
+	log->capacity = 0;
+}
+
+/*
+ * Starts a new epoch and returns its number.  Updates made from now on are
+ * recorded under the new epoch, so the returned value can be passed to
+ * avl_tree_changes_since() later to get everything that happened after this
+ * call.  Epochs of a new log start at 0.
+ */
+uint64_t
+avl_changelog_advance(struct avl_changelog *log)
+{
+	return ++log->epoch;
+}
+
+/* Returns the index of the first record of @epoch or later.  */
+static size_t
+avl_changelog_find_epoch(const struct avl_changelog *log, uint64_t epoch)
+{
+	size_t lo = 0, hi = log->count;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (log->changes[mid].epoch < epoch)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Drops all records made before @epoch.  The items removed or replaced in
+ * those epochs are no longer referenced by the log and may be freed.
+ */
+void
+avl_changelog_trim(struct avl_changelog *log, uint64_t epoch)
+{
+	const size_t drop = avl_changelog_find_epoch(log, epoch);
+
+	memmove(log->changes, log->changes + drop,
+		(log->count - drop) * sizeof(log->changes[0]));
+	log->count -= drop;
+}
+
+/*
+ * As avl_tree_link_node(), and records the insertion.
+ *
+ * Returns 0, or -1 if memory for the record could not be allocated.  In that
+ * case @node is not linked.
+ */
+int
+avl_changelog_link_node(struct avl_changelog *log, struct avl_tree_root *root,
+			struct avl_tree_link *link, struct avl_tree_node *node)
+{
+	if (!avl_changelog_append(log, AVL_CHANGE_INSERT, node, NULL))
+		return -1;
+	avl_tree_link_node(root, link, node);
+	return 0;
+}
+
+/*
+ * As avl_tree_remove(), and records the removal.
+ *
+ * Returns 0, or -1 if memory for the record could not be allocated.  In that
+ * case @node is not removed.
+ */
+int
+avl_changelog_remove(struct avl_changelog *log, struct avl_tree_root *root,
+		     struct avl_tree_node *node)
+{
+	if (!avl_changelog_append(log, AVL_CHANGE_REMOVE, node, NULL))
+		return -1;
+	avl_tree_remove(root, node);
+	return 0;
+}
+
+/*
+ * As avl_tree_replace(), and records the replacement.
+ *
+ * Returns 0, or -1 if memory for the record could not be allocated.  In that
+ * case @old_node is not replaced.
+ */
+int
+avl_changelog_replace(struct avl_changelog *log, struct avl_tree_root *root,
+		      struct avl_tree_node *old_node,
+		      struct avl_tree_node *new_node)
+{
+	if (!avl_changelog_append(log, AVL_CHANGE_REPLACE, new_node, old_node))
+		return -1;
+	avl_tree_replace(root, old_node, new_node);
+	return 0;
+}
+
+/* Stable bottom-up merge sort of a[0..n-1] by item key, using tmp[0..n-1] as
+ * scratch space.  Records of the same key stay in the order they were
+ * made.  */
+static void
+avl_changelog_sort(const struct avl_change **a, const struct avl_change **tmp,
+		   size_t n, avl_changelog_cmp_t cmp)
+{
+	for (size_t width = 1; width < n; width *= 2) {
+		for (size_t lo = 0; lo + width < n; lo += 2 * width) {
+			const size_t mid = lo + width;
+			const size_t hi = mid + width < n ? mid + width : n;
+			size_t i = lo, j = mid, k = 0;
+
+			if ((*cmp)(a[mid - 1]->node, a[mid]->node) <= 0)
+				continue;
+
+			while (i < mid && j < hi) {
+				if ((*cmp)(a[i]->node, a[j]->node) <= 0)
+					tmp[k++] = a[i++];
+				else
+					tmp[k++] = a[j++];
+			}
+			while (i < mid)
+				tmp[k++] = a[i++];
+			memcpy(a + lo, tmp, (j - lo) * sizeof(a[0]));
+		}
+	}
+}
+
+/*
+ * Computes the net changes made to a tree since an epoch.
+ *
+ * @log
+ *	The tree's change log.
+ *
+ * @epoch
+ *	Changes recorded in this epoch and later ones are included.
+ *
+ * @cmp
+ *	Comparison callback of the tree, as for avl_tree_insert().
+ *
+ * @visit
+ *	Called once for each key whose item changed, in increasing key order,
+ *	with @ctx as second argument.  Records of the same key are folded into
+ *	one change:
+ *
+ *	AVL_CHANGE_INSERT:  the key was absent and now has item @node.
+ *	AVL_CHANGE_REMOVE:  the key had item @node and is now absent.
+ *	AVL_CHANGE_REPLACE: the key had item @old and now has item @node.
+ *
+ *	Keys which were inserted and removed again are skipped.  The @epoch
+ *	member is that of the last record folded in.
+ *
+ * Returns 0, or -1 if temporary memory could not be allocated.
+ */
+int
+avl_tree_changes_since(const struct avl_changelog *log, uint64_t epoch,
+		       int (*cmp)(const struct avl_tree_node *,
+				  const struct avl_tree_node *),
+		       void (*visit)(const struct avl_change *, void *),
+		       void *ctx)
+{
+	const size_t first = avl_changelog_find_epoch(log, epoch);
+	const size_t n = log->count - first;
+	const struct avl_change **sorted;
+	size_t i, j;
+
+	if (n == 0)
+		return 0;
+
+	sorted = malloc(2 * n * sizeof(sorted[0]));
+	if (!sorted)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		sorted[i] = &log->changes[first + i];
+	avl_changelog_sort(sorted, sorted + n, n, cmp);
+
+	for (i = 0; i < n; i = j) {
+		const struct avl_change *head = sorted[i], *tail;
+		struct avl_change net;
+		bool existed, exists;
+
+		for (j = i + 1; j < n && (*cmp)(head->node,
+						sorted[j]->node) == 0; j++)
+			;
+		tail = sorted[j - 1];
+
+		existed = head->op != AVL_CHANGE_INSERT;
+		exists = tail->op != AVL_CHANGE_REMOVE;
+
+		net.epoch = tail->epoch;
+		if (existed && exists) {
+			net.op = AVL_CHANGE_REPLACE;
+			net.node = tail->node;
+			net.old = head->op == AVL_CHANGE_REPLACE ?
+				  head->old : head->node;
+		} else if (exists) {
+			net.op = AVL_CHANGE_INSERT;
+			net.node = tail->node;
+			net.old = NULL;
+		} else if (existed) {
+			net.op = AVL_CHANGE_REMOVE;
+			net.node = tail->node;
+			net.old = NULL;
+		} else {
+			continue;
+		}
+		(*visit)(&net, ctx);
+	}
+
+	free(sorted);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Change log of AVL tree updates
+ * ==============================
+ */
+
+#ifndef _AVL_CHANGELOG_H
+#define _AVL_CHANGELOG_H
+
+#include <stdint.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum avl_change_op {
+	AVL_CHANGE_INSERT,
+	AVL_CHANGE_REMOVE,
+	AVL_CHANGE_REPLACE,
+};
+
+struct avl_change {
+	uint64_t epoch;
+	enum avl_change_op op;
+	struct avl_tree_node *node;	/* inserted, removed or new item  */
+	struct avl_tree_node *old;	/* replaced item, or NULL  */
+};
+
+/* Records made by the avl_changelog_*() update functions, oldest first.  */
+struct avl_changelog {
+	struct avl_change *changes;
+	size_t count;
+	size_t capacity;
+	uint64_t epoch;			/* epoch of new records  */
+};
+
+#define AVL_CHANGELOG  (struct avl_changelog) {NULL, 0, 0, 0}
+
+void
+avl_changelog_destroy(struct avl_changelog *log);
+
+uint64_t
+avl_changelog_advance(struct avl_changelog *log);
+
+void
+avl_changelog_trim(struct avl_changelog *log, uint64_t epoch);
+
+int
+avl_changelog_link_node(struct avl_changelog *log, struct avl_tree_root *root,
+                        struct avl_tree_link *link, struct avl_tree_node *node);
+
+int
+avl_changelog_remove(struct avl_changelog *log, struct avl_tree_root *root,
+                     struct avl_tree_node *node);
+
+int
+avl_changelog_replace(struct avl_changelog *log, struct avl_tree_root *root,
+                      struct avl_tree_node *old_node,
+                      struct avl_tree_node *new_node);
+
+int
+avl_tree_changes_since(const struct avl_changelog *log, uint64_t epoch,
+                       int (*cmp)(const struct avl_tree_node *,
+                                  const struct avl_tree_node *),
+                       void (*visit)(const struct avl_change *, void *),
+                       void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_CHANGELOG_H */
@@ -0,0 +1,779 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree for concurrent readers and writers
+ * ===========================================
+ *
+ * This follows the optimistic relaxed-balance tree of Bronson, Casper, Chafi
+ * and Olukotun ("A Practical Concurrent Binary Search Tree", PPoPP 2010).
+ * Every node has its own lock and a version number that changes whenever
+ * keys move out of the subtree rooted at the node, which only happens when
+ * the node is rotated down, lies on the path to the successor of a removed
+ * node, or is itself removed.
+ *
+ * Searches take no locks.  They go down hand over hand: after reading a
+ * child pointer and the child's version, they check that the version of the
+ * node they came from did not change, so that the child's subtree still
+ * covers the key.  If it did change they back up one level and try again
+ * from there, not from the root.  A search that meets a node in the middle of
+ * a rotation or removal waits for it to finish, so searches are not
+ * wait-free, but they only ever wait for a writer holding the locks of the
+ * nodes it is changing.
+ *
+ * Writers lock only the nodes whose links they change: an insertion locks
+ * the new node's parent, a removal the node and its parent (see below for
+ * nodes with two children), and a rotation the parent of the rotated subtree
+ * and two or three of its nodes, always from the top down.  Changes to
+ * disjoint parts of the tree therefore run in parallel.  Rebalancing is
+ * relaxed: each writer fixes the heights and balance of the nodes it damaged,
+ * walking up with local rotations as in Bronson et al., so the tree is
+ * strictly balanced again whenever no writer is running.
+ *
+ * Bronson et al. turn a removed node with two children into a key-only
+ * routing node.  Intrusive nodes belong to the caller, so here the successor
+ * is moved into the removed node's place instead, under the locks of the path
+ * down to it, whose nodes are all marked as shrinking.
+ *
+ * Fields that other threads may be reading are accessed with atomic loads and
+ * stores.  Because searches may be running while a node is removed, a removed
+ * node must not be freed, reused or inserted again until every operation that
+ * started before the removal has returned (e.g. by deferring frees with an
+ * epoch or RCU scheme).  Keys of items must not change while the items are in
+ * the tree.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h>
+
+#include "avl_concurrent.h"
+
+/* Version bits.  The rest of the version counts completed shrinks.  */
+#define AVL_CTREE_UNLINKED		1UL
+#define AVL_CTREE_SHRINKING		2UL
+#define AVL_CTREE_SHRINK_COUNT		4UL
+
+/* Results of avl_ctree_condition() other than a new height  */
+#define AVL_CTREE_NOTHING		0
+#define AVL_CTREE_REBALANCE		-1
+
+/* Bound on the depth of a search.  The tree is never far from balanced, and
+ * an AVL tree of any size that fits in memory is far less deep than this.  */
+#define AVL_CTREE_MAX_DEPTH		128
+
+/* Spins on a node lock or version before yielding the CPU.  */
+#define AVL_CTREE_SPINS			256
+
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_child(const struct avl_ctree_node *node, int sign)
+{
+	return __atomic_load_n(sign < 0 ? &node->left : &node->right,
+			       __ATOMIC_ACQUIRE);
+}
+
+static AVL_INLINE void
+avl_ctree_set_child(struct avl_ctree_node *node, int sign,
+		    struct avl_ctree_node *child)
+{
+	__atomic_store_n(sign < 0 ? &node->left : &node->right, child,
+			 __ATOMIC_RELEASE);
+}
+
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_parent(const struct avl_ctree_node *node)
+{
+	return __atomic_load_n(&node->parent, __ATOMIC_ACQUIRE);
+}
+
+static AVL_INLINE void
+avl_ctree_set_parent(struct avl_ctree_node *node,
+		     struct avl_ctree_node *parent)
+{
+	__atomic_store_n(&node->parent, parent, __ATOMIC_RELEASE);
+}
+
+/* Replaces @node with @child among the children of @parent.  */
+static AVL_INLINE void
+avl_ctree_replace_child(struct avl_ctree_node *parent,
+			struct avl_ctree_node *node,
+			struct avl_ctree_node *child)
+{
+	avl_ctree_set_child(parent, avl_ctree_child(parent, -1) == node ?
+				    -1 : 1, child);
+}
+
+/* Returns the height of the subtree at @node, 0 if NULL.  */
+static AVL_INLINE int
+avl_ctree_height(const struct avl_ctree_node *node)
+{
+	return node ? __atomic_load_n(&node->height, __ATOMIC_RELAXED) : 0;
+}
+
+static AVL_INLINE void
+avl_ctree_set_height(struct avl_ctree_node *node, int height)
+{
+	__atomic_store_n(&node->height, height, __ATOMIC_RELAXED);
+}
+
+static AVL_INLINE unsigned long
+avl_ctree_version(const struct avl_ctree_node *node)
+{
+	return __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+}
+
+/* Checks, after some reads of the links of @node, that its version was still
+ * @version when they were made.  */
+static AVL_INLINE bool
+avl_ctree_validate(const struct avl_ctree_node *node, unsigned long version)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&node->version, __ATOMIC_RELAXED) == version;
+}
+
+/* Marks the start of a change that moves keys out of the subtree at @node,
+ * which must be locked.  */
+static AVL_INLINE void
+avl_ctree_begin_shrink(struct avl_ctree_node *node)
+{
+	const unsigned long version = __atomic_load_n(&node->version,
+						      __ATOMIC_RELAXED);
+
+	__atomic_store_n(&node->version, version | AVL_CTREE_SHRINKING,
+			 __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static AVL_INLINE void
+avl_ctree_end_shrink(struct avl_ctree_node *node)
+{
+	const unsigned long version = __atomic_load_n(&node->version,
+						      __ATOMIC_RELAXED);
+
+	__atomic_store_n(&node->version,
+			 (version & ~AVL_CTREE_SHRINKING) +
+			 AVL_CTREE_SHRINK_COUNT, __ATOMIC_RELEASE);
+}
+
+/* Waits for the change to @node that started at @version to finish.  */
+static void
+avl_ctree_wait_shrink(const struct avl_ctree_node *node,
+		      unsigned long version)
+{
+	if (version & AVL_CTREE_UNLINKED)
+		return;
+	for (;;) {
+		for (int spins = 0; spins < AVL_CTREE_SPINS; spins++)
+			if (avl_ctree_version(node) != version)
+				return;
+		sched_yield();
+	}
+}
+
+static AVL_INLINE void
+avl_ctree_lock(struct avl_ctree_node *node)
+{
+	while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE)) {
+		for (int spins = 0; spins < AVL_CTREE_SPINS; spins++)
+			if (!__atomic_load_n(&node->lock, __ATOMIC_RELAXED))
+				break;
+		if (__atomic_load_n(&node->lock, __ATOMIC_RELAXED))
+			sched_yield();
+	}
+}
+
+static AVL_INLINE void
+avl_ctree_unlock(struct avl_ctree_node *node)
+{
+	__atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Searches the tree for @key, without locking.  Exactly one of @ctx_cmp and
+ * @node_cmp must be non-NULL, and for all calls of this it is known at
+ * compilation time which one, so the compiler can remove the conditional.
+ *
+ * Returns the item equal to @key, if any.  Otherwise returns NULL and sets
+ * *@parent_ret and *@sign_ret to the node and side @key would be linked at,
+ * and *@version_ret to the version of that node the result is valid for.
+ */
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_search(struct avl_ctree *tree, const void *key,
+		 int (*ctx_cmp)(const void *, const struct avl_ctree_node *),
+		 int (*node_cmp)(const struct avl_ctree_node *,
+				 const struct avl_ctree_node *),
+		 struct avl_ctree_node **parent_ret, int *sign_ret,
+		 unsigned long *version_ret)
+{
+	struct avl_ctree_node *path[AVL_CTREE_MAX_DEPTH];
+	unsigned long versions[AVL_CTREE_MAX_DEPTH];
+	signed char signs[AVL_CTREE_MAX_DEPTH];
+	struct avl_ctree_node *node, *child;
+	unsigned long version, child_version;
+	int depth, sign, res;
+
+restart:
+	depth = 0;
+	node = &tree->holder;
+	version = avl_ctree_version(node);
+	sign = 1;
+	for (;;) {
+		child = avl_ctree_child(node, sign);
+		if (!child) {
+			if (!avl_ctree_validate(node, version))
+				goto back_up;
+			*parent_ret = node;
+			*sign_ret = sign;
+			*version_ret = version;
+			return NULL;
+		}
+
+		if (ctx_cmp)
+			res = (*ctx_cmp)(key, child);
+		else
+			res = (*node_cmp)(key, child);
+		if (res == 0)
+			return child;
+
+		/* The second read of the link is the one protected by
+		 * @child_version.  */
+		child_version = avl_ctree_version(child);
+		if (child_version &
+		    (AVL_CTREE_SHRINKING | AVL_CTREE_UNLINKED)) {
+			avl_ctree_wait_shrink(child, child_version);
+			if (!avl_ctree_validate(node, version))
+				goto back_up;
+			continue;
+		}
+		if (child != avl_ctree_child(node, sign)) {
+			if (!avl_ctree_validate(node, version))
+				goto back_up;
+			continue;
+		}
+		if (!avl_ctree_validate(node, version))
+			goto back_up;
+
+		/* The step to @child was valid when @node's version was
+		 * checked, so from now on only @child's version matters.  */
+		if (depth == AVL_CTREE_MAX_DEPTH)
+			goto restart;
+		path[depth] = node;
+		versions[depth] = version;
+		signs[depth] = sign;
+		depth++;
+		node = child;
+		version = child_version;
+		sign = res < 0 ? -1 : 1;
+		continue;
+
+	back_up:
+		/* Keys moved out of @node's subtree; retry the step that led
+		 * to it.  The holder never changes, so this stops there.  */
+		depth--;
+		node = path[depth];
+		version = versions[depth];
+		sign = signs[depth];
+	}
+}
+
+/*
+ * Returns what @node needs: AVL_CTREE_REBALANCE if its children's heights
+ * differ by more than one, else the height it should have if its own is
+ * wrong, else AVL_CTREE_NOTHING.  The heights are read without locking the
+ * children, but whoever changes a child is in charge of fixing its parent.
+ */
+static int
+avl_ctree_condition(const struct avl_ctree_node *node)
+{
+	const int left = avl_ctree_height(avl_ctree_child(node, -1));
+	const int right = avl_ctree_height(avl_ctree_child(node, 1));
+	const int height = 1 + (left > right ? left : right);
+
+	if (left - right > 1 || right - left > 1)
+		return AVL_CTREE_REBALANCE;
+	return height != avl_ctree_height(node) ? height : AVL_CTREE_NOTHING;
+}
+
+/* Fixes the height of @node, which must be locked.  Returns the next node to
+ * fix, if any: @node itself if it needs a rotation, or its parent if its
+ * height changed.  */
+static struct avl_ctree_node *
+avl_ctree_fix_height(struct avl_ctree_node *node)
+{
+	const int c = avl_ctree_condition(node);
+
+	if (c == AVL_CTREE_REBALANCE)
+		return node;
+	if (c == AVL_CTREE_NOTHING)
+		return NULL;
+	avl_ctree_set_height(node, c);
+	return avl_ctree_parent(node);
+}
+
+/*
+ * Rotates the subtree at @n so that its child @c on side @sign takes its
+ * place under @parent.  All three are locked.  @h_other is the height of the
+ * other child of @n, @h_outer that of the child of @c on side @sign, and
+ * @h_inner that of @inner, the child of @c on the other side, which moves
+ * under @n.
+ *
+ * The height of @parent is fixed too, while it is locked; the next node to
+ * fix above it, if any, is returned in *@up.  Returns the next node to fix
+ * below it, if any.
+ *
+ * This is a template function; @sign is known at compilation time.
+ */
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_rotate(struct avl_ctree_node *parent, struct avl_ctree_node *n,
+		 struct avl_ctree_node *c, int h_other, int h_outer,
+		 struct avl_ctree_node *inner, int h_inner,
+		 struct avl_ctree_node **up, const int sign)
+{
+	const int h_n = 1 + (h_inner > h_other ? h_inner : h_other);
+
+	/* @n loses @c and its outer subtree; @c only gains keys.  */
+	avl_ctree_begin_shrink(n);
+	avl_ctree_set_child(n, sign, inner);
+	if (inner)
+		avl_ctree_set_parent(inner, n);
+	avl_ctree_set_child(c, -sign, n);
+	avl_ctree_set_parent(n, c);
+	avl_ctree_replace_child(parent, n, c);
+	avl_ctree_set_parent(c, parent);
+	avl_ctree_set_height(n, h_n);
+	avl_ctree_set_height(c, 1 + (h_outer > h_n ? h_outer : h_n));
+	avl_ctree_end_shrink(n);
+
+	/* The heights of @n and @c were just fixed, but they may need a
+	 * rotation.  */
+	*up = avl_ctree_fix_height(parent);
+	if (h_inner - h_other < -1 || h_inner - h_other > 1)
+		return n;
+	if (h_outer - h_n < -1 || h_outer - h_n > 1)
+		return c;
+	return NULL;
+}
+
+/*
+ * Double rotation: @inner, the child of @n's child @c on the side opposite
+ * @sign, takes @n's place, with @c and @n as its children.  All four are
+ * locked.  @h_inner_outer is the height of the child of @inner that moves
+ * under @c.  Returns the next nodes to fix as avl_ctree_rotate() does.
+ *
+ * This is a template function; @sign is known at compilation time.
+ */
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_double_rotate(struct avl_ctree_node *parent,
+			struct avl_ctree_node *n, struct avl_ctree_node *c,
+			int h_other, int h_outer, struct avl_ctree_node *inner,
+			int h_inner_outer, struct avl_ctree_node **up,
+			const int sign)
+{
+	struct avl_ctree_node *inner_outer = avl_ctree_child(inner, sign);
+	struct avl_ctree_node *inner_inner = avl_ctree_child(inner, -sign);
+	const int h_inner_inner = avl_ctree_height(inner_inner);
+	const int h_n = 1 + (h_inner_inner > h_other ? h_inner_inner : h_other);
+	const int h_c = 1 + (h_outer > h_inner_outer ? h_outer : h_inner_outer);
+
+	avl_ctree_begin_shrink(n);
+	avl_ctree_begin_shrink(c);
+	avl_ctree_set_child(n, sign, inner_inner);
+	if (inner_inner)
+		avl_ctree_set_parent(inner_inner, n);
+	avl_ctree_set_child(c, -sign, inner_outer);
+	if (inner_outer)
+		avl_ctree_set_parent(inner_outer, c);
+	avl_ctree_set_child(inner, sign, c);
+	avl_ctree_set_parent(c, inner);
+	avl_ctree_set_child(inner, -sign, n);
+	avl_ctree_set_parent(n, inner);
+	avl_ctree_replace_child(parent, n, inner);
+	avl_ctree_set_parent(inner, parent);
+	avl_ctree_set_height(n, h_n);
+	avl_ctree_set_height(c, h_c);
+	avl_ctree_set_height(inner, 1 + (h_c > h_n ? h_c : h_n));
+	avl_ctree_end_shrink(n);
+	avl_ctree_end_shrink(c);
+
+	*up = avl_ctree_fix_height(parent);
+	if (h_inner_inner - h_other < -1 || h_inner_inner - h_other > 1)
+		return n;
+	if (h_c - h_n < -1 || h_c - h_n > 1)
+		return inner;
+	return NULL;
+}
+
+/*
+ * Rebalances @n, whose child @c on side @sign is too tall next to its other
+ * child, of height @h_other.  @parent and @n are locked.  As in Bronson et
+ * al., if a double rotation would leave @c unbalanced, @c is rebalanced on
+ * its own first, and @n later.  Returns the next nodes to fix as
+ * avl_ctree_rotate() does.
+ */
+static struct avl_ctree_node *
+avl_ctree_rebalance_side(struct avl_ctree_node *parent,
+			 struct avl_ctree_node *n, struct avl_ctree_node *c,
+			 int h_other, struct avl_ctree_node **up, int sign)
+{
+	struct avl_ctree_node *inner, *res;
+	int h_outer, h_inner, h_inner_outer;
+
+	avl_ctree_lock(c);
+	if (avl_ctree_height(c) - h_other <= 1) {
+		/* Out of date; look at @n again.  */
+		res = n;
+		goto out;
+	}
+
+	inner = avl_ctree_child(c, -sign);
+	h_outer = avl_ctree_height(avl_ctree_child(c, sign));
+	h_inner = avl_ctree_height(inner);
+	if (h_outer >= h_inner) {
+		res = sign < 0 ?
+		      avl_ctree_rotate(parent, n, c, h_other, h_outer,
+				       inner, h_inner, up, -1) :
+		      avl_ctree_rotate(parent, n, c, h_other, h_outer,
+				       inner, h_inner, up, 1);
+		goto out;
+	}
+
+	avl_ctree_lock(inner);
+	h_inner = avl_ctree_height(inner);
+	if (h_outer >= h_inner) {
+		res = sign < 0 ?
+		      avl_ctree_rotate(parent, n, c, h_other, h_outer,
+				       inner, h_inner, up, -1) :
+		      avl_ctree_rotate(parent, n, c, h_other, h_outer,
+				       inner, h_inner, up, 1);
+		avl_ctree_unlock(inner);
+		goto out;
+	}
+	h_inner_outer = avl_ctree_height(avl_ctree_child(inner, sign));
+	if (h_outer - h_inner_outer >= -1 && h_outer - h_inner_outer <= 1) {
+		res = sign < 0 ?
+		      avl_ctree_double_rotate(parent, n, c, h_other, h_outer,
+					      inner, h_inner_outer, up, -1) :
+		      avl_ctree_double_rotate(parent, n, c, h_other, h_outer,
+					      inner, h_inner_outer, up, 1);
+		avl_ctree_unlock(inner);
+		goto out;
+	}
+	avl_ctree_unlock(inner);
+	res = avl_ctree_rebalance_side(n, c, inner, h_outer, up, -sign);
+out:
+	avl_ctree_unlock(c);
+	return res;
+}
+
+/* Fixes the height or balance of @n, with @n and its parent @parent locked.
+ * Returns the next nodes to fix as avl_ctree_rotate() does.  */
+static struct avl_ctree_node *
+avl_ctree_rebalance(struct avl_ctree_node *parent, struct avl_ctree_node *n,
+		    struct avl_ctree_node **up)
+{
+	struct avl_ctree_node *left = avl_ctree_child(n, -1);
+	struct avl_ctree_node *right = avl_ctree_child(n, 1);
+	const int h_left = avl_ctree_height(left);
+	const int h_right = avl_ctree_height(right);
+	const int height = 1 + (h_left > h_right ? h_left : h_right);
+
+	if (h_left - h_right > 1)
+		return avl_ctree_rebalance_side(parent, n, left, h_right,
+						up, -1);
+	if (h_right - h_left > 1)
+		return avl_ctree_rebalance_side(parent, n, right, h_left,
+						up, 1);
+	if (height != avl_ctree_height(n)) {
+		avl_ctree_set_height(n, height);
+		*up = avl_ctree_fix_height(parent);
+	}
+	return NULL;
+}
+
+/*
+ * Fixes the heights and balance from @node up, as long as something changes.
+ * A rotation can leave damage both below and above it; the nodes above wait
+ * on a stack while the ones below are fixed.  No locks may be held.
+ */
+static void
+avl_ctree_fix(struct avl_ctree_node *node)
+{
+	struct avl_ctree_node *pending[AVL_CTREE_MAX_DEPTH];
+	struct avl_ctree_node *parent, *next, *up;
+	int npending = 0, c;
+
+	for (;;) {
+		if (!node || !(parent = avl_ctree_parent(node)) ||
+		    (c = avl_ctree_condition(node)) == AVL_CTREE_NOTHING ||
+		    (avl_ctree_version(node) & AVL_CTREE_UNLINKED)) {
+			if (!npending)
+				return;
+			node = pending[--npending];
+			continue;
+		}
+
+		up = NULL;
+		if (c != AVL_CTREE_REBALANCE) {
+			avl_ctree_lock(node);
+			next = avl_ctree_fix_height(node);
+			avl_ctree_unlock(node);
+		} else {
+			next = node;
+			avl_ctree_lock(parent);
+			if (!(avl_ctree_version(parent) & AVL_CTREE_UNLINKED) &&
+			    avl_ctree_parent(node) == parent) {
+				/* A removed node keeps its parent link.  */
+				avl_ctree_lock(node);
+				if (!(avl_ctree_version(node) &
+				      AVL_CTREE_UNLINKED))
+					next = avl_ctree_rebalance(parent,
+								   node, &up);
+				else
+					next = NULL;
+				avl_ctree_unlock(node);
+			}
+			avl_ctree_unlock(parent);
+		}
+
+		if (!next) {
+			next = up;
+		} else if (up) {
+			if (npending < AVL_CTREE_MAX_DEPTH)
+				pending[npending++] = up;
+			else
+				avl_ctree_fix(up);
+		}
+		node = next;
+	}
+}
+
+/* Unlinks @node, which has at most one child, from its parent @parent.  Both
+ * are locked.  Returns the next node to fix, if any.  */
+static struct avl_ctree_node *
+avl_ctree_splice(struct avl_ctree_node *parent, struct avl_ctree_node *node)
+{
+	struct avl_ctree_node *child = avl_ctree_child(node, -1);
+
+	if (!child)
+		child = avl_ctree_child(node, 1);
+	avl_ctree_replace_child(parent, node, child);
+	if (child)
+		avl_ctree_set_parent(child, parent);
+	__atomic_store_n(&node->version, AVL_CTREE_UNLINKED, __ATOMIC_RELEASE);
+	return avl_ctree_fix_height(parent);
+}
+
+/*
+ * Replaces @node, which has two children, with its in-order successor.
+ * @node and its parent @parent are locked.  The path from the right child of
+ * @node down to the successor is locked too, and its nodes marked as
+ * shrinking, since the successor's key moves out of their subtrees.  Returns
+ * the next node to fix, if any.  The successor, returned in *@succ_ret, needs
+ * fixing too: it takes over any damage to @node that another thread was going
+ * to fix.
+ */
+static struct avl_ctree_node *
+avl_ctree_swap(struct avl_ctree_node *parent, struct avl_ctree_node *node,
+	       struct avl_ctree_node **succ_ret)
+{
+	struct avl_ctree_node *right = avl_ctree_child(node, 1);
+	struct avl_ctree_node *succ = right, *succ_parent = node;
+	struct avl_ctree_node *next, *x;
+
+	avl_ctree_lock(right);
+	while ((next = avl_ctree_child(succ, -1))) {
+		avl_ctree_lock(next);
+		succ_parent = succ;
+		succ = next;
+	}
+
+	avl_ctree_begin_shrink(node);
+	for (x = right; x != succ; x = avl_ctree_child(x, -1))
+		avl_ctree_begin_shrink(x);
+
+	if (succ != right) {
+		next = avl_ctree_child(succ, 1);
+		avl_ctree_set_child(succ_parent, -1, next);
+		if (next)
+			avl_ctree_set_parent(next, succ_parent);
+		avl_ctree_set_child(succ, 1, right);
+		avl_ctree_set_parent(right, succ);
+	}
+	next = avl_ctree_child(node, -1);
+	avl_ctree_set_child(succ, -1, next);
+	avl_ctree_set_parent(next, succ);
+	avl_ctree_set_height(succ, avl_ctree_height(node));
+	avl_ctree_replace_child(parent, node, succ);
+	avl_ctree_set_parent(succ, parent);
+	__atomic_store_n(&node->version, AVL_CTREE_UNLINKED, __ATOMIC_RELEASE);
+
+	/* The successor is now above the path; unlock it last.  */
+	for (x = right; x != succ; x = next) {
+		next = x == succ_parent ? succ : avl_ctree_child(x, -1);
+		avl_ctree_end_shrink(x);
+		avl_ctree_unlock(x);
+	}
+	avl_ctree_unlock(succ);
+	*succ_ret = succ;
+	return succ_parent != node ? succ_parent : NULL;
+}
+
+/* Removes @node from the tree.  Returns false if another thread removed it
+ * first.  */
+static bool
+avl_ctree_unlink(struct avl_ctree_node *node)
+{
+	struct avl_ctree_node *parent, *damaged, *succ = NULL;
+
+	for (;;) {
+		if (avl_ctree_version(node) & AVL_CTREE_UNLINKED)
+			return false;
+		parent = avl_ctree_parent(node);
+		avl_ctree_lock(parent);
+		if (!(avl_ctree_version(parent) & AVL_CTREE_UNLINKED) &&
+		    avl_ctree_parent(node) == parent)
+			break;
+		avl_ctree_unlock(parent);
+	}
+
+	avl_ctree_lock(node);
+	if (avl_ctree_version(node) & AVL_CTREE_UNLINKED) {
+		avl_ctree_unlock(node);
+		avl_ctree_unlock(parent);
+		return false;
+	}
+	if (avl_ctree_child(node, -1) && avl_ctree_child(node, 1))
+		damaged = avl_ctree_swap(parent, node, &succ);
+	else
+		damaged = avl_ctree_splice(parent, node);
+	avl_ctree_unlock(node);
+	avl_ctree_unlock(parent);
+
+	avl_ctree_fix(damaged);
+	avl_ctree_fix(succ);
+	return true;
+}
+
+/* Initializes an empty concurrent AVL tree.  */
+void
+avl_ctree_init(struct avl_ctree *tree)
+{
+	tree->holder = (struct avl_ctree_node) {NULL, NULL, NULL, 0, 0, 0};
+}
+
+/* Same as avl_tree_lookup(), but may run concurrently with any other
+ * avl_ctree_*() call.  */
+struct avl_ctree_node *
+avl_ctree_lookup(struct avl_ctree *tree,
+		 const void *cmp_ctx,
+		 int (*cmp)(const void *, const struct avl_ctree_node *))
+{
+	struct avl_ctree_node *parent;
+	unsigned long version;
+	int sign;
+
+	return avl_ctree_search(tree, cmp_ctx, cmp, NULL,
+				&parent, &sign, &version);
+}
+
+/* Same as avl_tree_lookup_node(), but may run concurrently with any other
+ * avl_ctree_*() call.  */
+struct avl_ctree_node *
+avl_ctree_lookup_node(struct avl_ctree *tree,
+		      const struct avl_ctree_node *node,
+		      int (*cmp)(const struct avl_ctree_node *,
+				 const struct avl_ctree_node *))
+{
+	struct avl_ctree_node *parent;
+	unsigned long version;
+	int sign;
+
+	return avl_ctree_search(tree, node, NULL, cmp,
+				&parent, &sign, &version);
+}
+
+/* Same as avl_tree_insert(), but may run concurrently with any other
+ * avl_ctree_*() call.  Only the new item's parent is locked.  */
+struct avl_ctree_node *
+avl_ctree_insert(struct avl_ctree *tree,
+		 struct avl_ctree_node *item,
+		 int (*cmp)(const struct avl_ctree_node *,
+			    const struct avl_ctree_node *))
+{
+	struct avl_ctree_node *found, *parent, *damaged;
+	unsigned long version;
+	int sign;
+
+	item->left = NULL;
+	item->right = NULL;
+	item->version = 0;
+	item->height = 1;
+	item->lock = 0;
+
+	for (;;) {
+		found = avl_ctree_search(tree, item, NULL, cmp,
+					 &parent, &sign, &version);
+		if (found)
+			return found;
+
+		/* The search's result holds as long as @parent's version
+		 * does, and the lock keeps it from changing now.  */
+		avl_ctree_lock(parent);
+		if (avl_ctree_version(parent) == version &&
+		    !avl_ctree_child(parent, sign))
+			break;
+		avl_ctree_unlock(parent);
+	}
+
+	item->parent = parent;
+	avl_ctree_set_child(parent, sign, item);
+	damaged = avl_ctree_fix_height(parent);
+	avl_ctree_unlock(parent);
+
+	avl_ctree_fix(damaged);
+	return NULL;
+}
+
+/* Same as avl_tree_remove(), but may run concurrently with any other
+ * avl_ctree_*() call.  See the top of this file about freeing @node.  */
+void
+avl_ctree_remove(struct avl_ctree *tree, struct avl_ctree_node *node)
+{
+	/* @tree is implied by @node.  */
+	(void)tree;
+	avl_ctree_unlink(node);
+}
+
+/* Same as avl_tree_remove_key(), but may run concurrently with any other
+ * avl_ctree_*() call.  See the top of this file about freeing the removed
+ * node.  */
+struct avl_ctree_node *
+avl_ctree_remove_key(struct avl_ctree *tree,
+		     const void *cmp_ctx,
+		     int (*cmp)(const void *, const struct avl_ctree_node *))
+{
+	struct avl_ctree_node *found, *parent;
+	unsigned long version;
+	int sign;
+
+	do {
+		found = avl_ctree_search(tree, cmp_ctx, cmp, NULL,
+					 &parent, &sign, &version);
+	} while (found && !avl_ctree_unlink(found));
+
+	return found;
+}
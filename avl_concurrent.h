@@ -0,0 +1,104 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree for concurrent readers and writers
+ * ===========================================
+ */
+
+#ifndef _AVL_CONCURRENT_H
+#define _AVL_CONCURRENT_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __GNUC__
+#  error "avl_concurrent requires GCC-compatible __atomic builtins"
+#endif
+
+/* Node in a concurrent AVL tree.  Embed this in some other data structure.
+ * All fields are owned by the tree; they are read and written atomically,
+ * since lookups run concurrently with changes.  */
+struct avl_ctree_node {
+	struct avl_ctree_node *left;
+	struct avl_ctree_node *right;
+	struct avl_ctree_node *parent;
+
+	/* Changes whenever keys move out of the subtree rooted here  */
+	unsigned long version;
+
+	/* Height of the subtree, as last fixed  */
+	int height;
+
+	/* Held while the node's links are changed  */
+	int lock;
+};
+
+/* An AVL tree shared by several threads.  Lookups take no locks, and writers
+ * only lock the few nodes they change, so updates to disjoint parts of the
+ * tree proceed in parallel.  */
+struct avl_ctree {
+	/* Sentinel above the root, which is its right child  */
+	struct avl_ctree_node holder;
+};
+
+#define avl_ctree_entry(entry, type, member) \
+	avl_tree_entry(entry, type, member)
+
+void
+avl_ctree_init(struct avl_ctree *tree);
+
+/* Returns the root of the tree, for use once no other thread uses it.  */
+static AVL_INLINE struct avl_ctree_node *
+avl_ctree_root(const struct avl_ctree *tree)
+{
+	return tree->holder.right;
+}
+
+struct avl_ctree_node *
+avl_ctree_lookup(struct avl_ctree *tree,
+                 const void *cmp_ctx,
+                 int (*cmp)(const void *, const struct avl_ctree_node *));
+
+struct avl_ctree_node *
+avl_ctree_lookup_node(struct avl_ctree *tree,
+                      const struct avl_ctree_node *node,
+                      int (*cmp)(const struct avl_ctree_node *,
+                                 const struct avl_ctree_node *));
+
+struct avl_ctree_node *
+avl_ctree_insert(struct avl_ctree *tree,
+                 struct avl_ctree_node *item,
+                 int (*cmp)(const struct avl_ctree_node *,
+                            const struct avl_ctree_node *));
+
+void
+avl_ctree_remove(struct avl_ctree *tree, struct avl_ctree_node *node);
+
+struct avl_ctree_node *
+avl_ctree_remove_key(struct avl_ctree *tree,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_ctree_node *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_CONCURRENT_H */
@@ -0,0 +1,221 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree cursors
+ * ================
+ *
+ * The in-order iteration macros do not allow the tree to change under them.
+ * A `struct avl_tree_cursor' does allow removing the node it is on: since
+ * avl_tree_remove() relinks nodes rather than moving items between them, the
+ * in-order successor looked up before the removal is still the successor
+ * afterwards.  A filtering sweep can therefore run as a single ordered pass:
+ *
+ *	struct avl_tree_cursor cursor;
+ *	struct avl_tree_node *node;
+ *
+ *	avl_tree_cursor_init(&cursor, &root);
+ *	node = avl_tree_cursor_seek(&cursor, &lo, cmp);
+ *	while (node && (*cmp)(&hi, node) > 0) {
+ *		if (expired(node)) {
+ *			avl_tree_cursor_remove(&cursor);
+ *			free_item(node);
+ *			node = avl_tree_cursor_node(&cursor);
+ *		} else {
+ *			node = avl_tree_cursor_next(&cursor);
+ *		}
+ *	}
+ *
+ * Other changes to the tree, made through other cursors or directly, only
+ * invalidate the cursors positioned on a node that is removed or replaced.
+ */
+
+#include "avl_cursor.h"
+#include "avl_generic.h"
+#include "avl_traversal.h"
+
+/* Sets up a cursor on @root.  It starts past the end.  */
+void
+avl_tree_cursor_init(struct avl_tree_cursor *cursor,
+		     struct avl_tree_root *root)
+{
+	cursor->root = root;
+	cursor->node = NULL;
+}
+
+/* Moves the cursor to the first node and returns it, or NULL if the tree is
+ * empty.  */
+struct avl_tree_node *
+avl_tree_cursor_first(struct avl_tree_cursor *cursor)
+{
+	return cursor->node = avl_tree_first_in_order(cursor->root);
+}
+
+/* Moves the cursor to the last node and returns it, or NULL if the tree is
+ * empty.  */
+struct avl_tree_node *
+avl_tree_cursor_last(struct avl_tree_cursor *cursor)
+{
+	return cursor->node = avl_tree_last_in_order(cursor->root);
+}
+
+/* Moves the cursor to the first node not less than @cmp_ctx, as for
+ * avl_tree_lower_bound(), and returns it, or NULL if there is none.  */
+struct avl_tree_node *
+avl_tree_cursor_seek(struct avl_tree_cursor *cursor,
+		     const void *cmp_ctx,
+		     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	return cursor->node = avl_tree_lower_bound(cursor->root, cmp_ctx, cmp);
+}
+
+/* Moves the cursor to the next node and returns it, or NULL past the last
+ * node.  Past the end, this does nothing.  */
+struct avl_tree_node *
+avl_tree_cursor_next(struct avl_tree_cursor *cursor)
+{
+	if (cursor->node)
+		cursor->node = avl_tree_next_in_order(cursor->node);
+	return cursor->node;
+}
+
+/* Moves the cursor to the previous node and returns it, or NULL before the
+ * first node, which is the same position as past the end.  Past the end, this
+ * moves the cursor to the last node, so that a walk backwards can start where
+ * a walk forwards ended.  */
+struct avl_tree_node *
+avl_tree_cursor_prev(struct avl_tree_cursor *cursor)
+{
+	if (cursor->node)
+		cursor->node = avl_tree_prev_in_order(cursor->node);
+	else
+		cursor->node = avl_tree_last_in_order(cursor->root);
+	return cursor->node;
+}
+
+/*
+ * Removes the current node from the tree, as with avl_tree_remove(), and moves
+ * the cursor to its successor.  Returns the removed node, or NULL if the
+ * cursor was past the end.
+ */
+struct avl_tree_node *
+avl_tree_cursor_remove(struct avl_tree_cursor *cursor)
+{
+	struct avl_tree_node *node = cursor->node;
+
+	if (!node)
+		return NULL;
+
+	cursor->node = avl_tree_next_in_order(node);
+	avl_tree_remove(cursor->root, node);
+	return node;
+}
+
+/*
+ * Stack-based cursors
+ * ===================
+ *
+ * avl_tree_next_in_order() climbs back up through parent pointers after each
+ * right subtree, reading every ancestor again.  A
+ * `struct avl_tree_stack_cursor' remembers the ancestors it still has to visit
+ * on a stack inside the cursor instead, so a full scan reads each node once,
+ * and it never reads the parent pointers.  While a node is visited, its right
+ * subtree, which is visited next, is prefetched.
+ *
+ * The stack holds AVL_TREE_MAX_HEIGHT nodes, enough for any AVL tree, but not
+ * for a tree with relaxed changes pending (see avl_tree.c), whose paths can
+ * be as long as it has nodes.  A cursor which runs out of stack empties
+ * itself and reports the end of the tree, rather than write past the stack.
+ */
+
+#ifdef __GNUC__
+#  define avl_prefetch(addr)  __builtin_prefetch(addr)
+#else
+#  define avl_prefetch(addr)  ((void)(addr))
+#endif
+
+/* Pushes @node and its chain of left children, and returns the new current
+ * node.  */
+static AVL_INLINE struct avl_tree_node *
+avl_stack_push_left(struct avl_tree_stack_cursor *cursor,
+		    struct avl_tree_node *node)
+{
+	while (node) {
+		if (cursor->depth == AVL_TREE_MAX_HEIGHT) {
+			cursor->depth = 0;
+			return NULL;
+		}
+		cursor->stack[cursor->depth++] = node;
+		node = node->left;
+	}
+	if (!cursor->depth)
+		return NULL;
+
+	node = cursor->stack[cursor->depth - 1];
+	avl_prefetch(node->right);
+	return node;
+}
+
+/* Positions the cursor at the first node of the tree and returns it, or NULL
+ * if the tree is empty.  */
+struct avl_tree_node *
+avl_tree_stack_cursor_first(struct avl_tree_stack_cursor *cursor,
+			    const struct avl_tree_root *root)
+{
+	cursor->depth = 0;
+	return avl_stack_push_left(cursor, root->avl_tree_node);
+}
+
+/* Positions the cursor at the first node not less than @cmp_ctx, as for
+ * avl_tree_lower_bound(), and returns it, or NULL if there is none.  */
+struct avl_tree_node *
+avl_tree_stack_cursor_seek(struct avl_tree_stack_cursor *cursor,
+			   const struct avl_tree_root *root,
+			   const void *cmp_ctx,
+			   int (*cmp)(const void *,
+				      const struct avl_tree_node *))
+{
+	struct avl_tree_node *cur = root->avl_tree_node;
+
+	/* Only the nodes at which the search turns left are visited later;
+	 * the last of them is the lower bound.  */
+	cursor->depth = 0;
+	while (cur) {
+		if ((*cmp)(cmp_ctx, cur) > 0) {
+			cur = cur->right;
+		} else {
+			if (cursor->depth == AVL_TREE_MAX_HEIGHT) {
+				cursor->depth = 0;
+				return NULL;
+			}
+			cursor->stack[cursor->depth++] = cur;
+			cur = cur->left;
+		}
+	}
+	return avl_stack_push_left(cursor, NULL);
+}
+
+/* Moves the cursor to the next node and returns it, or NULL past the last
+ * node.  */
+struct avl_tree_node *
+avl_tree_stack_cursor_next(struct avl_tree_stack_cursor *cursor)
+{
+	if (!cursor->depth)
+		return NULL;
+	return avl_stack_push_left(cursor,
+				   cursor->stack[--cursor->depth]->right);
+}
@@ -0,0 +1,98 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree cursors
+ * ================
+ */
+
+#ifndef _AVL_CURSOR_H
+#define _AVL_CURSOR_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Position in an AVL tree which survives removal of the current node.  */
+struct avl_tree_cursor {
+	struct avl_tree_root *root;
+
+	/* Current node, or NULL if the cursor is past the end, which is also
+	 * where stepping back from the first node leaves it  */
+	struct avl_tree_node *node;
+};
+
+#define avl_tree_cursor_node(cursor)  ((cursor)->node)
+
+void
+avl_tree_cursor_init(struct avl_tree_cursor *cursor,
+                     struct avl_tree_root *root);
+
+struct avl_tree_node *
+avl_tree_cursor_first(struct avl_tree_cursor *cursor);
+
+struct avl_tree_node *
+avl_tree_cursor_last(struct avl_tree_cursor *cursor);
+
+struct avl_tree_node *
+avl_tree_cursor_seek(struct avl_tree_cursor *cursor,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_tree_cursor_next(struct avl_tree_cursor *cursor);
+
+struct avl_tree_node *
+avl_tree_cursor_prev(struct avl_tree_cursor *cursor);
+
+struct avl_tree_node *
+avl_tree_cursor_remove(struct avl_tree_cursor *cursor);
+
+/* Forward cursor which keeps the path from the root on a stack instead of
+ * following parent pointers.  The tree may not be modified while it is in
+ * use, and must not have relaxed changes pending; on such a tree the cursor
+ * may end the walk early.  See avl_cursor.c.  */
+struct avl_tree_stack_cursor {
+	/* Nodes whose left subtree is being visited, the current one last  */
+	struct avl_tree_node *stack[AVL_TREE_MAX_HEIGHT];
+	unsigned int depth;
+};
+
+#define avl_tree_stack_cursor_node(cursor) \
+	((cursor)->depth ? (cursor)->stack[(cursor)->depth - 1] : NULL)
+
+struct avl_tree_node *
+avl_tree_stack_cursor_first(struct avl_tree_stack_cursor *cursor,
+                            const struct avl_tree_root *root);
+
+struct avl_tree_node *
+avl_tree_stack_cursor_seek(struct avl_tree_stack_cursor *cursor,
+                           const struct avl_tree_root *root,
+                           const void *cmp_ctx,
+                           int (*cmp)(const void *,
+                                      const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_tree_stack_cursor_next(struct avl_tree_stack_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_CURSOR_H */
@@ -0,0 +1,476 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Ordered diff of two AVL trees
+ * =============================
+ *
+ * Both trees are walked in key order side by side, as in the merge step of a
+ * merge sort, with one comparison per step.
+ *
+ * The trees are intrusive, so an item can only be linked into one of them and
+ * the two never share nodes.  Plain nodes carry nothing about their subtree,
+ * so avl_tree_diff() always visits every item of both trees.  What can be
+ * done is spreading that work over several threads: the first tree is split
+ * into key ranges with avl_tree_partition(), the matching ranges of the second
+ * tree are found with a binary search each, and the pairs of ranges are then
+ * compared independently.
+ *
+ * Trees of `struct avl_diff_node' can do better.  Each item has a hash, and
+ * each node caches the digest of its subtree, the sum of the hashes in it,
+ * which avl_diff_update() keeps up to date through the augmented functions of
+ * avl_tree.c.  A sum does not depend on the shape of the tree, so the digest
+ * of any key range of the second tree follows from O(log m) nodes, and
+ * avl_tree_diff_digest() skips each subtree of the first tree whose digest
+ * matches that of the same range in the second.  It descends only towards the
+ * differences, which takes O(d log n log m) time for d of them instead of
+ * O(n + m).  Different items with colliding hashes can hide a difference, so
+ * hashes should mix all of what @equal compares into 64 bits.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "avl_diff.h"
+#include "avl_partition.h"
+#include "avl_traversal.h"
+
+typedef int (*avl_diff_cmp_t)(const struct avl_tree_node *,
+			      const struct avl_tree_node *);
+typedef bool (*avl_diff_equal_t)(const struct avl_tree_node *,
+				 const struct avl_tree_node *);
+
+struct avl_diff_job {
+	struct avl_tree_range a, b;
+	avl_diff_cmp_t cmp;
+	avl_diff_equal_t equal;
+	const struct avl_diff_callbacks *cb;
+	size_t differences;
+	pthread_t thread;
+	bool started;
+};
+
+/* Compares range @a of the first tree with range @b of the second one.  */
+static void *
+avl_diff_thread(void *arg)
+{
+	struct avl_diff_job *job = arg;
+	const struct avl_diff_callbacks *cb = job->cb;
+	struct avl_tree_node *x = job->a.first, *y = job->b.first;
+	size_t differences = 0;
+
+	while (x != job->a.end && y != job->b.end) {
+		const int res = (*job->cmp)(x, y);
+
+		if (res < 0) {
+			if (cb->only_a)
+				(*cb->only_a)(x, cb->ctx);
+			differences++;
+			x = avl_tree_next_in_order(x);
+		} else if (res > 0) {
+			if (cb->only_b)
+				(*cb->only_b)(y, cb->ctx);
+			differences++;
+			y = avl_tree_next_in_order(y);
+		} else {
+			if (job->equal && !(*job->equal)(x, y)) {
+				if (cb->changed)
+					(*cb->changed)(x, y, cb->ctx);
+				differences++;
+			}
+			x = avl_tree_next_in_order(x);
+			y = avl_tree_next_in_order(y);
+		}
+	}
+
+	for (; x != job->a.end; x = avl_tree_next_in_order(x), differences++)
+		if (cb->only_a)
+			(*cb->only_a)(x, cb->ctx);
+
+	for (; y != job->b.end; y = avl_tree_next_in_order(y), differences++)
+		if (cb->only_b)
+			(*cb->only_b)(y, cb->ctx);
+
+	job->differences = differences;
+	return NULL;
+}
+
+/* Returns the first node of the tree not less than @key, a node of the other
+ * tree, or NULL.  */
+static struct avl_tree_node *
+avl_diff_lower_bound(const struct avl_tree_root *root,
+		     const struct avl_tree_node *key, avl_diff_cmp_t cmp)
+{
+	struct avl_tree_node *cur = root->avl_tree_node, *result = NULL;
+
+	while (cur) {
+		if ((*cmp)(key, cur) > 0) {
+			cur = cur->right;
+		} else {
+			result = cur;
+			cur = cur->left;
+		}
+	}
+	return result;
+}
+
+/*
+ * Finds the differences between two AVL trees.
+ *
+ * @a, @b
+ *	Roots of the trees to compare.  Neither may be modified until this
+ *	returns.  Keys must be unique within each tree.
+ *
+ * @cmp
+ *	Comparison callback, as for avl_tree_insert().  It is passed a node of
+ *	@a first and a node of @b second.
+ *
+ * @equal
+ *	Called on each pair of items with the same key to decide whether they
+ *	differ otherwise, or NULL to only compare keys.
+ *
+ * @cb
+ *	Callbacks for the differences, which are reported in key order.
+ *
+ * Returns the number of differences, that is the number of keys present in
+ * only one of the trees plus the number of pairs for which @equal returned
+ * false.  Takes O(n + m) time for trees of n and m items.
+ */
+size_t
+avl_tree_diff(const struct avl_tree_root *a, const struct avl_tree_root *b,
+	      int (*cmp)(const struct avl_tree_node *,
+			 const struct avl_tree_node *),
+	      bool (*equal)(const struct avl_tree_node *,
+			    const struct avl_tree_node *),
+	      const struct avl_diff_callbacks *cb)
+{
+	struct avl_diff_job job = {
+		.a = { avl_tree_first_in_order(a), NULL },
+		.b = { avl_tree_first_in_order(b), NULL },
+		.cmp = cmp,
+		.equal = equal,
+		.cb = cb,
+	};
+
+	avl_diff_thread(&job);
+	return job.differences;
+}
+
+/*
+ * As avl_tree_diff(), but using several threads.
+ *
+ * @nranges
+ *	Number of key ranges to split the work into, as for
+ *	avl_tree_reduce_parallel().  Each range is compared by its own thread,
+ *	the first one by the calling thread.
+ *
+ * The callbacks are called from several threads at once, each thread
+ * reporting the differences of its own range in key order.  @equal and @cmp
+ * must be safe to call concurrently, too.
+ *
+ * Returns the number of differences.  If memory cannot be allocated or threads
+ * cannot be started, the work is done by the calling thread instead.
+ */
+size_t
+avl_tree_diff_parallel(const struct avl_tree_root *a,
+		       const struct avl_tree_root *b,
+		       int (*cmp)(const struct avl_tree_node *,
+				  const struct avl_tree_node *),
+		       bool (*equal)(const struct avl_tree_node *,
+				     const struct avl_tree_node *),
+		       const struct avl_diff_callbacks *cb,
+		       unsigned int nranges)
+{
+	struct avl_tree_range *ranges;
+	struct avl_diff_job *jobs;
+	size_t differences = 0;
+	unsigned int count, i;
+
+	if (nranges <= 1 || !a->avl_tree_node)
+		return avl_tree_diff(a, b, cmp, equal, cb);
+
+	ranges = malloc(nranges * sizeof(ranges[0]));
+	jobs = malloc(nranges * sizeof(jobs[0]));
+	if (!ranges || !jobs) {
+		free(ranges);
+		free(jobs);
+		return avl_tree_diff(a, b, cmp, equal, cb);
+	}
+
+	count = avl_tree_partition(a, ranges, nranges);
+
+	/* Range i of @b holds the keys from the first key of range i of @a up
+	 * to the first key of range i + 1.  The first range also takes the
+	 * keys of @b below all keys of @a.  */
+	for (i = 0; i < count; i++) {
+		jobs[i].a = ranges[i];
+		jobs[i].b.first = i == 0 ? avl_tree_first_in_order(b) :
+					   jobs[i - 1].b.end;
+		jobs[i].b.end = ranges[i].end ?
+				avl_diff_lower_bound(b, ranges[i].end, cmp) :
+				NULL;
+		jobs[i].cmp = cmp;
+		jobs[i].equal = equal;
+		jobs[i].cb = cb;
+		jobs[i].started = i > 0 &&
+			pthread_create(&jobs[i].thread, NULL,
+				       avl_diff_thread, &jobs[i]) == 0;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!jobs[i].started)
+			avl_diff_thread(&jobs[i]);
+
+	for (i = 0; i < count; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		differences += jobs[i].differences;
+	}
+
+	free(jobs);
+	free(ranges);
+	return differences;
+}
+
+/*
+ * Digest trees
+ * ============
+ */
+
+static AVL_INLINE struct avl_diff_node *
+avl_diff_node(const struct avl_tree_node *node)
+{
+	return avl_tree_entry(node, struct avl_diff_node, node);
+}
+
+/* Returns the digest of the subtree rooted at @node, which may be NULL.  */
+static AVL_INLINE uint64_t
+avl_diff_digest(const struct avl_tree_node *node)
+{
+	return node ? avl_diff_node(node)->digest : 0;
+}
+
+/* The augmented tree callback of digest trees: recomputes the digest of
+ * @node.  Pass it to the augmented functions of avl_tree.h to join, split or
+ * otherwise change a digest tree.  */
+void
+avl_diff_update(struct avl_tree_node *node)
+{
+	avl_diff_node(node)->digest = avl_diff_node(node)->hash +
+				      avl_diff_digest(node->left) +
+				      avl_diff_digest(node->right);
+}
+
+/* Same as avl_tree_link_node(), for a digest tree.  @item->hash must be set.
+ * Takes O(log n) time.  */
+void
+avl_diff_link_node(struct avl_tree_root *root, struct avl_tree_link *link,
+		   struct avl_diff_node *item)
+{
+	item->node.parent = link->parent;
+	item->node.balance = 0;
+	item->node.left = NULL;
+	item->node.right = NULL;
+	*link->node = &item->node;
+	avl_tree_rebalance_after_insert_augmented(root, &item->node,
+						  avl_diff_update);
+}
+
+/* Same as avl_tree_remove(), for a digest tree.  */
+void
+avl_diff_remove(struct avl_tree_root *root, struct avl_diff_node *item)
+{
+	avl_tree_remove_augmented(root, &item->node, avl_diff_update);
+}
+
+/* Changes the hash of @item, which is in a digest tree, after the item itself
+ * has changed.  Takes O(log n) time.  */
+void
+avl_diff_set_hash(struct avl_diff_node *item, uint64_t hash)
+{
+	const uint64_t delta = hash - item->hash;
+	struct avl_tree_node *node;
+
+	item->hash = hash;
+	for (node = &item->node; node; node = avl_get_parent(node))
+		avl_diff_node(node)->digest += delta;
+}
+
+struct avl_diff_digest_ctx {
+	const struct avl_tree_root *b;
+	avl_diff_cmp_t cmp;
+	avl_diff_equal_t equal;
+	const struct avl_diff_callbacks *cb;
+	size_t differences;
+};
+
+/* Returns the sum of the hashes of the items of @root which sort before @key,
+ * a node of the other tree, and also of those equal to it if @inclusive.  */
+static uint64_t
+avl_diff_digest_below(const struct avl_tree_root *root,
+		      const struct avl_tree_node *key, avl_diff_cmp_t cmp,
+		      bool inclusive)
+{
+	const struct avl_tree_node *cur = root->avl_tree_node;
+	uint64_t sum = 0;
+
+	while (cur) {
+		const int res = (*cmp)(key, cur);
+
+		if (res > 0 || (res == 0 && inclusive)) {
+			sum += avl_diff_node(cur)->hash +
+			       avl_diff_digest(cur->left);
+			cur = cur->right;
+		} else {
+			cur = cur->left;
+		}
+	}
+	return sum;
+}
+
+/* Returns the digest of the items of the second tree strictly between @lo and
+ * @hi, nodes of the first tree or NULL for no bound.  */
+static uint64_t
+avl_diff_range_digest(const struct avl_diff_digest_ctx *ctx,
+		      const struct avl_tree_node *lo,
+		      const struct avl_tree_node *hi)
+{
+	uint64_t digest = hi ? avl_diff_digest_below(ctx->b, hi, ctx->cmp,
+						     false) :
+			       avl_diff_digest(ctx->b->avl_tree_node);
+
+	if (lo)
+		digest -= avl_diff_digest_below(ctx->b, lo, ctx->cmp, true);
+	return digest;
+}
+
+/* Returns the node of the second tree with the same key as @key, or NULL.  */
+static struct avl_tree_node *
+avl_diff_lookup(const struct avl_diff_digest_ctx *ctx,
+		const struct avl_tree_node *key)
+{
+	struct avl_tree_node *cur = ctx->b->avl_tree_node;
+
+	while (cur) {
+		const int res = (*ctx->cmp)(key, cur);
+
+		if (res < 0)
+			cur = cur->left;
+		else if (res > 0)
+			cur = cur->right;
+		else
+			break;
+	}
+	return cur;
+}
+
+/* Reports the items of the second tree strictly between @lo and @hi as only
+ * in it.  */
+static void
+avl_diff_only_b_between(struct avl_diff_digest_ctx *ctx,
+			const struct avl_tree_node *lo,
+			const struct avl_tree_node *hi)
+{
+	const struct avl_diff_callbacks *cb = ctx->cb;
+	struct avl_tree_node *cur = ctx->b->avl_tree_node, *y = NULL;
+
+	/* Find the first item after @lo.  */
+	if (!lo) {
+		y = avl_tree_first_in_order(ctx->b);
+	} else {
+		while (cur) {
+			if ((*ctx->cmp)(lo, cur) < 0) {
+				y = cur;
+				cur = cur->left;
+			} else {
+				cur = cur->right;
+			}
+		}
+	}
+
+	for (; y && (!hi || (*ctx->cmp)(hi, y) > 0);
+	     y = avl_tree_next_in_order(y)) {
+		if (cb->only_b)
+			(*cb->only_b)(y, cb->ctx);
+		ctx->differences++;
+	}
+}
+
+/* Compares the subtree of the first tree rooted at @x with the items of the
+ * second tree between @lo and @hi, the nodes of the first tree which bound
+ * that subtree, or NULL.  Recurses on left subtrees only, so the depth is at
+ * most the height of the first tree.  */
+static void
+avl_diff_subtree(struct avl_diff_digest_ctx *ctx, struct avl_tree_node *x,
+		 struct avl_tree_node *lo, struct avl_tree_node *hi)
+{
+	const struct avl_diff_callbacks *cb = ctx->cb;
+
+	for (; x; lo = x, x = x->right) {
+		struct avl_tree_node *y;
+
+		/* Same items on both sides, or a hash collision.  */
+		if (avl_diff_node(x)->digest ==
+		    avl_diff_range_digest(ctx, lo, hi))
+			return;
+
+		avl_diff_subtree(ctx, x->left, lo, x);
+
+		y = avl_diff_lookup(ctx, x);
+		if (!y) {
+			if (cb->only_a)
+				(*cb->only_a)(x, cb->ctx);
+			ctx->differences++;
+		} else if (ctx->equal && !(*ctx->equal)(x, y)) {
+			if (cb->changed)
+				(*cb->changed)(x, y, cb->ctx);
+			ctx->differences++;
+		}
+	}
+	avl_diff_only_b_between(ctx, lo, hi);
+}
+
+/*
+ * As avl_tree_diff(), for two digest trees: trees of `struct avl_diff_node'
+ * changed only with avl_diff_link_node(), avl_diff_remove(),
+ * avl_diff_set_hash() and the augmented functions of avl_tree.h with
+ * avl_diff_update().
+ *
+ * Parts of the trees whose digests match are skipped without calling @cmp or
+ * @equal on them, so if two items with the same key are different, their
+ * hashes must be too; @equal then only confirms it.  Takes O(d log n log m)
+ * time for d differences, and O(n log m + m) at worst.
+ */
+size_t
+avl_tree_diff_digest(const struct avl_tree_root *a,
+		     const struct avl_tree_root *b,
+		     int (*cmp)(const struct avl_tree_node *,
+				const struct avl_tree_node *),
+		     bool (*equal)(const struct avl_tree_node *,
+				   const struct avl_tree_node *),
+		     const struct avl_diff_callbacks *cb)
+{
+	struct avl_diff_digest_ctx ctx = {
+		.b = b,
+		.cmp = cmp,
+		.equal = equal,
+		.cb = cb,
+	};
+
+	avl_diff_subtree(&ctx, a->avl_tree_node, NULL, NULL);
+	return ctx.differences;
+}
@@ -0,0 +1,113 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Ordered diff of two AVL trees
+ * =============================
+ */
+
+#ifndef _AVL_DIFF_H
+#define _AVL_DIFF_H
+
+#include <stdint.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Node of a tree for avl_tree_diff_digest().  Embed this in some other data
+ * structure.  */
+struct avl_diff_node {
+	struct avl_tree_node node;
+
+	/* Hash of the item, set before linking it and changed with
+	 * avl_diff_set_hash()  */
+	uint64_t hash;
+
+	/* Sum of the hashes of the items in the subtree rooted here  */
+	uint64_t digest;
+};
+
+/* Cast a node of a digest tree, given as a `struct avl_tree_node', to the
+ * containing data structure.  */
+#define avl_diff_entry(entry, type, member) \
+	avl_tree_entry(avl_tree_entry(entry, struct avl_diff_node, node), \
+		       type, member)
+
+/* Callbacks for the differences found by avl_tree_diff().  Any of them may be
+ * NULL.  */
+struct avl_diff_callbacks {
+	/* Key present in the first tree only  */
+	void (*only_a)(struct avl_tree_node *a, void *ctx);
+
+	/* Key present in the second tree only  */
+	void (*only_b)(struct avl_tree_node *b, void *ctx);
+
+	/* Key present in both trees, with items that are not equal  */
+	void (*changed)(struct avl_tree_node *a, struct avl_tree_node *b,
+			void *ctx);
+
+	void *ctx;
+};
+
+size_t
+avl_tree_diff(const struct avl_tree_root *a, const struct avl_tree_root *b,
+              int (*cmp)(const struct avl_tree_node *,
+                         const struct avl_tree_node *),
+              bool (*equal)(const struct avl_tree_node *,
+                            const struct avl_tree_node *),
+              const struct avl_diff_callbacks *cb);
+
+size_t
+avl_tree_diff_parallel(const struct avl_tree_root *a,
+                       const struct avl_tree_root *b,
+                       int (*cmp)(const struct avl_tree_node *,
+                                  const struct avl_tree_node *),
+                       bool (*equal)(const struct avl_tree_node *,
+                                     const struct avl_tree_node *),
+                       const struct avl_diff_callbacks *cb,
+                       unsigned int nranges);
+
+void
+avl_diff_update(struct avl_tree_node *node);
+
+void
+avl_diff_link_node(struct avl_tree_root *root, struct avl_tree_link *link,
+                   struct avl_diff_node *item);
+
+void
+avl_diff_remove(struct avl_tree_root *root, struct avl_diff_node *item);
+
+void
+avl_diff_set_hash(struct avl_diff_node *item, uint64_t hash);
+
+size_t
+avl_tree_diff_digest(const struct avl_tree_root *a,
+                     const struct avl_tree_root *b,
+                     int (*cmp)(const struct avl_tree_node *,
+                                const struct avl_tree_node *),
+                     bool (*equal)(const struct avl_tree_node *,
+                                   const struct avl_tree_node *),
+                     const struct avl_diff_callbacks *cb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_DIFF_H */
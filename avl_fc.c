@@ -0,0 +1,264 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Flat-combining front end for an AVL tree
+ * ========================================
+ *
+ * When many threads update one tree under a mutex, most of the time goes to
+ * handing the mutex over and to moving the cache lines of the nodes near the
+ * root between CPUs.  With flat combining, a thread publishes its request in
+ * its own slot and then tries to take the mutex.  Whichever thread gets it
+ * (the combiner) applies all published requests at once, sorted by key, while
+ * the others wait on their own slots.  The tree stays in the combiner's cache
+ * and the sorted batch is applied with a finger search: each request starts
+ * from the node the previous one ended at, so requests for nearby keys share
+ * most of their path.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "avl_fc.h"
+
+enum {
+	AVL_FC_NONE = 0,
+	AVL_FC_INSERT,
+	AVL_FC_REMOVE,
+	AVL_FC_LOOKUP,
+};
+
+/* Spins on a slot before yielding the CPU.  */
+#define AVL_FC_SPINS	256
+
+/*
+ * Initializes an empty flat-combining tree.
+ *
+ * @cmp
+ *	Comparison callback, as for avl_tree_insert().
+ *
+ * @max_threads
+ *	Maximum number of threads that will call avl_fc_register().
+ *
+ * Returns 0, or an error number on failure: ENOMEM, or the error returned by
+ * pthread_mutex_init().
+ */
+int
+avl_fc_tree_init(struct avl_fc_tree *tree,
+		 int (*cmp)(const struct avl_tree_node *,
+			    const struct avl_tree_node *),
+		 unsigned int max_threads)
+{
+	void *slots;
+	int ret;
+
+	tree->root = AVL_ROOT;
+	tree->cmp = cmp;
+	tree->nslots = max_threads;
+	tree->nregistered = 0;
+
+	ret = posix_memalign(&slots, 64, max_threads * sizeof(tree->slots[0]));
+	if (ret)
+		return ret;
+	tree->slots = slots;
+	for (unsigned int i = 0; i < max_threads; i++)
+		tree->slots[i].op = AVL_FC_NONE;
+
+	tree->batch = malloc(max_threads * sizeof(tree->batch[0]));
+	if (!tree->batch) {
+		free(tree->slots);
+		return ENOMEM;
+	}
+
+	ret = pthread_mutex_init(&tree->lock, NULL);
+	if (ret) {
+		free(tree->batch);
+		free(tree->slots);
+	}
+	return ret;
+}
+
+/* Releases the resources of a flat-combining tree.  The items are not
+ * freed.  */
+void
+avl_fc_tree_destroy(struct avl_fc_tree *tree)
+{
+	pthread_mutex_destroy(&tree->lock);
+	free(tree->batch);
+	free(tree->slots);
+}
+
+/* Returns a request slot for the calling thread to pass to the other
+ * avl_fc_*() functions, or NULL if all slots are taken.  A slot must only be
+ * used by one thread at a time.  */
+struct avl_fc_slot *
+avl_fc_register(struct avl_fc_tree *tree)
+{
+	unsigned int i = __atomic_fetch_add(&tree->nregistered, 1,
+					    __ATOMIC_RELAXED);
+
+	return (i < tree->nslots) ? &tree->slots[i] : NULL;
+}
+
+/* Returns the node to start searching for @key from, given @finger, a node
+ * whose key is not greater than @key: the lowest ancestor of @finger
+ * (inclusive) whose key is not less than @key, or the root.  All keys between
+ * @finger and that node are in its left subtree, so searching from there finds
+ * the same place as searching from the root.  */
+static struct avl_tree_node *
+avl_fc_climb(struct avl_fc_tree *tree, struct avl_tree_node *finger,
+	     const struct avl_tree_node *key)
+{
+	if (!finger)
+		return tree->root.avl_tree_node;
+
+	while ((*tree->cmp)(key, finger) > 0) {
+		if (!avl_get_parent(finger))
+			return finger;
+		finger = avl_get_parent(finger);
+	}
+	return finger;
+}
+
+/* Applies one request, starting the search at @start.  Returns a node still in
+ * the tree whose key is not greater than that of the request, for the next
+ * search to start from, or NULL.  */
+static struct avl_tree_node *
+avl_fc_apply(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+	     struct avl_tree_node *start)
+{
+	struct avl_tree_link link;
+	struct avl_tree_node *parent = start ? avl_get_parent(start) : NULL;
+	struct avl_tree_node *floor = NULL;
+	struct avl_tree_node **current;
+	int res;
+
+	if (!parent)
+		current = &tree->root.avl_tree_node;
+	else if (start == parent->left)
+		current = &parent->left;
+	else
+		current = &parent->right;
+
+	slot->result = NULL;
+	tree_search_for_each (&link, current) {
+		res = (*tree->cmp)(slot->node, *current);
+		if (res < 0) {
+			current = &(*current)->left;
+		} else if (res > 0) {
+			floor = *current;
+			current = &(*current)->right;
+		} else {
+			slot->result = *current;
+			break;
+		}
+	}
+
+	switch (slot->op) {
+	case AVL_FC_INSERT:
+		if (slot->result)
+			return slot->result;
+		avl_tree_link_node(&tree->root, &link, slot->node);
+		return slot->node;
+	case AVL_FC_REMOVE:
+		if (slot->result)
+			avl_tree_remove(&tree->root, slot->result);
+		return floor;
+	default:
+		return slot->result ? slot->result : floor;
+	}
+}
+
+/* Applies all published requests.  The mutex must be held.  */
+static void
+avl_fc_combine(struct avl_fc_tree *tree)
+{
+	struct avl_tree_node *finger = NULL;
+	unsigned int n = 0, i, j;
+
+	for (i = 0; i < tree->nslots; i++)
+		if (__atomic_load_n(&tree->slots[i].op, __ATOMIC_ACQUIRE))
+			tree->batch[n++] = &tree->slots[i];
+
+	/* Insertion sort; a batch holds at most one request per thread.  */
+	for (i = 1; i < n; i++) {
+		struct avl_fc_slot *slot = tree->batch[i];
+
+		for (j = i; j > 0 &&
+		     (*tree->cmp)(tree->batch[j - 1]->node, slot->node) > 0; j--)
+			tree->batch[j] = tree->batch[j - 1];
+		tree->batch[j] = slot;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct avl_fc_slot *slot = tree->batch[i];
+
+		finger = avl_fc_climb(tree, finger, slot->node);
+		finger = avl_fc_apply(tree, slot, finger);
+		__atomic_store_n(&slot->op, AVL_FC_NONE, __ATOMIC_RELEASE);
+	}
+}
+
+/* Publishes a request and waits until it has been applied, by this thread or
+ * by another.  */
+static struct avl_tree_node *
+avl_fc_request(struct avl_fc_tree *tree, struct avl_fc_slot *slot, int op,
+	       struct avl_tree_node *node)
+{
+	slot->node = node;
+	__atomic_store_n(&slot->op, op, __ATOMIC_RELEASE);
+
+	for (;;) {
+		if (pthread_mutex_trylock(&tree->lock) == 0) {
+			avl_fc_combine(tree);
+			pthread_mutex_unlock(&tree->lock);
+		}
+		for (int spins = 0; spins < AVL_FC_SPINS; spins++)
+			if (!__atomic_load_n(&slot->op, __ATOMIC_ACQUIRE))
+				return slot->result;
+		sched_yield();
+	}
+}
+
+/* Same as avl_tree_insert(): inserts @item unless an equal item is already in
+ * the tree, in which case that item is returned.  */
+struct avl_tree_node *
+avl_fc_insert(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+	      struct avl_tree_node *item)
+{
+	return avl_fc_request(tree, slot, AVL_FC_INSERT, item);
+}
+
+/* Removes the item that compares equal to @key, and returns it, or returns
+ * NULL if there is none.  */
+struct avl_tree_node *
+avl_fc_remove(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+	      struct avl_tree_node *key)
+{
+	return avl_fc_request(tree, slot, AVL_FC_REMOVE, key);
+}
+
+/* Same as avl_tree_lookup_node().  */
+struct avl_tree_node *
+avl_fc_lookup(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+	      struct avl_tree_node *key)
+{
+	return avl_fc_request(tree, slot, AVL_FC_LOOKUP, key);
+}
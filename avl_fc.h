@@ -0,0 +1,92 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Flat-combining front end for an AVL tree
+ * ========================================
+ */
+
+#ifndef _AVL_FC_H
+#define _AVL_FC_H
+
+#include <pthread.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __GNUC__
+#  error "avl_fc requires GCC-compatible attributes and __atomic builtins"
+#endif
+
+/* Per-thread request slot.  Each slot has its own cache line so that
+ * publishing a request does not disturb other threads.  */
+struct avl_fc_slot {
+	/* Pending operation (AVL_FC_*), or 0 once it has been applied  */
+	int op;
+
+	/* Item to insert, or item equal to the one to remove or look up  */
+	struct avl_tree_node *node;
+
+	/* Result of the operation, valid once @op is 0  */
+	struct avl_tree_node *result;
+} __attribute__((aligned(64)));
+
+struct avl_fc_tree {
+	struct avl_tree_root root;
+	int (*cmp)(const struct avl_tree_node *, const struct avl_tree_node *);
+
+	/* Held by the thread currently applying requests  */
+	pthread_mutex_t lock;
+
+	struct avl_fc_slot *slots;
+	struct avl_fc_slot **batch;
+	unsigned int nslots;
+	unsigned int nregistered;
+};
+
+int
+avl_fc_tree_init(struct avl_fc_tree *tree,
+                 int (*cmp)(const struct avl_tree_node *,
+                            const struct avl_tree_node *),
+                 unsigned int max_threads);
+
+void
+avl_fc_tree_destroy(struct avl_fc_tree *tree);
+
+struct avl_fc_slot *
+avl_fc_register(struct avl_fc_tree *tree);
+
+struct avl_tree_node *
+avl_fc_insert(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+              struct avl_tree_node *item);
+
+struct avl_tree_node *
+avl_fc_remove(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+              struct avl_tree_node *key);
+
+struct avl_tree_node *
+avl_fc_lookup(struct avl_fc_tree *tree, struct avl_fc_slot *slot,
+              struct avl_tree_node *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_FC_H */
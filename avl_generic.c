@@ -23,6 +23,8 @@
  */
 
 #include "avl_tree.h"
+#include "avl_traversal.h"
+#include "avl_trace.h"
 
 /*
  * Looks up an item in the specified AVL tree.
@@ -79,6 +81,8 @@ avl_tree_lookup(const struct avl_tree_root *root,
 {
 	const struct avl_tree_node *cur = root->avl_tree_node;
 
+	AVL_TRACE_CTX(AVL_TRACE_LOOKUP, cmp_ctx);
+
 	while (cur) {
 		int res = (*cmp)(cmp_ctx, cur);
 		if (res < 0)
@@ -104,6 +108,8 @@ avl_tree_lookup_node(const struct avl_tree_root *root,
 {
 	const struct avl_tree_node *cur = root->avl_tree_node;
 
+	AVL_TRACE_NODE(AVL_TRACE_LOOKUP, node);
+
 	while (cur) {
 		int res = (*cmp)(node, cur);
 		if (res < 0)
@@ -187,6 +193,8 @@ avl_tree_insert(struct avl_tree_root *root,
 	struct avl_tree_node **current = &root->avl_tree_node;
 	int res;
 
+	AVL_TRACE_NODE(AVL_TRACE_INSERT, item);
+
 	tree_search_for_each (&link, current) {
 		res = (*cmp)(item, *current);
 		if (res < 0)
@@ -197,6 +205,245 @@ avl_tree_insert(struct avl_tree_root *root,
 			return *current;
 	}
 
-	avl_tree_link_node(root, &link, item);
+	avl_tree_link_node_untraced(root, &link, item);
+	return NULL;
+}
+
+/*
+ * Removes the item which compares equal to @cmp_ctx from the specified AVL
+ * tree.  @cmp_ctx and @cmp are as for avl_tree_lookup().
+ *
+ * Returns a pointer to the AVL tree node of the removed item, or NULL if no
+ * item was found.  As with avl_tree_remove(), no memory is freed.
+ */
+struct avl_tree_node *
+avl_tree_remove_key(struct avl_tree_root *root,
+                    const void *cmp_ctx,
+                    int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	const struct avl_tree_node *cur = root->avl_tree_node;
+
+	while (cur) {
+		int res = (*cmp)(cmp_ctx, cur);
+		if (res < 0)
+			cur = cur->left;
+		else if (res > 0)
+			cur = cur->right;
+		else
+			break;
+	}
+
+	if (cur) {
+		AVL_TRACE_NODE(AVL_TRACE_REMOVE, cur);
+		avl_tree_remove_untraced(root, (struct avl_tree_node *)cur);
+	} else {
+		AVL_TRACE_CTX(AVL_TRACE_REMOVE, cmp_ctx);
+	}
+
+	return (struct avl_tree_node *)cur;
+}
+
+/*
+ * Inserts an item into the specified AVL tree, replacing any item which
+ * compares equal to it.  Arguments are as for avl_tree_insert().
+ *
+ * If an equal item was found, @item takes its place with avl_tree_replace(),
+ * so no rebalancing is done, and a pointer to the AVL tree node of the
+ * displaced item is returned.  Otherwise @item is inserted and NULL is
+ * returned.
+ */
+struct avl_tree_node *
+avl_tree_upsert(struct avl_tree_root *root,
+                struct avl_tree_node *item,
+                int (*cmp)(const struct avl_tree_node *,
+                           const struct avl_tree_node *))
+{
+	struct avl_tree_link link;
+	struct avl_tree_node **current = &root->avl_tree_node;
+	int res;
+
+	AVL_TRACE_NODE(AVL_TRACE_INSERT, item);
+
+	tree_search_for_each (&link, current) {
+		res = (*cmp)(item, *current);
+		if (res < 0) {
+			current = &(*current)->left;
+		} else if (res > 0) {
+			current = &(*current)->right;
+		} else {
+			struct avl_tree_node *old = *current;
+
+			avl_tree_replace(root, old, item);
+			return old;
+		}
+	}
+
+	avl_tree_link_node_untraced(root, &link, item);
 	return NULL;
 }
+
+/*
+ * Inserts an item into the specified AVL tree, allowing duplicates.
+ *
+ * This is the multiset counterpart of avl_tree_insert().  Arguments have the
+ * same meaning, but an item which compares equal to items already in the tree
+ * is still inserted, after all of them in in-order.  Equal items therefore
+ * stay contiguous and in insertion order, and can be visited with
+ * avl_tree_for_each_equal().
+ *
+ * A specific duplicate is removed by passing its own node to avl_tree_remove();
+ * no further search is needed once it has been found.
+ */
+void
+avl_tree_insert_multi(struct avl_tree_root *root,
+                      struct avl_tree_node *item,
+                      int (*cmp)(const struct avl_tree_node *,
+                                 const struct avl_tree_node *))
+{
+	struct avl_tree_link link;
+	struct avl_tree_node **current = &root->avl_tree_node;
+
+	AVL_TRACE_NODE(AVL_TRACE_INSERT, item);
+
+	tree_search_for_each (&link, current) {
+		if ((*cmp)(item, *current) < 0)
+			current = &(*current)->left;
+		else
+			current = &(*current)->right;
+	}
+
+	avl_tree_link_node_untraced(root, &link, item);
+}
+
+/*
+ * Returns the first item, in in-order, which is not less than @cmp_ctx, or
+ * NULL if there is none.  @cmp is as for avl_tree_lookup().
+ *
+ * If the tree contains items equal to @cmp_ctx, this is the first of them.
+ */
+struct avl_tree_node *
+avl_tree_lower_bound(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	const struct avl_tree_node *cur = root->avl_tree_node;
+	const struct avl_tree_node *result = NULL;
+
+	while (cur) {
+		if ((*cmp)(cmp_ctx, cur) <= 0) {
+			result = cur;
+			cur = cur->left;
+		} else {
+			cur = cur->right;
+		}
+	}
+
+	return (struct avl_tree_node *)result;
+}
+
+/*
+ * Returns the first item, in in-order, which is greater than @cmp_ctx, or NULL
+ * if there is none.  @cmp is as for avl_tree_lookup().
+ *
+ * Together with avl_tree_lower_bound() this gives the half-open range of items
+ * equal to @cmp_ctx.
+ */
+struct avl_tree_node *
+avl_tree_upper_bound(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	const struct avl_tree_node *cur = root->avl_tree_node;
+	const struct avl_tree_node *result = NULL;
+
+	while (cur) {
+		if ((*cmp)(cmp_ctx, cur) < 0) {
+			result = cur;
+			cur = cur->left;
+		} else {
+			cur = cur->right;
+		}
+	}
+
+	return (struct avl_tree_node *)result;
+}
+
+/*
+ * Returns the number of items in the tree which compare equal to @cmp_ctx.
+ * This takes O(log n + k) time, where k is the result.
+ */
+size_t
+avl_tree_count_equal(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	const struct avl_tree_node *cur;
+	size_t count = 0;
+
+	for (cur = avl_tree_lower_bound(root, cmp_ctx, cmp);
+	     cur && (*cmp)(cmp_ctx, cur) == 0;
+	     cur = avl_tree_next_in_order(cur))
+		count++;
+
+	return count;
+}
+
+/*
+ * Returns the number of items in the tree not less than @lo_ctx and less than
+ * @hi_ctx, both compared with @cmp.  The nodes carry no subtree sizes, so this
+ * takes O(log n + k) time, where k is the result.
+ */
+size_t
+avl_tree_count_range(const struct avl_tree_root *root,
+                     const void *lo_ctx, const void *hi_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	const struct avl_tree_node *cur;
+	size_t count = 0;
+
+	for (cur = avl_tree_lower_bound(root, lo_ctx, cmp);
+	     cur && (*cmp)(hi_ctx, cur) > 0;
+	     cur = avl_tree_next_in_order(cur))
+		count++;
+
+	return count;
+}
+
+/*
+ * Removes all items not less than @lo_ctx and less than @hi_ctx from the tree.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.
+ *
+ * @lo_ctx, @hi_ctx
+ *	Bounds of the range, passed as first argument to @cmp as for
+ *	avl_tree_lookup().
+ *
+ * @detached
+ *	Location of a root pointer which receives the removed items, as a
+ *	balanced tree of their own.  They can be freed with
+ *	avl_tree_for_each_in_postorder().
+ *
+ * The range is carved out with two splits and a join, so this takes O(log n)
+ * time however many items are removed.
+ */
+void
+avl_tree_remove_range(struct avl_tree_root *root,
+                      const void *lo_ctx, const void *hi_ctx,
+                      int (*cmp)(const void *, const struct avl_tree_node *),
+                      struct avl_tree_root *detached)
+{
+	struct avl_tree_root below, rest, above;
+	struct avl_tree_node *last;
+
+	avl_tree_split(root, lo_ctx, cmp, &below, &rest);
+	avl_tree_split(&rest, hi_ctx, cmp, detached, &above);
+
+	last = avl_tree_last_in_order(&below);
+	if (!last) {
+		*root = above;
+		return;
+	}
+	avl_tree_remove_untraced(&below, last);
+	avl_tree_join(root, &below, last, &above);
+}
@@ -27,6 +27,10 @@
 
 #include "avl_tree.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct avl_tree_node *
 avl_tree_lookup(const struct avl_tree_root *root,
                 const void *cmp_ctx,
@@ -44,4 +48,51 @@ avl_tree_insert(struct avl_tree_root *root,
                 int (*cmp)(const struct avl_tree_node *,
                            const struct avl_tree_node *));
 
+struct avl_tree_node *
+avl_tree_remove_key(struct avl_tree_root *root,
+                    const void *cmp_ctx,
+                    int (*cmp)(const void *, const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_tree_upsert(struct avl_tree_root *root,
+                struct avl_tree_node *item,
+                int (*cmp)(const struct avl_tree_node *,
+                           const struct avl_tree_node *));
+
+void
+avl_tree_insert_multi(struct avl_tree_root *root,
+                      struct avl_tree_node *item,
+                      int (*cmp)(const struct avl_tree_node *,
+                                 const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_tree_lower_bound(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_tree_upper_bound(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+size_t
+avl_tree_count_equal(const struct avl_tree_root *root,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+size_t
+avl_tree_count_range(const struct avl_tree_root *root,
+                     const void *lo_ctx, const void *hi_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+void
+avl_tree_remove_range(struct avl_tree_root *root,
+                      const void *lo_ctx, const void *hi_ctx,
+                      int (*cmp)(const void *, const struct avl_tree_node *),
+                      struct avl_tree_root *detached);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _AVL_GENERIC_H */
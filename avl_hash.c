@@ -0,0 +1,246 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree with a hash index for exact-match lookups
+ * ==================================================
+ *
+ * A lookup in the tree follows about log2(n) pointers.  When most lookups are
+ * for exact keys, a hash table that maps each item's hash to its node answers
+ * them with one or two cache misses, while the tree is kept for ordered
+ * iteration and range queries.
+ *
+ * The table uses linear probing and stores each item's hash next to its node
+ * pointer, so the comparison callback is only called on hash matches.
+ * Removal shifts later entries of the probe run back instead of leaving
+ * tombstones.
+ */
+
+#include <stdlib.h>
+
+#include "avl_hash.h"
+
+#define AVL_HASH_MIN_BITS	4
+
+/* Maps a hash to its home slot.  The multiplication spreads hashes that
+ * differ only in their high or low bits, such as small integer keys.  */
+static AVL_INLINE size_t
+avl_hash_home(const struct avl_hash_tree *tree, unsigned long hash)
+{
+	return (size_t)(((unsigned long long)hash * 0x9E3779B97F4A7C15ULL) >>
+			(64 - tree->bits));
+}
+
+static AVL_INLINE size_t
+avl_hash_mask(const struct avl_hash_tree *tree)
+{
+	return ((size_t)1 << tree->bits) - 1;
+}
+
+/* Puts @node in the first free slot of its probe run.  There must be one.  */
+static void
+avl_hash_put(struct avl_hash_tree *tree, unsigned long hash,
+	     struct avl_tree_node *node)
+{
+	size_t i = avl_hash_home(tree, hash);
+
+	while (tree->slots[i].node)
+		i = (i + 1) & avl_hash_mask(tree);
+	tree->slots[i].hash = hash;
+	tree->slots[i].node = node;
+}
+
+/* Doubles the table (or allocates the first one), keeping the load factor at
+ * most 3/4.  Returns false if memory could not be allocated.  */
+static bool
+avl_hash_grow(struct avl_hash_tree *tree)
+{
+	struct avl_hash_slot *old = tree->slots;
+	const size_t old_size = old ? avl_hash_mask(tree) + 1 : 0;
+	const unsigned int bits = old ? tree->bits + 1 : AVL_HASH_MIN_BITS;
+
+	tree->slots = calloc((size_t)1 << bits, sizeof(tree->slots[0]));
+	if (!tree->slots) {
+		tree->slots = old;
+		return false;
+	}
+	tree->bits = bits;
+
+	for (size_t i = 0; i < old_size; i++)
+		if (old[i].node)
+			avl_hash_put(tree, old[i].hash, old[i].node);
+	free(old);
+	return true;
+}
+
+/*
+ * Initializes an empty hash-indexed AVL tree.
+ *
+ * @hash
+ *	Returns the hash of the key of an item in the tree.  Items which
+ *	compare equal must have the same hash.
+ *
+ * @cmp
+ *	Comparison callback, as for avl_tree_insert().
+ *
+ * No memory is allocated until the first insertion.
+ */
+void
+avl_hash_tree_init(struct avl_hash_tree *tree,
+		   unsigned long (*hash)(const struct avl_tree_node *),
+		   int (*cmp)(const struct avl_tree_node *,
+			      const struct avl_tree_node *))
+{
+	tree->root = AVL_ROOT;
+	tree->slots = NULL;
+	tree->bits = 0;
+	tree->count = 0;
+	tree->hash = hash;
+	tree->cmp = cmp;
+}
+
+/* Frees the hash table and leaves the tree empty.  The items themselves are
+ * not freed.  */
+void
+avl_hash_tree_destroy(struct avl_hash_tree *tree)
+{
+	free(tree->slots);
+	avl_hash_tree_init(tree, tree->hash, tree->cmp);
+}
+
+/*
+ * Inserts an item into a hash-indexed AVL tree.
+ *
+ * Returns 0 if @item was inserted.  If an equal item is already in the tree,
+ * returns 1 and sets *@dup_ret (if @dup_ret is not NULL) to it.  Returns -1,
+ * and changes nothing, if the hash table had to grow but could not.
+ */
+int
+avl_hash_tree_insert(struct avl_hash_tree *tree, struct avl_tree_node *item,
+		     struct avl_tree_node **dup_ret)
+{
+	struct avl_tree_link link;
+	struct avl_tree_node **current = &tree->root.avl_tree_node;
+	int res;
+
+	tree_search_for_each (&link, current) {
+		res = (*tree->cmp)(item, *current);
+		if (res < 0) {
+			current = &(*current)->left;
+		} else if (res > 0) {
+			current = &(*current)->right;
+		} else {
+			if (dup_ret)
+				*dup_ret = *current;
+			return 1;
+		}
+	}
+
+	if ((!tree->slots ||
+	     (tree->count + 1) * 4 > (avl_hash_mask(tree) + 1) * 3) &&
+	    !avl_hash_grow(tree) &&
+	    (!tree->slots || tree->count == avl_hash_mask(tree)))
+		return -1;
+
+	avl_tree_link_node(&tree->root, &link, item);
+	avl_hash_put(tree, (*tree->hash)(item), item);
+	tree->count++;
+	return 0;
+}
+
+/* Removes an item from a hash-indexed AVL tree.  As with avl_tree_remove(), no
+ * memory is freed.  */
+void
+avl_hash_tree_remove(struct avl_hash_tree *tree, struct avl_tree_node *node)
+{
+	const size_t mask = avl_hash_mask(tree);
+	size_t i = avl_hash_home(tree, (*tree->hash)(node));
+	size_t j;
+
+	while (tree->slots[i].node != node)
+		i = (i + 1) & mask;
+
+	/* Move back any later entry of the probe run whose home slot does not
+	 * lie cyclically in (i, j], so that no lookup skips over the hole.  */
+	for (j = (i + 1) & mask; tree->slots[j].node; j = (j + 1) & mask) {
+		size_t home = avl_hash_home(tree, tree->slots[j].hash);
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			tree->slots[i] = tree->slots[j];
+			i = j;
+		}
+	}
+	tree->slots[i].node = NULL;
+
+	avl_tree_remove(&tree->root, node);
+	tree->count--;
+}
+
+/*
+ * Looks up an item by exact key in a hash-indexed AVL tree.
+ *
+ * @hash
+ *	Hash of the key being searched for, computed the same way as the
+ *	tree's hash callback.
+ *
+ * @cmp_ctx, @cmp
+ *	As for avl_tree_lookup().  @cmp is only called on items with the same
+ *	hash.
+ *
+ * Returns a pointer to the AVL tree node of the item, or NULL if it was not
+ * found.
+ */
+struct avl_tree_node *
+avl_hash_tree_lookup(const struct avl_hash_tree *tree, unsigned long hash,
+		     const void *cmp_ctx,
+		     int (*cmp)(const void *, const struct avl_tree_node *))
+{
+	size_t i;
+
+	if (!tree->slots)
+		return NULL;
+
+	for (i = avl_hash_home(tree, hash); tree->slots[i].node;
+	     i = (i + 1) & avl_hash_mask(tree)) {
+		if (tree->slots[i].hash == hash &&
+		    (*cmp)(cmp_ctx, tree->slots[i].node) == 0)
+			return tree->slots[i].node;
+	}
+	return NULL;
+}
+
+/* Same as avl_hash_tree_lookup(), but the item being searched for is in the
+ * same format as those in the tree, and the tree's own callbacks are used.  */
+struct avl_tree_node *
+avl_hash_tree_lookup_node(const struct avl_hash_tree *tree,
+			  const struct avl_tree_node *node)
+{
+	unsigned long hash;
+	size_t i;
+
+	if (!tree->slots)
+		return NULL;
+
+	hash = (*tree->hash)(node);
+	for (i = avl_hash_home(tree, hash); tree->slots[i].node;
+	     i = (i + 1) & avl_hash_mask(tree)) {
+		if (tree->slots[i].hash == hash &&
+		    (*tree->cmp)(node, tree->slots[i].node) == 0)
+			return tree->slots[i].node;
+	}
+	return NULL;
+}
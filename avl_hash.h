@@ -0,0 +1,80 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree with a hash index for exact-match lookups
+ * ==================================================
+ */
+
+#ifndef _AVL_HASH_H
+#define _AVL_HASH_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct avl_hash_slot {
+	unsigned long hash;
+	struct avl_tree_node *node;	/* NULL if the slot is free  */
+};
+
+/* An AVL tree plus an open-addressing hash table of the same items.  Use only
+ * the avl_hash_tree_*() functions to insert and remove items; any read-only
+ * tree operation may be used on @root.  */
+struct avl_hash_tree {
+	struct avl_tree_root root;
+
+	struct avl_hash_slot *slots;
+	unsigned int bits;		/* log2 of the number of slots  */
+	size_t count;
+
+	unsigned long (*hash)(const struct avl_tree_node *);
+	int (*cmp)(const struct avl_tree_node *, const struct avl_tree_node *);
+};
+
+void
+avl_hash_tree_init(struct avl_hash_tree *tree,
+                   unsigned long (*hash)(const struct avl_tree_node *),
+                   int (*cmp)(const struct avl_tree_node *,
+                              const struct avl_tree_node *));
+
+void
+avl_hash_tree_destroy(struct avl_hash_tree *tree);
+
+int
+avl_hash_tree_insert(struct avl_hash_tree *tree, struct avl_tree_node *item,
+                     struct avl_tree_node **dup_ret);
+
+void
+avl_hash_tree_remove(struct avl_hash_tree *tree, struct avl_tree_node *node);
+
+struct avl_tree_node *
+avl_hash_tree_lookup(const struct avl_hash_tree *tree, unsigned long hash,
+                     const void *cmp_ctx,
+                     int (*cmp)(const void *, const struct avl_tree_node *));
+
+struct avl_tree_node *
+avl_hash_tree_lookup_node(const struct avl_hash_tree *tree,
+                          const struct avl_tree_node *node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_HASH_H */
@@ -29,7 +29,8 @@
 
 /*
  * Iterate through the nodes in an AVL tree in sorted order.
- * You may not modify the tree during the iteration.
+ * You may not modify the tree during the iteration; to remove nodes while
+ * walking in order, use a `struct avl_tree_cursor' (see avl_cursor.h).
  *
  * @child_struct
  *	Variable that will receive a pointer to each struct inserted into the
@@ -91,4 +92,21 @@
 	          && (_parent = avl_get_parent(_cur), 1);           \
 	     _cur = avl_tree_next_in_postorder(_cur, _parent))
 
+/*
+ * Iterate through the items in an AVL tree which compare equal to @cmp_ctx, in
+ * sorted (that is, insertion) order.  This is meant for trees built with
+ * avl_tree_insert_multi().  You may not modify the tree during the iteration.
+ *
+ * @cmp_ctx and @cmp are as for avl_tree_lookup(); the other arguments are as
+ * for avl_tree_for_each_in_order().
+ */
+#define avl_tree_for_each_equal(child_struct, root, cmp_ctx, cmp,   \
+	                        struct_name, struct_member)         \
+	for (struct avl_tree_node *_cur =                           \
+	     avl_tree_lower_bound(root, cmp_ctx, cmp);              \
+	     _cur && (*(cmp))(cmp_ctx, _cur) == 0 &&                \
+	     ((child_struct) =                                      \
+	      avl_tree_entry(_cur, struct_name, struct_member), 1); \
+	     _cur = avl_tree_next_in_order(_cur))
+
 #endif /* _AVL_ITERATION_H */
@@ -0,0 +1,417 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree without parent pointers
+ * ================================
+ *
+ * `struct avl_tree_node' spends a word on the parent pointer and another one
+ * on the balance factor, which is what makes O(1) removal of a given node and
+ * stepping from node to node possible.  Indexes that are only ever used by
+ * key can do without both: a `struct avl_lite_node' is just the two child
+ * pointers, with the balance factor kept in their lowest bits, so it takes 16
+ * bytes instead of 32 on 64-bit machines.
+ *
+ * Insertion and removal record the search path on a stack of at most
+ * AVL_TREE_MAX_HEIGHT entries and rebalance along it bottom-up, with the same
+ * rotations as avl_tree.c.  In exchange for the smaller node, items can only
+ * be removed by key, and in-order traversal needs a stack-based cursor.
+ */
+
+#include "avl_lite.h"
+
+/* Returns the left child (sign < 0) or the right child (sign > 0) of @node.  */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_get_child(const struct avl_lite_node *node, int sign)
+{
+	if (sign < 0)
+		return avl_lite_left(node);
+	else
+		return avl_lite_right(node);
+}
+
+/* Sets the left child (sign < 0) or the right child (sign > 0) of @node,
+ * keeping its balance factor.  */
+static AVL_INLINE void
+avl_lite_set_child(struct avl_lite_node *node, int sign,
+		   struct avl_lite_node *child)
+{
+	if (sign < 0)
+		node->left = (uintptr_t)child | (node->left & 1);
+	else
+		node->right = (uintptr_t)child | (node->right & 1);
+}
+
+/* Returns the balance factor of @node: -1, 0 or +1.  */
+static AVL_INLINE int
+avl_lite_get_balance(const struct avl_lite_node *node)
+{
+	return (int)(node->right & 1) - (int)(node->left & 1);
+}
+
+static AVL_INLINE void
+avl_lite_set_balance(struct avl_lite_node *node, int balance)
+{
+	node->left = (node->left & ~(uintptr_t)1) | (balance < 0);
+	node->right = (node->right & ~(uintptr_t)1) | (balance > 0);
+}
+
+/* Links @child in place of the subtree at depth @i of the search path.  */
+static AVL_INLINE void
+avl_lite_replace(struct avl_lite_root *root,
+		 struct avl_lite_node * const *path, const signed char *dirs,
+		 int i, struct avl_lite_node *child)
+{
+	if (i > 0)
+		avl_lite_set_child(path[i - 1], dirs[i - 1], child);
+	else
+		root->node = child;
+}
+
+/*
+ * Template for a single rotation which lifts the child of @A on side @sign
+ * into its place --- for sign < 0, a clockwise rotation:
+ *
+ *           A             B
+ *          / \           / \
+ *         B   C?  =>    D?  A
+ *        / \               / \
+ *       D?  E?            E?  C?
+ *
+ * Returns B.  Like avl_rotate(), this does not update balance factors, nor
+ * the pointer to A.
+ */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_lift(struct avl_lite_node * const A, const int sign)
+{
+	struct avl_lite_node * const B = avl_lite_get_child(A, sign);
+
+	avl_lite_set_child(A, sign, avl_lite_get_child(B, -sign));
+	avl_lite_set_child(B, -sign, A);
+	return B;
+}
+
+/*
+ * Template for the double rotation which lifts E, the child of B on side
+ * -@sign, where B is the child of @A on side @sign --- for sign < 0:
+ *
+ *           A             E
+ *          / \          /   \
+ *         B   C?  =>   B     A
+ *        / \          / \   / \
+ *       D?  E        D?  F?G?  C?
+ *          / \
+ *         F?  G?
+ *
+ * Returns E and sets the balance factors of all three nodes, as
+ * avl_do_double_rotate() does.
+ */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_double_lift(struct avl_lite_node * const A, const int sign)
+{
+	struct avl_lite_node * const B = avl_lite_get_child(A, sign);
+	struct avl_lite_node * const E = avl_lite_get_child(B, -sign);
+	const int e = avl_lite_get_balance(E);
+
+	avl_lite_set_child(A, sign, avl_lite_lift(B, -sign));
+	avl_lite_lift(A, sign);
+
+	avl_lite_set_balance(A, e == sign ? -sign : 0);
+	avl_lite_set_balance(B, e == -sign ? sign : 0);
+	avl_lite_set_balance(E, 0);
+	return E;
+}
+
+/*
+ * Looks up an item in a lite AVL tree, as avl_tree_lookup() does.
+ */
+struct avl_lite_node *
+avl_lite_lookup(const struct avl_lite_root *root,
+		const void *cmp_ctx,
+		int (*cmp)(const void *, const struct avl_lite_node *))
+{
+	struct avl_lite_node *cur = root->node;
+
+	while (cur) {
+		const int res = (*cmp)(cmp_ctx, cur);
+
+		if (res < 0)
+			cur = avl_lite_left(cur);
+		else if (res > 0)
+			cur = avl_lite_right(cur);
+		else
+			break;
+	}
+	return cur;
+}
+
+/* Handles the growth of the subtree of @node on side @sign after an
+ * insertion.  Returns true if the height of @node's subtree is unchanged,
+ * storing in *subtree_ret a new root for it if a rotation was done.  */
+static AVL_INLINE bool
+avl_lite_grow(struct avl_lite_node *node, const int sign,
+	      struct avl_lite_node **subtree_ret)
+{
+	const int balance = avl_lite_get_balance(node);
+	struct avl_lite_node *child;
+
+	if (balance == 0) {
+		avl_lite_set_balance(node, sign);
+		return false;
+	}
+	if (balance == -sign) {
+		avl_lite_set_balance(node, 0);
+		return true;
+	}
+
+	/* @node is now too heavy on side @sign.  The child there grew, so its
+	 * balance factor is not 0.  */
+	child = avl_lite_get_child(node, sign);
+	if (avl_lite_get_balance(child) == sign) {
+		*subtree_ret = avl_lite_lift(node, sign);
+		avl_lite_set_balance(node, 0);
+		avl_lite_set_balance(child, 0);
+	} else {
+		*subtree_ret = avl_lite_double_lift(node, sign);
+	}
+	return true;
+}
+
+/*
+ * Inserts an item into a lite AVL tree, as avl_tree_insert() does.
+ *
+ * Returns NULL if the item was inserted, otherwise a pointer to the node of
+ * the item already in the tree which compares equal to @item.
+ */
+struct avl_lite_node *
+avl_lite_insert(struct avl_lite_root *root, struct avl_lite_node *item,
+		int (*cmp)(const struct avl_lite_node *,
+			   const struct avl_lite_node *))
+{
+	struct avl_lite_node *path[AVL_TREE_MAX_HEIGHT];
+	signed char dirs[AVL_TREE_MAX_HEIGHT];
+	struct avl_lite_node *cur = root->node;
+	int depth = 0;
+
+	while (cur) {
+		const int res = (*cmp)(item, cur);
+
+		if (res == 0)
+			return cur;
+		path[depth] = cur;
+		dirs[depth] = res < 0 ? -1 : +1;
+		cur = avl_lite_get_child(cur, dirs[depth]);
+		depth++;
+	}
+
+	item->left = 0;
+	item->right = 0;
+	avl_lite_replace(root, path, dirs, depth, item);
+
+	/* Walk back up while subtrees grow in height.  */
+	for (int i = depth - 1; i >= 0; i--) {
+		struct avl_lite_node *subtree = NULL;
+		bool done;
+
+		if (dirs[i] < 0)
+			done = avl_lite_grow(path[i], -1, &subtree);
+		else
+			done = avl_lite_grow(path[i], +1, &subtree);
+
+		if (subtree)
+			avl_lite_replace(root, path, dirs, i, subtree);
+		if (done)
+			break;
+	}
+	return NULL;
+}
+
+/* Handles the shrinkage of the subtree of @node on side @sign after a
+ * removal.  Returns true if the height of @node's subtree is unchanged,
+ * storing in *subtree_ret a new root for it if a rotation was done.  */
+static AVL_INLINE bool
+avl_lite_shrink(struct avl_lite_node *node, const int sign,
+		struct avl_lite_node **subtree_ret)
+{
+	const int balance = avl_lite_get_balance(node);
+	struct avl_lite_node *child;
+
+	if (balance == sign) {
+		avl_lite_set_balance(node, 0);
+		return false;
+	}
+	if (balance == 0) {
+		avl_lite_set_balance(node, -sign);
+		return true;
+	}
+
+	/* @node is now too heavy on side -@sign.  */
+	child = avl_lite_get_child(node, -sign);
+	switch (avl_lite_get_balance(child) * -sign) {
+	case 1:
+		*subtree_ret = avl_lite_lift(node, -sign);
+		avl_lite_set_balance(node, 0);
+		avl_lite_set_balance(child, 0);
+		return false;
+	case 0:
+		/* The only case that does not arise on insertion: the
+		 * rotation leaves the height unchanged.  */
+		*subtree_ret = avl_lite_lift(node, -sign);
+		avl_lite_set_balance(node, -sign);
+		avl_lite_set_balance(child, sign);
+		return true;
+	default:
+		*subtree_ret = avl_lite_double_lift(node, -sign);
+		return false;
+	}
+}
+
+/*
+ * Removes the item which compares equal to @cmp_ctx from a lite AVL tree.
+ * @cmp_ctx and @cmp are as for avl_tree_lookup().
+ *
+ * Returns the node of the removed item, or NULL if there was none.  As with
+ * avl_tree_remove(), no memory is freed.
+ */
+struct avl_lite_node *
+avl_lite_remove(struct avl_lite_root *root,
+		const void *cmp_ctx,
+		int (*cmp)(const void *, const struct avl_lite_node *))
+{
+	struct avl_lite_node *path[AVL_TREE_MAX_HEIGHT];
+	signed char dirs[AVL_TREE_MAX_HEIGHT];
+	struct avl_lite_node *node = root->node;
+	int depth = 0;
+
+	while (node) {
+		const int res = (*cmp)(cmp_ctx, node);
+
+		if (res == 0)
+			break;
+		path[depth] = node;
+		dirs[depth] = res < 0 ? -1 : +1;
+		node = avl_lite_get_child(node, dirs[depth]);
+		depth++;
+	}
+	if (!node)
+		return NULL;
+
+	if (node->left > 1 && node->right > 1) {
+		/* Two children: move the in-order successor into @node's
+		 * place, and remove it from its own instead.  */
+		const int k = depth;
+		struct avl_lite_node *succ;
+
+		path[depth] = node;
+		dirs[depth++] = +1;
+		for (succ = avl_lite_right(node); succ->left > 1;
+		     succ = avl_lite_left(succ)) {
+			path[depth] = succ;
+			dirs[depth++] = -1;
+		}
+
+		avl_lite_set_child(path[depth - 1], dirs[depth - 1],
+				   avl_lite_right(succ));
+		*succ = *node;
+		path[k] = succ;
+		avl_lite_replace(root, path, dirs, k, succ);
+	} else {
+		avl_lite_replace(root, path, dirs, depth,
+				 node->left > 1 ? avl_lite_left(node) :
+						  avl_lite_right(node));
+	}
+
+	/* Walk back up while subtrees shrink in height.  */
+	for (int i = depth - 1; i >= 0; i--) {
+		struct avl_lite_node *subtree = NULL;
+		bool done;
+
+		if (dirs[i] < 0)
+			done = avl_lite_shrink(path[i], -1, &subtree);
+		else
+			done = avl_lite_shrink(path[i], +1, &subtree);
+
+		if (subtree)
+			avl_lite_replace(root, path, dirs, i, subtree);
+		if (done)
+			break;
+	}
+	return node;
+}
+
+/*
+ * Empties a lite AVL tree, calling @release, if not NULL, on each node.  The
+ * nodes are visited in order, using right rotations to flatten the tree as it
+ * goes, so this takes O(n) time and no extra memory.
+ */
+void
+avl_lite_destroy(struct avl_lite_root *root,
+		 void (*release)(struct avl_lite_node *))
+{
+	struct avl_lite_node *node = root->node;
+
+	while (node) {
+		struct avl_lite_node *left = avl_lite_left(node);
+
+		if (left) {
+			node->left = left->right & ~(uintptr_t)1;
+			left->right = (uintptr_t)node;
+			node = left;
+		} else {
+			struct avl_lite_node *next = avl_lite_right(node);
+
+			if (release)
+				(*release)(node);
+			node = next;
+		}
+	}
+	root->node = NULL;
+}
+
+/* Pushes @node and its chain of left children, and returns the new current
+ * node.  */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_push_left(struct avl_lite_cursor *cursor, struct avl_lite_node *node)
+{
+	while (node) {
+		cursor->stack[cursor->depth++] = node;
+		node = avl_lite_left(node);
+	}
+	return cursor->depth ? cursor->stack[cursor->depth - 1] : NULL;
+}
+
+/* Positions the cursor at the first node of the tree and returns it, or NULL
+ * if the tree is empty.  The tree may not be modified while the cursor is in
+ * use.  */
+struct avl_lite_node *
+avl_lite_cursor_first(struct avl_lite_cursor *cursor,
+		      const struct avl_lite_root *root)
+{
+	cursor->depth = 0;
+	return avl_lite_push_left(cursor, root->node);
+}
+
+/* Moves the cursor to the next node and returns it, or NULL past the last
+ * node.  */
+struct avl_lite_node *
+avl_lite_cursor_next(struct avl_lite_cursor *cursor)
+{
+	if (!cursor->depth)
+		return NULL;
+	return avl_lite_push_left(cursor,
+				  avl_lite_right(cursor->stack[--cursor->depth]));
+}
@@ -0,0 +1,101 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree without parent pointers
+ * ================================
+ */
+
+#ifndef _AVL_LITE_H
+#define _AVL_LITE_H
+
+#include <stdint.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Node in a lite AVL tree: two words.  Embed this in some other data
+ * structure, which must be at least 2-byte aligned.  The lowest bit of each
+ * child pointer is set if that side of the node is the taller one.  */
+struct avl_lite_node {
+	uintptr_t left;
+	uintptr_t right;
+};
+
+struct avl_lite_root {
+	struct avl_lite_node *node;
+};
+
+#define AVL_LITE_ROOT  (struct avl_lite_root) {NULL}
+
+#define avl_lite_entry(entry, type, member) \
+	avl_tree_entry(entry, type, member)
+
+/* Returns the left child of @node, or NULL.  */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_left(const struct avl_lite_node *node)
+{
+	return (struct avl_lite_node *)(node->left & ~(uintptr_t)1);
+}
+
+/* Returns the right child of @node, or NULL.  */
+static AVL_INLINE struct avl_lite_node *
+avl_lite_right(const struct avl_lite_node *node)
+{
+	return (struct avl_lite_node *)(node->right & ~(uintptr_t)1);
+}
+
+/* Forward cursor over a lite tree; see `struct avl_tree_stack_cursor'.  */
+struct avl_lite_cursor {
+	struct avl_lite_node *stack[AVL_TREE_MAX_HEIGHT];
+	unsigned int depth;
+};
+
+struct avl_lite_node *
+avl_lite_lookup(const struct avl_lite_root *root,
+                const void *cmp_ctx,
+                int (*cmp)(const void *, const struct avl_lite_node *));
+
+struct avl_lite_node *
+avl_lite_insert(struct avl_lite_root *root, struct avl_lite_node *item,
+                int (*cmp)(const struct avl_lite_node *,
+                           const struct avl_lite_node *));
+
+struct avl_lite_node *
+avl_lite_remove(struct avl_lite_root *root,
+                const void *cmp_ctx,
+                int (*cmp)(const void *, const struct avl_lite_node *));
+
+void
+avl_lite_destroy(struct avl_lite_root *root,
+                 void (*release)(struct avl_lite_node *));
+
+struct avl_lite_node *
+avl_lite_cursor_first(struct avl_lite_cursor *cursor,
+                      const struct avl_lite_root *root);
+
+struct avl_lite_node *
+avl_lite_cursor_next(struct avl_lite_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_LITE_H */
@@ -0,0 +1,1387 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree memtables and sorted run files
+ * =======================================
+ *
+ * A memtable is the in-memory write buffer of a log-structured store: writes
+ * go into an AVL tree of key-value entries until it is big enough, at which
+ * point it is frozen and written out, in key order, as an immutable sorted run
+ * file.  Deletions are recorded as tombstone entries so that they shadow
+ * older values in runs.
+ *
+ * Run file layout (all integers little-endian, "varint" being LEB128):
+ *
+ *	data blocks	entries, each:
+ *			  varint shared	 length of the prefix shared with the
+ *					 previous key in the block
+ *			  varint rest	 length of the rest of the key
+ *			  varint vlen	 value length plus one, or 0 for a
+ *					 tombstone
+ *			  rest of the key, then the value
+ *	index		per block: varint offset, varint size,
+ *			varint first key length, first key
+ *	bloom filter	bit array
+ *	footer		u64 index offset, u64 index size, u64 bloom filter
+ *			size, u64 number of entries, u32 number of hashes,
+ *			u32 magic
+ *
+ * Blocks are about AVL_RUN_BLOCK_SIZE bytes and each starts with a full key,
+ * so a lookup reads the index and bloom filter once, at open, and then at most
+ * one block.  The writer streams the tree with avl_tree_next_in_order() and
+ * keeps only the current block, the index and the filter in memory.
+ *
+ * `struct avl_lsm' ties these together.  Writers update the active memtable
+ * under a mutex.  avl_lsm_freeze() swaps in an empty one in O(1), and
+ * avl_lsm_flush(), typically run by a background thread, writes out the
+ * oldest frozen memtable without holding the mutex, so that ingest continues
+ * meanwhile.  Lookups and scans merge all memtables and runs, newest first,
+ * holding the mutex only while they read the active memtable.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_memtable.h"
+#include "avl_traversal.h"
+
+#ifndef AVL_RUN_BLOCK_SIZE
+#  define AVL_RUN_BLOCK_SIZE	4096
+#endif
+
+/* 10 bits and 7 hashes per key give a false positive rate of about 1%.  */
+#define AVL_RUN_BLOOM_BITS_PER_KEY	10
+#define AVL_RUN_BLOOM_HASHES		7
+
+#define AVL_RUN_FOOTER_SIZE	40
+#define AVL_RUN_MAGIC		0x4e55524cU	/* "LRUN"  */
+
+#define AVL_MEMTABLE_ENTRY(__node) \
+	avl_tree_entry(__node, struct avl_memtable_entry, node)
+
+static int
+avl_key_cmp(const void *a, size_t a_len, const void *b, size_t b_len)
+{
+	int res = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+	if (res)
+		return res;
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+static AVL_INLINE int
+avl_entry_cmp(const void *key, size_t key_len,
+	      const struct avl_tree_node *node)
+{
+	const struct avl_memtable_entry *entry = AVL_MEMTABLE_ENTRY(node);
+
+	return avl_key_cmp(key, key_len,
+			   avl_memtable_entry_key(entry), entry->key_len);
+}
+
+/* Returns the first entry not less than @key, or NULL.  */
+static struct avl_tree_node *
+avl_memtable_seek(const struct avl_memtable *mt, const void *key,
+		  size_t key_len)
+{
+	struct avl_tree_node *cur = mt->root.avl_tree_node, *result = NULL;
+
+	while (cur) {
+		if (avl_entry_cmp(key, key_len, cur) > 0) {
+			cur = cur->right;
+		} else {
+			result = cur;
+			cur = cur->left;
+		}
+	}
+	return result;
+}
+
+static size_t
+avl_memtable_entry_bytes(const struct avl_memtable_entry *entry)
+{
+	return sizeof(*entry) + entry->key_len +
+	       (entry->value_len == AVL_MEMTABLE_TOMBSTONE ?
+		0 : entry->value_len);
+}
+
+/* Links @entry, replacing and freeing any entry with the same key.  */
+static void
+avl_memtable_link(struct avl_memtable *mt, struct avl_memtable_entry *entry)
+{
+	struct avl_tree_node **cur = &mt->root.avl_tree_node;
+	struct avl_tree_link link;
+
+	tree_search_for_each (&link, cur) {
+		const int res = avl_entry_cmp(avl_memtable_entry_key(entry),
+					      entry->key_len, *cur);
+
+		if (res < 0) {
+			cur = &(*cur)->left;
+		} else if (res > 0) {
+			cur = &(*cur)->right;
+		} else {
+			struct avl_memtable_entry *old =
+				AVL_MEMTABLE_ENTRY(*cur);
+
+			avl_tree_replace(&mt->root, *cur, &entry->node);
+			mt->bytes -= avl_memtable_entry_bytes(old);
+			mt->bytes += avl_memtable_entry_bytes(entry);
+			free(old);
+			return;
+		}
+	}
+
+	avl_tree_link_node_untraced(&mt->root, &link, &entry->node);
+	mt->count++;
+	mt->bytes += avl_memtable_entry_bytes(entry);
+}
+
+static struct avl_memtable_entry *
+avl_memtable_entry_new(const void *key, size_t key_len,
+		       const void *value, size_t value_len)
+{
+	const size_t copy_len = value ? value_len : 0;
+	struct avl_memtable_entry *entry;
+
+	entry = malloc(sizeof(*entry) + key_len + copy_len);
+	if (!entry)
+		return NULL;
+
+	entry->key_len = key_len;
+	entry->value_len = value ? value_len : AVL_MEMTABLE_TOMBSTONE;
+	memcpy(entry->data, key, key_len);
+	if (copy_len)
+		memcpy(entry->data + key_len, value, copy_len);
+	return entry;
+}
+
+/*
+ * Sets the value of @key in the memtable, both copied.  @value may be NULL
+ * only for an empty value.  Returns 0, or -1 if @value is NULL with a nonzero
+ * @value_len or memory could not be allocated.
+ */
+int
+avl_memtable_put(struct avl_memtable *mt, const void *key, size_t key_len,
+		 const void *value, size_t value_len)
+{
+	struct avl_memtable_entry *entry;
+
+	if (!value && value_len)
+		return -1;
+	entry = avl_memtable_entry_new(key, key_len, value ? value : "",
+				       value_len);
+	if (!entry)
+		return -1;
+	avl_memtable_link(mt, entry);
+	return 0;
+}
+
+/*
+ * Records the deletion of @key with a tombstone entry, which hides the key in
+ * older memtables and runs.  Returns 0, or -1 if memory could not be
+ * allocated.
+ */
+int
+avl_memtable_delete(struct avl_memtable *mt, const void *key, size_t key_len)
+{
+	struct avl_memtable_entry *entry;
+
+	entry = avl_memtable_entry_new(key, key_len, NULL, 0);
+	if (!entry)
+		return -1;
+	avl_memtable_link(mt, entry);
+	return 0;
+}
+
+/*
+ * Returns the entry for @key, which may be a tombstone (value_len ==
+ * AVL_MEMTABLE_TOMBSTONE), or NULL if the memtable has none.
+ */
+const struct avl_memtable_entry *
+avl_memtable_get(const struct avl_memtable *mt, const void *key,
+		 size_t key_len)
+{
+	struct avl_tree_node *node = avl_memtable_seek(mt, key, key_len);
+
+	if (node && avl_entry_cmp(key, key_len, node) == 0)
+		return AVL_MEMTABLE_ENTRY(node);
+	return NULL;
+}
+
+/* Frees all entries of the memtable and empties it.  */
+void
+avl_memtable_destroy(struct avl_memtable *mt)
+{
+	struct avl_tree_node *node = avl_tree_first_in_postorder(&mt->root);
+
+	while (node) {
+		struct avl_tree_node *next =
+			avl_tree_next_in_postorder(node, avl_get_parent(node));
+
+		free(AVL_MEMTABLE_ENTRY(node));
+		node = next;
+	}
+	mt->root.avl_tree_node = NULL;
+	mt->count = 0;
+	mt->bytes = 0;
+}
+
+/*
+ * Run files
+ * =========
+ */
+
+struct avl_buf {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+};
+
+static bool
+avl_buf_reserve(struct avl_buf *buf, size_t extra)
+{
+	if (buf->len + extra > buf->cap) {
+		size_t cap = buf->cap ? buf->cap : 256;
+		unsigned char *data;
+
+		while (cap < buf->len + extra)
+			cap *= 2;
+		data = realloc(buf->data, cap);
+		if (!data)
+			return false;
+		buf->data = data;
+		buf->cap = cap;
+	}
+	return true;
+}
+
+/* The caller must have reserved 10 bytes.  */
+static void
+avl_buf_put_varint(struct avl_buf *buf, uint64_t v)
+{
+	while (v >= 0x80) {
+		buf->data[buf->len++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	buf->data[buf->len++] = (unsigned char)v;
+}
+
+static void
+avl_put_u64(unsigned char *p, uint64_t v)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t
+avl_get_u64(const unsigned char *p)
+{
+	uint64_t v = 0;
+
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static bool
+avl_get_varint(const unsigned char **p, const unsigned char *end,
+	       uint64_t *v_ret)
+{
+	uint64_t v = 0;
+
+	for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+		const unsigned char byte = *(*p)++;
+
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*v_ret = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* 64-bit FNV-1a.  */
+static uint64_t
+avl_run_hash(const unsigned char *key, size_t key_len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (key_len--) {
+		h ^= *key++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Runs @stmt for each of the @k bit positions of @key in a bloom filter of
+ * @bits bits, with `bit' set to the position (double hashing).  */
+#define avl_bloom_for_each_bit(bit, key, key_len, bits, k, stmt)      \
+	do {                                                          \
+		const uint64_t _h = avl_run_hash(key, key_len);        \
+		const uint64_t _step = (_h >> 33) | 1;                \
+		for (unsigned int _i = 0; _i < (k); _i++) {           \
+			const uint64_t bit = (_h + _i * _step) % (bits); \
+			stmt;                                         \
+		}                                                     \
+	} while (0)
+
+struct avl_run_writer {
+	FILE *f;
+	uint64_t offset;
+	struct avl_buf block;
+	struct avl_buf index;
+	const struct avl_memtable_entry *first;
+	const struct avl_memtable_entry *prev;
+};
+
+static bool
+avl_run_finish_block(struct avl_run_writer *w)
+{
+	if (w->block.len == 0)
+		return true;
+
+	if (fwrite(w->block.data, 1, w->block.len, w->f) != w->block.len ||
+	    !avl_buf_reserve(&w->index, 30 + w->first->key_len))
+		return false;
+
+	avl_buf_put_varint(&w->index, w->offset);
+	avl_buf_put_varint(&w->index, w->block.len);
+	avl_buf_put_varint(&w->index, w->first->key_len);
+	memcpy(w->index.data + w->index.len, avl_memtable_entry_key(w->first),
+	       w->first->key_len);
+	w->index.len += w->first->key_len;
+
+	w->offset += w->block.len;
+	w->block.len = 0;
+	return true;
+}
+
+static bool
+avl_run_add(struct avl_run_writer *w, const struct avl_memtable_entry *entry)
+{
+	const unsigned char *key = avl_memtable_entry_key(entry);
+	const bool tombstone = entry->value_len == AVL_MEMTABLE_TOMBSTONE;
+	const size_t value_len = tombstone ? 0 : entry->value_len;
+	size_t shared = 0;
+
+	if (w->block.len == 0) {
+		w->first = entry;
+	} else {
+		const unsigned char *prev = avl_memtable_entry_key(w->prev);
+		const size_t max = w->prev->key_len < entry->key_len ?
+				   w->prev->key_len : entry->key_len;
+
+		while (shared < max && prev[shared] == key[shared])
+			shared++;
+	}
+
+	if (!avl_buf_reserve(&w->block,
+			     30 + entry->key_len - shared + value_len))
+		return false;
+
+	avl_buf_put_varint(&w->block, shared);
+	avl_buf_put_varint(&w->block, entry->key_len - shared);
+	avl_buf_put_varint(&w->block, tombstone ? 0 : (uint64_t)value_len + 1);
+	memcpy(w->block.data + w->block.len, key + shared,
+	       entry->key_len - shared);
+	w->block.len += entry->key_len - shared;
+	memcpy(w->block.data + w->block.len,
+	       avl_memtable_entry_value(entry), value_len);
+	w->block.len += value_len;
+
+	w->prev = entry;
+	if (w->block.len >= AVL_RUN_BLOCK_SIZE)
+		return avl_run_finish_block(w);
+	return true;
+}
+
+/*
+ * Writes the entries of a memtable, tombstones included, to a new sorted run
+ * file at @path.  The memtable must not change meanwhile.
+ *
+ * Returns 0, or -1 on error, with errno set.  A partially written file is
+ * removed.
+ */
+int
+avl_memtable_write_run(const struct avl_memtable *mt, const char *path)
+{
+	struct avl_run_writer w = { .offset = 0 };
+	const struct avl_tree_node *node;
+	unsigned char footer[AVL_RUN_FOOTER_SIZE];
+	uint64_t bloom_bits = mt->count * AVL_RUN_BLOOM_BITS_PER_KEY;
+	unsigned char *bloom;
+	bool ok;
+
+	bloom_bits = bloom_bits < 64 ? 64 : (bloom_bits + 7) & ~(uint64_t)7;
+	bloom = calloc(bloom_bits / 8, 1);
+	if (!bloom)
+		return -1;
+
+	w.f = fopen(path, "wb");
+	if (!w.f) {
+		free(bloom);
+		return -1;
+	}
+
+	ok = true;
+	for (node = avl_tree_first_in_order(&mt->root); ok && node;
+	     node = avl_tree_next_in_order(node)) {
+		const struct avl_memtable_entry *entry =
+			AVL_MEMTABLE_ENTRY(node);
+
+		avl_bloom_for_each_bit(bit, avl_memtable_entry_key(entry),
+				       entry->key_len, bloom_bits,
+				       AVL_RUN_BLOOM_HASHES,
+				       bloom[bit / 8] |= 1 << (bit % 8));
+		ok = avl_run_add(&w, entry);
+	}
+	ok = ok && avl_run_finish_block(&w);
+
+	avl_put_u64(footer, w.offset);
+	avl_put_u64(footer + 8, w.index.len);
+	avl_put_u64(footer + 16, bloom_bits / 8);
+	avl_put_u64(footer + 24, mt->count);
+	avl_put_u64(footer + 32, AVL_RUN_BLOOM_HASHES |
+				 (uint64_t)AVL_RUN_MAGIC << 32);
+
+	ok = ok &&
+	     fwrite(w.index.data, 1, w.index.len, w.f) == w.index.len &&
+	     fwrite(bloom, 1, bloom_bits / 8, w.f) == bloom_bits / 8 &&
+	     fwrite(footer, 1, sizeof(footer), w.f) == sizeof(footer);
+	ok = (fclose(w.f) == 0) && ok;
+
+	free(w.block.data);
+	free(w.index.data);
+	free(bloom);
+
+	if (!ok) {
+		remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+static bool
+avl_pread_all(int fd, void *buf, size_t size, uint64_t offset)
+{
+	while (size) {
+		const ssize_t n = pread(fd, buf, size, (off_t)offset);
+
+		if (n <= 0)
+			return false;
+		buf = (char *)buf + n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+/* Parses the index of a run into its array of blocks.  */
+static bool
+avl_run_parse_index(struct avl_run *run, size_t index_size)
+{
+	const unsigned char *p = run->index, *end = run->index + index_size;
+	size_t cap = 0;
+
+	while (p < end) {
+		struct avl_run_block *b;
+		uint64_t key_len;
+
+		if (run->nblocks == cap) {
+			cap = cap ? cap * 2 : 16;
+			b = realloc(run->blocks, cap * sizeof(b[0]));
+			if (!b)
+				return false;
+			run->blocks = b;
+		}
+		b = &run->blocks[run->nblocks++];
+		if (!avl_get_varint(&p, end, &b->offset) ||
+		    !avl_get_varint(&p, end, &b->size) ||
+		    !avl_get_varint(&p, end, &key_len) ||
+		    key_len > (uint64_t)(end - p))
+			return false;
+		b->first_key = p;
+		b->first_key_len = key_len;
+		p += key_len;
+	}
+	return true;
+}
+
+/*
+ * Opens a run file written by avl_memtable_write_run().  Reads its index and
+ * bloom filter into memory.  Returns NULL on error.
+ */
+struct avl_run *
+avl_run_open(const char *path)
+{
+	unsigned char footer[AVL_RUN_FOOTER_SIZE];
+	uint64_t index_offset, index_size, bloom_size, tail;
+	struct avl_run *run;
+	struct stat st;
+
+	run = calloc(1, sizeof(*run));
+	if (!run)
+		return NULL;
+
+	run->fd = open(path, O_RDONLY);
+	if (run->fd < 0 || fstat(run->fd, &st) ||
+	    st.st_size < AVL_RUN_FOOTER_SIZE ||
+	    !avl_pread_all(run->fd, footer, sizeof(footer),
+			   st.st_size - AVL_RUN_FOOTER_SIZE))
+		goto fail;
+
+	index_offset = avl_get_u64(footer);
+	index_size = avl_get_u64(footer + 8);
+	bloom_size = avl_get_u64(footer + 16);
+	run->count = avl_get_u64(footer + 24);
+	tail = avl_get_u64(footer + 32);
+	run->bloom_hashes = (unsigned int)(tail & 0xffffffff);
+	run->bloom_bits = bloom_size * 8;
+
+	if ((tail >> 32) != AVL_RUN_MAGIC || bloom_size == 0 ||
+	    index_offset + index_size + bloom_size + AVL_RUN_FOOTER_SIZE !=
+	    (uint64_t)st.st_size)
+		goto fail;
+
+	run->index = malloc(index_size ? index_size : 1);
+	run->bloom = malloc(bloom_size);
+	if (!run->index || !run->bloom ||
+	    !avl_pread_all(run->fd, run->index, index_size, index_offset) ||
+	    !avl_pread_all(run->fd, run->bloom, bloom_size,
+			   index_offset + index_size) ||
+	    !avl_run_parse_index(run, index_size))
+		goto fail;
+
+	return run;
+
+fail:
+	avl_run_close(run);
+	return NULL;
+}
+
+/* Closes a run opened with avl_run_open().  The file itself is kept.  */
+void
+avl_run_close(struct avl_run *run)
+{
+	if (run->fd >= 0)
+		close(run->fd);
+	free(run->blocks);
+	free(run->index);
+	free(run->bloom);
+	free(run);
+}
+
+/* Returns false if @key is certainly not in the run.  */
+static bool
+avl_run_may_contain(const struct avl_run *run, const void *key,
+		    size_t key_len)
+{
+	bool present = true;
+
+	avl_bloom_for_each_bit(bit, key, key_len, run->bloom_bits,
+			       run->bloom_hashes,
+			       present &= (run->bloom[bit / 8] >> (bit % 8)) & 1);
+	return present;
+}
+
+/* Prepares a cursor over @run.  It is not positioned until
+ * avl_run_cursor_seek() is called.  */
+void
+avl_run_cursor_init(struct avl_run_cursor *cursor, const struct avl_run *run)
+{
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->run = run;
+}
+
+/* Frees the buffers of a cursor.  */
+void
+avl_run_cursor_destroy(struct avl_run_cursor *cursor)
+{
+	free(cursor->buf);
+	free(cursor->key);
+	cursor->buf = NULL;
+	cursor->key = NULL;
+}
+
+static int
+avl_run_cursor_load(struct avl_run_cursor *cursor, size_t block)
+{
+	const struct avl_run_block *b = &cursor->run->blocks[block];
+
+	if (b->size > cursor->buf_size || !cursor->buf) {
+		unsigned char *buf = realloc(cursor->buf, b->size ? b->size : 1);
+
+		if (!buf)
+			return -1;
+		cursor->buf = buf;
+	}
+	if (!avl_pread_all(cursor->run->fd, cursor->buf, b->size, b->offset))
+		return -1;
+
+	cursor->block = block;
+	cursor->buf_size = b->size;
+	cursor->pos = 0;
+	cursor->key_len = 0;
+	return 0;
+}
+
+/* Decodes the entry at the cursor's position in its block.  */
+static int
+avl_run_cursor_decode(struct avl_run_cursor *cursor)
+{
+	const unsigned char *p = cursor->buf + cursor->pos;
+	const unsigned char *end = cursor->buf + cursor->buf_size;
+	uint64_t shared, rest, vlen;
+
+	if (!avl_get_varint(&p, end, &shared) ||
+	    !avl_get_varint(&p, end, &rest) ||
+	    !avl_get_varint(&p, end, &vlen) ||
+	    shared > cursor->key_len || rest > (uint64_t)(end - p) ||
+	    (vlen && vlen - 1 > (uint64_t)(end - p) - rest))
+		return -1;
+
+	if (shared + rest > cursor->key_cap) {
+		unsigned char *key = realloc(cursor->key, shared + rest);
+
+		if (!key)
+			return -1;
+		cursor->key = key;
+		cursor->key_cap = shared + rest;
+	}
+	memcpy(cursor->key + shared, p, rest);
+	cursor->key_len = shared + rest;
+	p += rest;
+
+	cursor->value = p;
+	cursor->value_len = vlen ? vlen - 1 : AVL_MEMTABLE_TOMBSTONE;
+	p += vlen ? vlen - 1 : 0;
+
+	cursor->pos = p - cursor->buf;
+	cursor->valid = true;
+	return 1;
+}
+
+/*
+ * Moves the cursor to the next entry.  Returns 1 if there is one, 0 at the
+ * end of the run, or -1 on an I/O or memory error.
+ */
+int
+avl_run_cursor_next(struct avl_run_cursor *cursor)
+{
+	while (cursor->pos >= cursor->buf_size) {
+		if (cursor->block + 1 >= cursor->run->nblocks) {
+			cursor->valid = false;
+			return 0;
+		}
+		if (avl_run_cursor_load(cursor, cursor->block + 1))
+			return -1;
+	}
+	return avl_run_cursor_decode(cursor);
+}
+
+/*
+ * Positions the cursor at the first entry whose key is not less than @key.
+ * Returns 1 if there is one, 0 if all keys are less, or -1 on an I/O or
+ * memory error.
+ */
+int
+avl_run_cursor_seek(struct avl_run_cursor *cursor, const void *key,
+		    size_t key_len)
+{
+	const struct avl_run *run = cursor->run;
+	size_t lo = 0, hi = run->nblocks;
+	int res;
+
+	if (run->nblocks == 0) {
+		cursor->valid = false;
+		return 0;
+	}
+
+	/* Find the last block starting with a key not greater than @key.  */
+	while (hi - lo > 1) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const struct avl_run_block *b = &run->blocks[mid];
+
+		if (avl_key_cmp(b->first_key, b->first_key_len,
+				key, key_len) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	/* Scan on from the current entry if it is in the right block and not
+	 * past @key, as when looking up keys in increasing order.  */
+	if (cursor->valid && cursor->block == lo &&
+	    (res = avl_key_cmp(cursor->key, cursor->key_len,
+			       key, key_len)) <= 0) {
+		if (res == 0)
+			return 1;
+	} else if (avl_run_cursor_load(cursor, lo)) {
+		cursor->valid = false;
+		return -1;
+	}
+
+	do {
+		res = avl_run_cursor_next(cursor);
+	} while (res == 1 &&
+		 avl_key_cmp(cursor->key, cursor->key_len, key, key_len) < 0);
+	return res;
+}
+
+/*
+ * Looks up @key in a run, using @cursor, which may have been used on another
+ * run before, to read it.  Returns 1 if found, with the entry, possibly a
+ * tombstone, at the cursor; 0 if not found; or -1 on an I/O or memory error.
+ */
+int
+avl_run_get(const struct avl_run *run, struct avl_run_cursor *cursor,
+	    const void *key, size_t key_len)
+{
+	int res;
+
+	if (!avl_run_may_contain(run, key, key_len))
+		return 0;
+
+	if (cursor->run != run) {
+		cursor->run = run;
+		cursor->valid = false;
+	}
+	res = avl_run_cursor_seek(cursor, key, key_len);
+	if (res != 1)
+		return res;
+	return avl_key_cmp(cursor->key, cursor->key_len, key, key_len) == 0;
+}
+
+/*
+ * Log-structured store
+ * ====================
+ *
+ * The state of a store is a reference-counted `struct avl_lsm_version'.  Only
+ * its active memtable changes in place, under the mutex; avl_lsm_freeze() and
+ * avl_lsm_flush() install a new version instead.  Readers take a reference to
+ * the current version under the mutex and then read its frozen memtables and
+ * runs without it, so that file reads, allocations and scan callbacks do not
+ * hold up writers.  A memtable or run is freed along with the last version
+ * holding it.
+ */
+
+/* Allocates a version with room for @nfrozen frozen memtables and @nruns
+ * runs, in one block.  */
+static struct avl_lsm_version *
+avl_lsm_version_new(size_t nfrozen, size_t nruns)
+{
+	struct avl_lsm_version *v;
+
+	v = malloc(sizeof(*v) + nfrozen * sizeof(v->frozen[0]) +
+		   nruns * sizeof(v->runs[0]));
+	if (!v)
+		return NULL;
+	v->refs = 1;
+	v->active = NULL;
+	v->frozen = (struct avl_memtable **)(v + 1);
+	v->nfrozen = nfrozen;
+	v->runs = (struct avl_run **)(v->frozen + nfrozen);
+	v->nruns = nruns;
+	return v;
+}
+
+/*
+ * Drops a reference to @v, with the mutex held.  Returns true if it was the
+ * last one.  @v then holds only the memtables and runs that no other version
+ * holds, and the caller must free it with avl_lsm_version_free() once the
+ * mutex is released.
+ */
+static bool
+avl_lsm_version_unref(struct avl_lsm_version *v)
+{
+	if (--v->refs)
+		return false;
+	if (--v->active->refs)
+		v->active = NULL;
+	for (size_t i = 0; i < v->nfrozen; i++)
+		if (--v->frozen[i]->refs)
+			v->frozen[i] = NULL;
+	for (size_t i = 0; i < v->nruns; i++)
+		if (--v->runs[i]->refs)
+			v->runs[i] = NULL;
+	return true;
+}
+
+static void
+avl_lsm_version_free(struct avl_lsm_version *v)
+{
+	if (v->active) {
+		avl_memtable_destroy(v->active);
+		free(v->active);
+	}
+	for (size_t i = 0; i < v->nfrozen; i++) {
+		if (v->frozen[i]) {
+			avl_memtable_destroy(v->frozen[i]);
+			free(v->frozen[i]);
+		}
+	}
+	for (size_t i = 0; i < v->nruns; i++)
+		if (v->runs[i])
+			avl_run_close(v->runs[i]);
+	free(v);
+}
+
+/* Drops a reference to @v taken by a reader.  */
+static void
+avl_lsm_version_put(struct avl_lsm *lsm, struct avl_lsm_version *v)
+{
+	bool last;
+
+	pthread_mutex_lock(&lsm->lock);
+	last = avl_lsm_version_unref(v);
+	pthread_mutex_unlock(&lsm->lock);
+	if (last)
+		avl_lsm_version_free(v);
+}
+
+/*
+ * Makes @v, whose memtables and runs are set, the current version, with the
+ * mutex held.  Returns the previous version if that was its last reference,
+ * for the caller to pass to avl_lsm_version_free() after unlocking.
+ */
+static struct avl_lsm_version *
+avl_lsm_install(struct avl_lsm *lsm, struct avl_lsm_version *v)
+{
+	struct avl_lsm_version *old = lsm->current;
+
+	v->active->refs++;
+	for (size_t i = 0; i < v->nfrozen; i++)
+		v->frozen[i]->refs++;
+	for (size_t i = 0; i < v->nruns; i++)
+		v->runs[i]->refs++;
+	lsm->current = v;
+	return old && avl_lsm_version_unref(old) ? old : NULL;
+}
+
+/*
+ * Initializes a store with an empty active memtable, no frozen memtables and
+ * no runs.  Returns 0, or -1 with errno set if memory could not be allocated
+ * or the mutex could not be initialized.
+ */
+int
+avl_lsm_init(struct avl_lsm *lsm)
+{
+	struct avl_lsm_version *v = avl_lsm_version_new(0, 0);
+	int err;
+
+	if (!v)
+		return -1;
+	v->active = malloc(sizeof(*v->active));
+	if (!v->active) {
+		free(v);
+		return -1;
+	}
+	*v->active = AVL_MEMTABLE;
+
+	err = pthread_mutex_init(&lsm->lock, NULL);
+	if (err) {
+		free(v->active);
+		free(v);
+		errno = err;
+		return -1;
+	}
+	lsm->current = NULL;
+	avl_lsm_install(lsm, v);
+	return 0;
+}
+
+/* Frees all memtables and closes all runs.  Unflushed data is lost.  No other
+ * thread may be using the store.  */
+void
+avl_lsm_destroy(struct avl_lsm *lsm)
+{
+	if (avl_lsm_version_unref(lsm->current))
+		avl_lsm_version_free(lsm->current);
+	pthread_mutex_destroy(&lsm->lock);
+}
+
+/* As avl_memtable_put(), on the active memtable.  */
+int
+avl_lsm_put(struct avl_lsm *lsm, const void *key, size_t key_len,
+	    const void *value, size_t value_len)
+{
+	int res;
+
+	pthread_mutex_lock(&lsm->lock);
+	res = avl_memtable_put(lsm->current->active, key, key_len,
+			       value, value_len);
+	pthread_mutex_unlock(&lsm->lock);
+	return res;
+}
+
+/* As avl_memtable_delete(), on the active memtable.  */
+int
+avl_lsm_delete(struct avl_lsm *lsm, const void *key, size_t key_len)
+{
+	int res;
+
+	pthread_mutex_lock(&lsm->lock);
+	res = avl_memtable_delete(lsm->current->active, key, key_len);
+	pthread_mutex_unlock(&lsm->lock);
+	return res;
+}
+
+/* Returns the memory used by the active memtable, to decide when to freeze
+ * it.  */
+size_t
+avl_lsm_active_bytes(struct avl_lsm *lsm)
+{
+	size_t bytes;
+
+	pthread_mutex_lock(&lsm->lock);
+	bytes = lsm->current->active->bytes;
+	pthread_mutex_unlock(&lsm->lock);
+	return bytes;
+}
+
+static int
+avl_lsm_copy_value(const void *value, size_t value_len,
+		   void **value_ret, size_t *value_len_ret)
+{
+	if (value_len == AVL_MEMTABLE_TOMBSTONE)
+		return 0;
+
+	*value_ret = malloc(value_len ? value_len : 1);
+	if (!*value_ret)
+		return -1;
+	memcpy(*value_ret, value, value_len);
+	*value_len_ret = value_len;
+	return 1;
+}
+
+/*
+ * Looks up @key in the newest memtable or run that has it.  Only the lookup
+ * in the active memtable holds the store's mutex; the frozen memtables and
+ * runs, and their file reads, are searched without it.
+ *
+ * Returns 1 if the key has a value, which is copied into a buffer returned in
+ * *value_ret that the caller must free(); 0 if the key is absent or deleted;
+ * or -1 on an I/O or memory error.
+ */
+int
+avl_lsm_get(struct avl_lsm *lsm, const void *key, size_t key_len,
+	    void **value_ret, size_t *value_len_ret)
+{
+	const struct avl_memtable_entry *entry;
+	struct avl_lsm_version *v;
+	struct avl_run_cursor cursor;
+	void *buf = NULL;
+	size_t size = 0;
+	int res = 0;
+
+	/* A writer may replace and free the entry as soon as the mutex is
+	 * released, so the value is copied under it, into a buffer allocated
+	 * without it.  */
+	pthread_mutex_lock(&lsm->lock);
+	while ((entry = avl_memtable_get(lsm->current->active, key, key_len)) &&
+	       entry->value_len != AVL_MEMTABLE_TOMBSTONE &&
+	       (!buf || entry->value_len > size)) {
+		size = entry->value_len;
+		pthread_mutex_unlock(&lsm->lock);
+		free(buf);
+		buf = malloc(size ? size : 1);
+		if (!buf)
+			return -1;
+		pthread_mutex_lock(&lsm->lock);
+	}
+	if (entry) {
+		if (entry->value_len != AVL_MEMTABLE_TOMBSTONE) {
+			memcpy(buf, avl_memtable_entry_value(entry),
+			       entry->value_len);
+			*value_ret = buf;
+			*value_len_ret = entry->value_len;
+			buf = NULL;
+			res = 1;
+		}
+		pthread_mutex_unlock(&lsm->lock);
+		free(buf);
+		return res;
+	}
+	v = lsm->current;
+	v->refs++;
+	pthread_mutex_unlock(&lsm->lock);
+	free(buf);
+
+	for (size_t i = 0; !entry && i < v->nfrozen; i++)
+		entry = avl_memtable_get(v->frozen[i], key, key_len);
+
+	if (entry) {
+		res = avl_lsm_copy_value(avl_memtable_entry_value(entry),
+					 entry->value_len,
+					 value_ret, value_len_ret);
+		goto out;
+	}
+
+	avl_run_cursor_init(&cursor, NULL);
+	for (size_t i = 0; i < v->nruns; i++) {
+		res = avl_run_get(v->runs[i], &cursor, key, key_len);
+		if (res == 1) {
+			res = avl_lsm_copy_value(cursor.value,
+						 cursor.value_len,
+						 value_ret, value_len_ret);
+			break;
+		}
+		if (res < 0)
+			break;
+	}
+	avl_run_cursor_destroy(&cursor);
+out:
+	avl_lsm_version_put(lsm, v);
+	return res;
+}
+
+/*
+ * Freezes the active memtable and replaces it with an empty one.  The new
+ * version copies only pointers, so this takes time in the number of frozen
+ * memtables and runs, not entries.  Returns 1 if a memtable was frozen, 0 if
+ * the active one was empty, or -1 if memory could not be allocated.
+ */
+int
+avl_lsm_freeze(struct avl_lsm *lsm)
+{
+	struct avl_memtable *mt = malloc(sizeof(*mt));
+	struct avl_lsm_version *cur, *v, *old = NULL;
+	int res = 1;
+
+	if (!mt)
+		return -1;
+	*mt = AVL_MEMTABLE;
+
+	pthread_mutex_lock(&lsm->lock);
+	cur = lsm->current;
+	if (!cur->active->count) {
+		res = 0;
+	} else if (!(v = avl_lsm_version_new(cur->nfrozen + 1, cur->nruns))) {
+		res = -1;
+	} else {
+		v->active = mt;
+		v->frozen[0] = cur->active;
+		memcpy(v->frozen + 1, cur->frozen,
+		       cur->nfrozen * sizeof(v->frozen[0]));
+		memcpy(v->runs, cur->runs, cur->nruns * sizeof(v->runs[0]));
+		old = avl_lsm_install(lsm, v);
+		mt = NULL;
+	}
+	pthread_mutex_unlock(&lsm->lock);
+
+	if (old)
+		avl_lsm_version_free(old);
+	free(mt);
+	return res;
+}
+
+/*
+ * Writes the oldest frozen memtable to a new run file at @path, then replaces
+ * the memtable with the run.  The file is written without holding the store's
+ * mutex, so that other threads can keep reading and writing.  Only one thread
+ * at a time may flush.  The memtable is freed once no reader uses it.
+ *
+ * Returns 1 if a memtable was flushed, 0 if there was none, or -1 on error,
+ * in which case the memtable stays frozen.
+ */
+int
+avl_lsm_flush(struct avl_lsm *lsm, const char *path)
+{
+	struct avl_lsm_version *cur, *v, *old;
+	struct avl_memtable *mt = NULL;
+	struct avl_run *run;
+
+	pthread_mutex_lock(&lsm->lock);
+	cur = lsm->current;
+	if (cur->nfrozen)
+		mt = cur->frozen[cur->nfrozen - 1];
+	pthread_mutex_unlock(&lsm->lock);
+
+	if (!mt)
+		return 0;
+
+	/* Frozen memtables never change, and only the flushing thread drops
+	 * them from the current version, so this needs no reference.  */
+	if (avl_memtable_write_run(mt, path))
+		return -1;
+	run = avl_run_open(path);
+	if (!run)
+		return -1;
+
+	/* Newer memtables may have been frozen meanwhile, but @mt is still
+	 * the oldest one.  */
+	pthread_mutex_lock(&lsm->lock);
+	cur = lsm->current;
+	v = avl_lsm_version_new(cur->nfrozen - 1, cur->nruns + 1);
+	if (!v) {
+		pthread_mutex_unlock(&lsm->lock);
+		avl_run_close(run);
+		return -1;
+	}
+	v->active = cur->active;
+	memcpy(v->frozen, cur->frozen, v->nfrozen * sizeof(v->frozen[0]));
+	v->runs[0] = run;
+	memcpy(v->runs + 1, cur->runs, cur->nruns * sizeof(v->runs[0]));
+	old = avl_lsm_install(lsm, v);
+	pthread_mutex_unlock(&lsm->lock);
+
+	if (old)
+		avl_lsm_version_free(old);
+	return 1;
+}
+
+/* One input of a merged scan: the active memtable, a frozen memtable or a
+ * run.  Writers may change the active memtable during the scan, so its
+ * current entry is copied into @buf under the store's mutex.  */
+struct avl_lsm_source {
+	const struct avl_memtable *active;
+	unsigned char *buf;		/* key, then value  */
+	size_t buf_size;
+	size_t key_len;
+	size_t value_len;
+	struct avl_tree_node *node;	/* frozen memtables  */
+	struct avl_run_cursor cursor;	/* runs  */
+	bool is_run;
+	bool valid;
+};
+
+/*
+ * Copies into @src the first entry of its active memtable with a key greater
+ * than the one in its buffer, or equal too if @inclusive.  The buffer is grown
+ * without holding the mutex, after which the search is redone.  Returns 0, or
+ * -1 if memory could not be allocated.
+ */
+static int
+avl_lsm_source_load(struct avl_lsm *lsm, struct avl_lsm_source *src,
+		    bool inclusive)
+{
+	const struct avl_memtable_entry *entry;
+	struct avl_tree_node *node;
+	unsigned char *buf;
+	size_t size;
+
+	pthread_mutex_lock(&lsm->lock);
+	for (;;) {
+		node = avl_memtable_seek(src->active, src->buf, src->key_len);
+		if (node && !inclusive &&
+		    avl_entry_cmp(src->buf, src->key_len, node) == 0)
+			node = avl_tree_next_in_order(node);
+		src->valid = node != NULL;
+		if (!node)
+			break;
+
+		entry = AVL_MEMTABLE_ENTRY(node);
+		size = entry->key_len;
+		if (entry->value_len != AVL_MEMTABLE_TOMBSTONE)
+			size += entry->value_len;
+		if (size <= src->buf_size) {
+			memcpy(src->buf, entry->data, size);
+			src->key_len = entry->key_len;
+			src->value_len = entry->value_len;
+			break;
+		}
+
+		pthread_mutex_unlock(&lsm->lock);
+		buf = malloc(size);
+		if (!buf) {
+			src->valid = false;
+			return -1;
+		}
+		memcpy(buf, src->buf, src->key_len);
+		free(src->buf);
+		src->buf = buf;
+		src->buf_size = size;
+		pthread_mutex_lock(&lsm->lock);
+	}
+	pthread_mutex_unlock(&lsm->lock);
+	return 0;
+}
+
+static void
+avl_lsm_source_entry(const struct avl_lsm_source *src,
+		     const unsigned char **key, size_t *key_len,
+		     const unsigned char **value, size_t *value_len)
+{
+	if (src->active) {
+		*key = src->buf;
+		*key_len = src->key_len;
+		*value = src->buf + src->key_len;
+		*value_len = src->value_len;
+	} else if (src->is_run) {
+		*key = src->cursor.key;
+		*key_len = src->cursor.key_len;
+		*value = src->cursor.value;
+		*value_len = src->cursor.value_len;
+	} else {
+		const struct avl_memtable_entry *entry =
+			AVL_MEMTABLE_ENTRY(src->node);
+
+		*key = avl_memtable_entry_key(entry);
+		*key_len = entry->key_len;
+		*value = avl_memtable_entry_value(entry);
+		*value_len = entry->value_len;
+	}
+}
+
+static int
+avl_lsm_source_next(struct avl_lsm *lsm, struct avl_lsm_source *src)
+{
+	int res;
+
+	if (src->active)
+		return avl_lsm_source_load(lsm, src, false);
+	if (!src->is_run) {
+		src->node = avl_tree_next_in_order(src->node);
+		src->valid = src->node != NULL;
+		return 0;
+	}
+	res = avl_run_cursor_next(&src->cursor);
+	src->valid = res == 1;
+	return res < 0 ? -1 : 0;
+}
+
+/*
+ * Visits the live keys of the store in increasing order, merging all
+ * memtables and runs.  For each key only the newest entry counts, and keys
+ * whose newest entry is a tombstone are skipped.
+ *
+ * @start, @start_len
+ *	First key to visit, or NULL to start at the lowest key.
+ *
+ * @visit
+ *	Called for each key with its value and @ctx.  Returning nonzero stops
+ *	the scan.
+ *
+ * The scan reads the memtables and runs of the version current when it
+ * starts.  Only the steps through the active memtable take the store's mutex,
+ * one entry at a time; run reads and @visit run without it, so @visit may
+ * itself write to, freeze or flush the store.  Writes made during the scan
+ * may or may not be visited.  Returns the last value returned by @visit, or
+ * -1 on an I/O or memory error.
+ */
+int
+avl_lsm_scan(struct avl_lsm *lsm, const void *start, size_t start_len,
+	     int (*visit)(const void *key, size_t key_len,
+			  const void *value, size_t value_len, void *ctx),
+	     void *ctx)
+{
+	struct avl_lsm_version *version;
+	struct avl_lsm_source *srcs;
+	size_t nsrcs, n = 0;
+	int res = 0;
+
+	if (!start)
+		start = "";
+
+	pthread_mutex_lock(&lsm->lock);
+	version = lsm->current;
+	version->refs++;
+	pthread_mutex_unlock(&lsm->lock);
+
+	nsrcs = 1 + version->nfrozen + version->nruns;
+	srcs = calloc(nsrcs, sizeof(srcs[0]));
+	if (!srcs) {
+		avl_lsm_version_put(lsm, version);
+		return -1;
+	}
+
+	/* Sources are ordered newest first, so that on equal keys the lowest
+	 * index wins.  The active memtable starts from a copy of @start.  */
+	srcs[n].active = version->active;
+	srcs[n].buf = malloc(start_len ? start_len : 1);
+	if (srcs[n].buf) {
+		memcpy(srcs[n].buf, start, start_len);
+		srcs[n].buf_size = start_len;
+		srcs[n].key_len = start_len;
+		res = avl_lsm_source_load(lsm, &srcs[n], true);
+	} else {
+		res = -1;
+	}
+	n++;
+	for (size_t i = 0; i < version->nfrozen; i++, n++) {
+		srcs[n].node = avl_memtable_seek(version->frozen[i],
+						 start, start_len);
+		srcs[n].valid = srcs[n].node != NULL;
+	}
+	for (size_t i = 0; i < version->nruns; i++, n++) {
+		srcs[n].is_run = true;
+		avl_run_cursor_init(&srcs[n].cursor, version->runs[i]);
+		if (res == 0) {
+			const int seek = avl_run_cursor_seek(&srcs[n].cursor,
+							     start, start_len);
+
+			srcs[n].valid = seek == 1;
+			if (seek < 0)
+				res = -1;
+		}
+	}
+
+	while (res == 0) {
+		const unsigned char *key = NULL, *value = NULL, *k, *v;
+		size_t key_len = 0, value_len = 0, kl, vl;
+		size_t best = nsrcs;
+
+		for (size_t i = 0; i < nsrcs; i++) {
+			if (!srcs[i].valid)
+				continue;
+			avl_lsm_source_entry(&srcs[i], &k, &kl, &v, &vl);
+			if (best == nsrcs ||
+			    avl_key_cmp(k, kl, key, key_len) < 0) {
+				best = i;
+				key = k;
+				key_len = kl;
+				value = v;
+				value_len = vl;
+			}
+		}
+		if (best == nsrcs)
+			break;
+
+		if (value_len != AVL_MEMTABLE_TOMBSTONE)
+			res = (*visit)(key, key_len, value, value_len, ctx);
+
+		/* Skip the older entries of the same key, then the newest
+		 * one, whose key buffer the others were compared with.  */
+		for (size_t i = best + 1; res == 0 && i < nsrcs; i++) {
+			if (!srcs[i].valid)
+				continue;
+			avl_lsm_source_entry(&srcs[i], &k, &kl, &v, &vl);
+			if (avl_key_cmp(k, kl, key, key_len) == 0)
+				res = avl_lsm_source_next(lsm, &srcs[i]);
+		}
+		if (res == 0)
+			res = avl_lsm_source_next(lsm, &srcs[best]);
+	}
+
+	for (size_t i = 0; i < nsrcs; i++)
+		if (srcs[i].is_run)
+			avl_run_cursor_destroy(&srcs[i].cursor);
+	free(srcs[0].buf);
+	free(srcs);
+	avl_lsm_version_put(lsm, version);
+	return res;
+}
@@ -0,0 +1,200 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree memtables and sorted run files
+ * =======================================
+ */
+
+#ifndef _AVL_MEMTABLE_H
+#define _AVL_MEMTABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* value_len of an entry which records a deletion  */
+#define AVL_MEMTABLE_TOMBSTONE	SIZE_MAX
+
+/* A key-value pair, allocated by the memtable.  */
+struct avl_memtable_entry {
+	struct avl_tree_node node;
+	size_t key_len;
+	size_t value_len;
+	unsigned char data[];		/* key, then value  */
+};
+
+#define avl_memtable_entry_key(entry)	((entry)->data)
+#define avl_memtable_entry_value(entry)	((entry)->data + (entry)->key_len)
+
+/* In-memory write buffer: an AVL tree of entries with unique byte-string
+ * keys, ordered as by memcmp() with shorter keys first on ties.  */
+struct avl_memtable {
+	struct avl_tree_root root;
+	size_t count;
+
+	/* Memory used by the entries  */
+	size_t bytes;
+
+	/* Number of `avl_lsm_version's holding the memtable  */
+	unsigned long refs;
+};
+
+#define AVL_MEMTABLE  (struct avl_memtable) {{NULL, }, 0, 0, 0}
+
+/* Sparse index entry of a run file: the first key of each data block.  */
+struct avl_run_block {
+	uint64_t offset;
+	uint64_t size;
+	const unsigned char *first_key;
+	size_t first_key_len;
+};
+
+/* A sorted run file opened for reading.  */
+struct avl_run {
+	int fd;
+	uint64_t count;
+	struct avl_run_block *blocks;
+	size_t nblocks;
+	unsigned char *index;		/* holds the first keys  */
+	unsigned char *bloom;
+	uint64_t bloom_bits;
+	unsigned int bloom_hashes;
+
+	/* Number of `avl_lsm_version's holding the run  */
+	unsigned long refs;
+};
+
+/* Position in a run file, with the current entry decoded.  */
+struct avl_run_cursor {
+	const struct avl_run *run;
+	size_t block;			/* index of the loaded block  */
+	unsigned char *buf;
+	size_t buf_size;
+	size_t pos;			/* offset of the next entry in buf  */
+
+	unsigned char *key;
+	size_t key_len;
+	size_t key_cap;
+	const unsigned char *value;
+	size_t value_len;		/* AVL_MEMTABLE_TOMBSTONE if deleted  */
+	bool valid;
+};
+
+/* The memtables and runs making up an `avl_lsm' at some point: an active
+ * memtable taking writes, frozen memtables waiting to be flushed, and run
+ * files, each newer than the ones after it.  Freezing and flushing replace the
+ * store's version with a new one; readers hold a reference to the version they
+ * started with, which keeps its memtables and runs alive.  */
+struct avl_lsm_version {
+	unsigned long refs;
+	struct avl_memtable *active;
+	struct avl_memtable **frozen;	/* newest first  */
+	size_t nfrozen;
+	struct avl_run **runs;		/* newest first  */
+	size_t nruns;
+};
+
+/* A log-structured store.  The mutex protects @current, the reference counts
+ * and the active memtable.  */
+struct avl_lsm {
+	pthread_mutex_t lock;
+	struct avl_lsm_version *current;
+};
+
+int
+avl_memtable_put(struct avl_memtable *mt, const void *key, size_t key_len,
+                 const void *value, size_t value_len);
+
+int
+avl_memtable_delete(struct avl_memtable *mt, const void *key, size_t key_len);
+
+const struct avl_memtable_entry *
+avl_memtable_get(const struct avl_memtable *mt, const void *key,
+                 size_t key_len);
+
+void
+avl_memtable_destroy(struct avl_memtable *mt);
+
+int
+avl_memtable_write_run(const struct avl_memtable *mt, const char *path);
+
+struct avl_run *
+avl_run_open(const char *path);
+
+void
+avl_run_close(struct avl_run *run);
+
+void
+avl_run_cursor_init(struct avl_run_cursor *cursor, const struct avl_run *run);
+
+void
+avl_run_cursor_destroy(struct avl_run_cursor *cursor);
+
+int
+avl_run_cursor_seek(struct avl_run_cursor *cursor, const void *key,
+                    size_t key_len);
+
+int
+avl_run_cursor_next(struct avl_run_cursor *cursor);
+
+int
+avl_run_get(const struct avl_run *run, struct avl_run_cursor *cursor,
+            const void *key, size_t key_len);
+
+int
+avl_lsm_init(struct avl_lsm *lsm);
+
+void
+avl_lsm_destroy(struct avl_lsm *lsm);
+
+int
+avl_lsm_put(struct avl_lsm *lsm, const void *key, size_t key_len,
+            const void *value, size_t value_len);
+
+int
+avl_lsm_delete(struct avl_lsm *lsm, const void *key, size_t key_len);
+
+size_t
+avl_lsm_active_bytes(struct avl_lsm *lsm);
+
+int
+avl_lsm_get(struct avl_lsm *lsm, const void *key, size_t key_len,
+            void **value_ret, size_t *value_len_ret);
+
+int
+avl_lsm_freeze(struct avl_lsm *lsm);
+
+int
+avl_lsm_flush(struct avl_lsm *lsm, const char *path);
+
+int
+avl_lsm_scan(struct avl_lsm *lsm, const void *start, size_t start_len,
+             int (*visit)(const void *key, size_t key_len,
+                          const void *value, size_t value_len, void *ctx),
+             void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_MEMTABLE_H */
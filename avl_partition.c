@@ -0,0 +1,257 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree partitioning and parallel traversal
+ * ============================================
+ *
+ * The nodes of the top levels of an AVL tree split its in-order sequence into
+ * pieces.  Picking evenly spaced nodes from those levels as boundaries gives
+ * disjoint, key-ordered ranges which different threads can walk at the same
+ * time with avl_tree_next_in_order(), without any further coordination.
+ *
+ * The ranges are balanced only roughly.  The two subtrees of a node differ in
+ * height by at most one, but not in size by a bounded amount: a perfect
+ * subtree of height h, with 2^h - 1 nodes, can sit next to a minimal one of
+ * height h - 1, with F(h + 1) - 1 nodes (F being the Fibonacci numbers), a
+ * factor of about 1.24^h fewer.  The sizes of the ranges are thus within a
+ * constant factor of each other, but one which grows with the depth of the
+ * boundaries, so callers such as avl_tree_reduce_parallel() and
+ * avl_tree_diff_parallel() must not count on the same amount of work per
+ * range.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "avl_partition.h"
+#include "avl_traversal.h"
+
+/* Deepest level (counting the root as level 0) used to pick boundaries.  */
+#define AVL_PARTITION_MAX_LEVELS	24
+
+/* Continues an in-order traversal of the tree truncated to its first
+ * @max_levels levels.  *@level tracks the level of the current node.  */
+static const struct avl_tree_node *
+avl_partition_next(const struct avl_tree_node *node, int *level,
+		   int max_levels)
+{
+	const struct avl_tree_node *next;
+
+	if (node->right && *level + 1 < max_levels) {
+		next = node->right;
+		(*level)++;
+		while (next->left && *level + 1 < max_levels) {
+			next = next->left;
+			(*level)++;
+		}
+		return next;
+	}
+
+	for (next = avl_get_parent(node);
+	     next && node == next->right;
+	     node = next, next = avl_get_parent(next))
+		(*level)--;
+	(*level)--;
+	return next;
+}
+
+/* Starts an in-order traversal of the tree truncated to its first @max_levels
+ * levels.  */
+static const struct avl_tree_node *
+avl_partition_first(const struct avl_tree_root *root, int *level,
+		    int max_levels)
+{
+	const struct avl_tree_node *first = root->avl_tree_node;
+
+	*level = 0;
+	if (first) {
+		while (first->left && *level + 1 < max_levels) {
+			first = first->left;
+			(*level)++;
+		}
+	}
+	return first;
+}
+
+/*
+ * Splits an AVL tree into disjoint ranges of roughly balanced sizes (see
+ * above).
+ *
+ * @root
+ *	Root of the AVL tree.
+ *
+ * @ranges
+ *	Array which receives the ranges, in key order.
+ *
+ * @nranges
+ *	Number of ranges wanted; the size of @ranges.
+ *
+ * Returns the number of ranges actually stored, which is less than @nranges
+ * only if the tree is too small to be split that many ways (and 0 if it is
+ * empty).  Together the ranges cover the whole tree.  This takes O(nranges)
+ * time and does not modify the tree.
+ */
+unsigned int
+avl_tree_partition(const struct avl_tree_root *root,
+		   struct avl_tree_range *ranges, unsigned int nranges)
+{
+	const struct avl_tree_node *cur;
+	unsigned long candidates = 0, idx = 0;
+	unsigned int count = 0;
+	int levels = 1, level;
+
+	if (!root->avl_tree_node || nranges == 0)
+		return 0;
+
+	/* One level more than strictly needed, so the boundaries can be
+	 * spaced more evenly.  */
+	while (levels < AVL_PARTITION_MAX_LEVELS &&
+	       (1UL << (levels - 1)) < nranges)
+		levels++;
+
+	for (cur = avl_partition_first(root, &level, levels); cur;
+	     cur = avl_partition_next(cur, &level, levels))
+		candidates++;
+
+	if (nranges > candidates + 1)
+		nranges = candidates + 1;
+
+	ranges[0].first = avl_tree_first_in_order(root);
+
+	/* Boundary j (1 <= j < nranges) is candidate number
+	 * j * (candidates + 1) / nranges - 1, counting from 0.  These are
+	 * strictly increasing because nranges <= candidates + 1.  */
+	for (cur = avl_partition_first(root, &level, levels); cur;
+	     cur = avl_partition_next(cur, &level, levels), idx++) {
+		if (count + 1 < nranges &&
+		    idx == (count + 1) * (candidates + 1) / nranges - 1) {
+			ranges[count].end = (struct avl_tree_node *)cur;
+			ranges[++count].first = (struct avl_tree_node *)cur;
+		}
+	}
+	ranges[count++].end = NULL;
+
+	return count;
+}
+
+struct avl_reduce_job {
+	struct avl_tree_range range;
+	void (*visit)(struct avl_tree_node *node, void *acc);
+	void *acc;
+	pthread_t thread;
+	bool started;
+};
+
+static void *
+avl_reduce_thread(void *arg)
+{
+	struct avl_reduce_job *job = arg;
+	struct avl_tree_node *cur;
+
+	for (cur = job->range.first; cur != job->range.end;
+	     cur = avl_tree_next_in_order(cur))
+		(*job->visit)(cur, job->acc);
+	return NULL;
+}
+
+/*
+ * Visits every node of an AVL tree using several threads, optionally reducing
+ * per-thread results to one.
+ *
+ * @root
+ *	Root of the AVL tree.  It must not be modified until this returns.
+ *
+ * @nranges
+ *	Number of ranges to split the tree into with avl_tree_partition().
+ *	Each range is walked by its own thread, the first one by the calling
+ *	thread.
+ *
+ * @visit
+ *	Callback run on each node, in key order within a range.  The second
+ *	argument is the accumulator of the range the node belongs to.
+ *
+ * @accs
+ *	Array of @nranges accumulators of @acc_size bytes each, initialized by
+ *	the caller.  May be NULL if @acc_size is 0, in which case @visit
+ *	receives NULL.
+ *
+ * @combine
+ *	If not NULL, called after all ranges are done to fold the accumulator
+ *	of each range, in key order, into the first one.  The first argument
+ *	is the first accumulator and the second one that of the next range.
+ *
+ * Returns the number of ranges used, as for avl_tree_partition().  If a thread
+ * cannot be started, its range is walked by the calling thread instead.  The
+ * ranges need not take the same time, so the slowest one sets the pace.
+ */
+unsigned int
+avl_tree_reduce_parallel(const struct avl_tree_root *root,
+			 unsigned int nranges,
+			 void (*visit)(struct avl_tree_node *node, void *acc),
+			 void *accs, size_t acc_size,
+			 void (*combine)(void *acc, const void *next))
+{
+	struct avl_tree_range *ranges, one_range;
+	struct avl_reduce_job *jobs, one_job;
+	unsigned int count, i;
+
+	if (nranges == 0)
+		return 0;
+
+	ranges = malloc(nranges * sizeof(ranges[0]));
+	jobs = malloc(nranges * sizeof(jobs[0]));
+	if (!ranges || !jobs) {
+		/* Walk the whole tree as a single range.  */
+		free(ranges);
+		free(jobs);
+		ranges = &one_range;
+		jobs = &one_job;
+		nranges = 1;
+	}
+
+	count = avl_tree_partition(root, ranges, nranges);
+
+	for (i = 0; i < count; i++) {
+		jobs[i].range = ranges[i];
+		jobs[i].visit = visit;
+		jobs[i].acc = acc_size ? (char *)accs + i * acc_size : NULL;
+		jobs[i].started = i > 0 &&
+			pthread_create(&jobs[i].thread, NULL,
+				       avl_reduce_thread, &jobs[i]) == 0;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!jobs[i].started)
+			avl_reduce_thread(&jobs[i]);
+
+	for (i = 0; i < count; i++)
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+
+	if (combine)
+		for (i = 1; i < count; i++)
+			(*combine)(accs, (char *)accs + i * acc_size);
+
+	if (jobs != &one_job) {
+		free(jobs);
+		free(ranges);
+	}
+	return count;
+}
@@ -0,0 +1,70 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree partitioning and parallel traversal
+ * ============================================
+ */
+
+#ifndef _AVL_PARTITION_H
+#define _AVL_PARTITION_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A run of consecutive nodes of an AVL tree, in in-order.  */
+struct avl_tree_range {
+	/* First node in the range  */
+	struct avl_tree_node *first;
+
+	/* Node following the last one in the range, or NULL if the range
+	 * extends to the end of the tree  */
+	struct avl_tree_node *end;
+};
+
+/*
+ * Iterate through the nodes of a range in sorted order.  The arguments are as
+ * for avl_tree_for_each_in_order(), except for @range, a pointer to a
+ * `struct avl_tree_range'.  You may not modify the tree during the iteration.
+ */
+#define avl_tree_for_each_in_range(child_struct, range,             \
+	                           struct_name, struct_member)      \
+	for (struct avl_tree_node *_cur = (range)->first;           \
+	     _cur != (range)->end &&                                \
+	     ((child_struct) =                                      \
+	      avl_tree_entry(_cur, struct_name, struct_member), 1); \
+	     _cur = avl_tree_next_in_order(_cur))
+
+unsigned int
+avl_tree_partition(const struct avl_tree_root *root,
+                   struct avl_tree_range *ranges, unsigned int nranges);
+
+unsigned int
+avl_tree_reduce_parallel(const struct avl_tree_root *root,
+                         unsigned int nranges,
+                         void (*visit)(struct avl_tree_node *node, void *acc),
+                         void *accs, size_t acc_size,
+                         void (*combine)(void *acc, const void *next));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_PARTITION_H */
@@ -0,0 +1,252 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Radix-directed AVL trees for integer keys
+ * =========================================
+ *
+ * With dense integer keys, the first levels of every descent in one big tree
+ * only find out what the high bits of the key already say.  Here those bits
+ * index a table of independent AVL trees instead, each holding the items of
+ * one key prefix, so a lookup is one table load followed by a descent of a
+ * small tree.
+ *
+ * Keys are taken to be below 2^key_bits; larger ones all go to the last slot,
+ * which keeps the slots in key order.  The table doubles when there are more
+ * than AVL_RADIX_LOAD items per slot on average, each tree being split in two
+ * at the new prefix boundary with avl_tree_split(), so the trees stay about
+ * log2(AVL_RADIX_LOAD) levels high however many items there are, up to
+ * AVL_RADIX_MAX_BITS bits of table.  In-order iteration goes through the
+ * slots in order.
+ */
+
+#include <stdlib.h>
+
+#include "avl_radix.h"
+#include "avl_traversal.h"
+
+#define AVL_RADIX_MIN_BITS	4
+#define AVL_RADIX_MAX_BITS	24
+
+/* Average number of items per slot above which the table grows  */
+#define AVL_RADIX_LOAD		16
+
+/* Returns the slot of the items with key @key.  */
+static AVL_INLINE size_t
+avl_radix_slot(const struct avl_radix_tree *tree, unsigned long key)
+{
+	const unsigned int shift = tree->key_bits - tree->bits;
+	const size_t last = ((size_t)1 << tree->bits) - 1;
+
+	if (shift >= 8 * sizeof(key))
+		return 0;
+	key >>= shift;
+	return key < last ? key : last;
+}
+
+struct avl_radix_boundary {
+	const struct avl_radix_tree *tree;
+	unsigned long key;
+};
+
+/* Comparison callback for avl_tree_split(), against a slot boundary.  */
+static int
+avl_radix_cmp_boundary(const void *boundary, const struct avl_tree_node *node)
+{
+	const struct avl_radix_boundary *b = boundary;
+	const unsigned long node_key = avl_radix_key(b->tree, node);
+
+	return (b->key > node_key) - (b->key < node_key);
+}
+
+/* Doubles the table (or allocates the first one), splitting each tree in two.
+ * Returns false if memory could not be allocated.  */
+static bool
+avl_radix_grow(struct avl_radix_tree *tree)
+{
+	struct avl_tree_root *old = tree->slots;
+	const size_t old_size = old ? (size_t)1 << tree->bits : 0;
+	const unsigned int bits = old ? tree->bits + 1 : AVL_RADIX_MIN_BITS;
+	struct avl_tree_root *slots;
+
+	slots = calloc((size_t)1 << bits, sizeof(slots[0]));
+	if (!slots)
+		return false;
+	tree->slots = slots;
+	tree->bits = bits;
+
+	for (size_t i = 0; i < old_size; i++) {
+		/* Keys from the new odd slot on go right.  */
+		const struct avl_radix_boundary boundary = {
+			.tree = tree,
+			.key = (unsigned long)(2 * i + 1) <<
+			       (tree->key_bits - bits),
+		};
+
+		avl_tree_split(&old[i], &boundary, avl_radix_cmp_boundary,
+			       &slots[2 * i], &slots[2 * i + 1]);
+	}
+	free(old);
+	return true;
+}
+
+/*
+ * Initializes an empty radix-directed tree.
+ *
+ * @key_offset
+ *	Offset of the `unsigned long' key of each item from its `struct
+ *	avl_tree_node', as computed by AVL_RADIX_KEY_OFFSET().
+ *
+ * @key_bits
+ *	Number of low-order bits the keys use: the table is indexed by the
+ *	highest of those.  Keys may exceed this range, but then they all
+ *	share the last slot.
+ *
+ * No memory is allocated until the first insertion.
+ */
+void
+avl_radix_tree_init(struct avl_radix_tree *tree, ptrdiff_t key_offset,
+		    unsigned int key_bits)
+{
+	tree->slots = NULL;
+	tree->bits = 0;
+	tree->key_bits = key_bits < 8 * sizeof(unsigned long) ?
+			 key_bits : 8 * sizeof(unsigned long);
+	tree->count = 0;
+	tree->key_offset = key_offset;
+}
+
+/* Frees the table and leaves the tree empty.  The items themselves are not
+ * freed.  */
+void
+avl_radix_tree_destroy(struct avl_radix_tree *tree)
+{
+	free(tree->slots);
+	avl_radix_tree_init(tree, tree->key_offset, tree->key_bits);
+}
+
+/*
+ * Inserts an item into a radix-directed tree.
+ *
+ * Returns 0 if @item was inserted.  If an item with the same key is already in
+ * the tree, returns 1 and sets *@dup_ret (if @dup_ret is not NULL) to it.
+ * Returns -1, and changes nothing, if the first table could not be allocated;
+ * failing to grow the table later only makes the trees higher.
+ */
+int
+avl_radix_tree_insert(struct avl_radix_tree *tree, struct avl_tree_node *item,
+		      struct avl_tree_node **dup_ret)
+{
+	const unsigned long key = avl_radix_key(tree, item);
+	struct avl_tree_link link;
+	struct avl_tree_node **current;
+	struct avl_tree_root *slot;
+
+	if (!tree->slots && !avl_radix_grow(tree))
+		return -1;
+
+	slot = &tree->slots[avl_radix_slot(tree, key)];
+	current = &slot->avl_tree_node;
+	tree_search_for_each (&link, current) {
+		const unsigned long cur_key = avl_radix_key(tree, *current);
+
+		if (key < cur_key) {
+			current = &(*current)->left;
+		} else if (key > cur_key) {
+			current = &(*current)->right;
+		} else {
+			if (dup_ret)
+				*dup_ret = *current;
+			return 1;
+		}
+	}
+	avl_tree_link_node(slot, &link, item);
+	tree->count++;
+
+	if (tree->count > ((size_t)AVL_RADIX_LOAD << tree->bits) &&
+	    tree->bits < AVL_RADIX_MAX_BITS && tree->bits < tree->key_bits)
+		avl_radix_grow(tree);
+	return 0;
+}
+
+/* Removes an item from a radix-directed tree.  As with avl_tree_remove(), no
+ * memory is freed.  */
+void
+avl_radix_tree_remove(struct avl_radix_tree *tree, struct avl_tree_node *node)
+{
+	avl_tree_remove(&tree->slots[avl_radix_slot(tree,
+						     avl_radix_key(tree, node))],
+			node);
+	tree->count--;
+}
+
+/* Returns the node of the item with key @key, or NULL if there is none.  */
+struct avl_tree_node *
+avl_radix_tree_lookup(const struct avl_radix_tree *tree, unsigned long key)
+{
+	struct avl_tree_node *cur;
+
+	if (!tree->slots)
+		return NULL;
+
+	cur = tree->slots[avl_radix_slot(tree, key)].avl_tree_node;
+	while (cur) {
+		const unsigned long cur_key = avl_radix_key(tree, cur);
+
+		if (key < cur_key)
+			cur = cur->left;
+		else if (key > cur_key)
+			cur = cur->right;
+		else
+			break;
+	}
+	return cur;
+}
+
+/* Returns the first item in the slots from @i on, or NULL.  */
+static struct avl_tree_node *
+avl_radix_first_from(const struct avl_radix_tree *tree, size_t i)
+{
+	const size_t size = tree->slots ? (size_t)1 << tree->bits : 0;
+
+	for (; i < size; i++)
+		if (tree->slots[i].avl_tree_node)
+			return avl_tree_first_in_order(&tree->slots[i]);
+	return NULL;
+}
+
+/* Returns the item with the smallest key, or NULL if the tree is empty.  */
+struct avl_tree_node *
+avl_radix_tree_first(const struct avl_radix_tree *tree)
+{
+	return avl_radix_first_from(tree, 0);
+}
+
+/* Returns the item after @node in key order, or NULL if @node is the last
+ * one.  The tree may not be modified between calls.  */
+struct avl_tree_node *
+avl_radix_tree_next(const struct avl_radix_tree *tree,
+		    const struct avl_tree_node *node)
+{
+	struct avl_tree_node *next = avl_tree_next_in_order(node);
+
+	if (next)
+		return next;
+	return avl_radix_first_from(tree,
+				    avl_radix_slot(tree,
+						   avl_radix_key(tree, node)) + 1);
+}
@@ -0,0 +1,85 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Radix-directed AVL trees for integer keys
+ * =========================================
+ */
+
+#ifndef _AVL_RADIX_H
+#define _AVL_RADIX_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A table of AVL trees indexed by the high bits of `unsigned long' keys.
+ * Use only the avl_radix_tree_*() functions to insert and remove items.  */
+struct avl_radix_tree {
+	struct avl_tree_root *slots;
+	unsigned int bits;		/* log2 of the number of slots  */
+	unsigned int key_bits;
+	size_t count;
+
+	/* Offset of the key from the `struct avl_tree_node' of each item  */
+	ptrdiff_t key_offset;
+};
+
+/* Computes the key offset of avl_radix_tree_init() for items of type @type,
+ * with the node and key in members @node and @key.  */
+#define AVL_RADIX_KEY_OFFSET(type, node, key) \
+	((ptrdiff_t)offsetof(type, key) - (ptrdiff_t)offsetof(type, node))
+
+/* Returns the key of the item containing @node.  */
+static AVL_INLINE unsigned long
+avl_radix_key(const struct avl_radix_tree *tree,
+	      const struct avl_tree_node *node)
+{
+	return *(const unsigned long *)((const char *)node + tree->key_offset);
+}
+
+void
+avl_radix_tree_init(struct avl_radix_tree *tree, ptrdiff_t key_offset,
+                    unsigned int key_bits);
+
+void
+avl_radix_tree_destroy(struct avl_radix_tree *tree);
+
+int
+avl_radix_tree_insert(struct avl_radix_tree *tree, struct avl_tree_node *item,
+                      struct avl_tree_node **dup_ret);
+
+void
+avl_radix_tree_remove(struct avl_radix_tree *tree, struct avl_tree_node *node);
+
+struct avl_tree_node *
+avl_radix_tree_lookup(const struct avl_radix_tree *tree, unsigned long key);
+
+struct avl_tree_node *
+avl_radix_tree_first(const struct avl_radix_tree *tree);
+
+struct avl_tree_node *
+avl_radix_tree_next(const struct avl_radix_tree *tree,
+                    const struct avl_tree_node *node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_RADIX_H */
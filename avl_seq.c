@@ -0,0 +1,232 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Sequences indexed by position
+ * =============================
+ *
+ * A sequence keeps items in the order they were put in, like an array, but
+ * inserting or removing one in the middle takes O(log n) time instead of
+ * moving all those after it.  It is an AVL tree without keys: each node caches
+ * the size of its subtree, and the position of an item is the number of items
+ * before it in order, which the sizes of left subtrees give on the way down.
+ *
+ * The sizes are kept up to date by the augmented variants of the functions in
+ * avl_tree.c, so the sequence shares their rotations, joins and splits.
+ * Concatenation and splitting take O(log n) time as well.
+ */
+
+#include "avl_seq.h"
+#include "avl_traversal.h"
+
+static AVL_INLINE struct avl_seq_node *
+avl_seq_node(const struct avl_tree_node *node)
+{
+	return avl_tree_entry(node, struct avl_seq_node, node);
+}
+
+/* Returns the size of the subtree rooted at @node, which may be NULL.  */
+static AVL_INLINE size_t
+avl_seq_subtree_size(const struct avl_tree_node *node)
+{
+	return node ? avl_seq_node(node)->size : 0;
+}
+
+/* The augmented tree callback: recomputes the size of @node.  */
+static void
+avl_seq_update(struct avl_tree_node *node)
+{
+	avl_seq_node(node)->size = 1 + avl_seq_subtree_size(node->left) +
+				   avl_seq_subtree_size(node->right);
+}
+
+/* Returns the item at position @index of @root, counting from 0, or NULL if
+ * there are not that many items.  Takes O(log n) time.  */
+struct avl_seq_node *
+avl_seq_get(const struct avl_seq_root *root, size_t index)
+{
+	const struct avl_tree_node *node = root->tree.avl_tree_node;
+
+	while (node) {
+		size_t left = avl_seq_subtree_size(node->left);
+
+		if (index < left) {
+			node = node->left;
+		} else if (index > left) {
+			index -= left + 1;
+			node = node->right;
+		} else {
+			return avl_seq_node(node);
+		}
+	}
+	return NULL;
+}
+
+/* Returns the position of @item in its sequence.  Takes O(log n) time.  */
+size_t
+avl_seq_index(const struct avl_seq_node *item)
+{
+	const struct avl_tree_node *node = &item->node;
+	const struct avl_tree_node *parent;
+	size_t index = avl_seq_subtree_size(node->left);
+
+	while ((parent = avl_get_parent(node))) {
+		if (node == parent->right)
+			index += avl_seq_subtree_size(parent->left) + 1;
+		node = parent;
+	}
+	return index;
+}
+
+/*
+ * Inserts an item into a sequence.
+ *
+ * @root
+ *	Location of the sequence.
+ *
+ * @index
+ *	Position the item will have, from 0 to avl_seq_size(@root): the items
+ *	from there on move up by one.
+ *
+ * @item
+ *	Pointer to the `struct avl_seq_node' embedded in the item to insert.
+ *
+ * Returns 0, or -1 if @index is out of range.  Takes O(log n) time.
+ */
+int
+avl_seq_insert_at(struct avl_seq_root *root, size_t index,
+		  struct avl_seq_node *item)
+{
+	struct avl_tree_node **cur = &root->tree.avl_tree_node;
+	struct avl_tree_node *parent = NULL;
+
+	if (index > avl_seq_size(root))
+		return -1;
+
+	while (*cur) {
+		size_t left = avl_seq_subtree_size((*cur)->left);
+
+		parent = *cur;
+		if (index <= left) {
+			cur = &parent->left;
+		} else {
+			index -= left + 1;
+			cur = &parent->right;
+		}
+	}
+
+	item->node.parent = parent;
+	item->node.balance = 0;
+	*cur = &item->node;
+	avl_tree_rebalance_after_insert_augmented(&root->tree, &item->node,
+						  avl_seq_update);
+	return 0;
+}
+
+/* Removes @item from the sequence at @root, in O(log n) time.  The items after
+ * it move down by one.  */
+void
+avl_seq_remove(struct avl_seq_root *root, struct avl_seq_node *item)
+{
+	avl_tree_remove_augmented(&root->tree, &item->node, avl_seq_update);
+}
+
+/* Removes the item at position @index of @root and returns it, or returns NULL
+ * if there are not that many items.  Takes O(log n) time.  */
+struct avl_seq_node *
+avl_seq_remove_at(struct avl_seq_root *root, size_t index)
+{
+	struct avl_seq_node *item = avl_seq_get(root, index);
+
+	if (item)
+		avl_seq_remove(root, item);
+	return item;
+}
+
+/*
+ * Concatenates two sequences.
+ *
+ * @root
+ *	Location of the result.  May be @left or @right.
+ *
+ * @left, @right
+ *	The sequences to concatenate, in that order.  Both are empty on return,
+ *	unless they are @root.
+ *
+ * The first item of @right is taken out and put back between the two as the
+ * node joining them.  Takes O(log n) time.
+ */
+void
+avl_seq_concat(struct avl_seq_root *root, struct avl_seq_root *left,
+	       struct avl_seq_root *right)
+{
+	struct avl_tree_node *mid = avl_tree_first_in_order(&right->tree);
+
+	if (!mid) {
+		mid = left->tree.avl_tree_node;
+		left->tree.avl_tree_node = NULL;
+		right->tree.avl_tree_node = NULL;
+		root->tree.avl_tree_node = mid;
+		return;
+	}
+
+	avl_tree_remove_augmented(&right->tree, mid, avl_seq_update);
+	avl_tree_join_augmented(&root->tree, &left->tree, mid, &right->tree,
+				avl_seq_update);
+}
+
+/* Directs the split of a sequence: *@ctx points to the number of items still
+ * to go into the left part, which avl_tree_split_augmented() takes from the
+ * nodes it calls this on, from the root down.  */
+static int
+avl_seq_split_cmp(const void *ctx, const struct avl_tree_node *node)
+{
+	size_t * const remaining = *(size_t * const *)ctx;
+	const size_t left = avl_seq_subtree_size(node->left);
+
+	if (*remaining <= left)
+		return -1;
+	*remaining -= left + 1;
+	return 1;
+}
+
+/*
+ * Splits a sequence in two at a position.
+ *
+ * @root
+ *	Location of the sequence.  It is empty on return, unless it is @left or
+ *	@right.
+ *
+ * @index
+ *	Number of items which go to @left; all of them if it is larger than
+ *	avl_seq_size(@root).
+ *
+ * @left, @right
+ *	Locations of the sequences receiving the items before and from
+ *	position @index, in order.
+ *
+ * Takes O(log n) time.
+ */
+void
+avl_seq_split(struct avl_seq_root *root, size_t index,
+	      struct avl_seq_root *left, struct avl_seq_root *right)
+{
+	size_t *remaining = &index;
+
+	avl_tree_split_augmented(&root->tree, &remaining, avl_seq_split_cmp,
+				 &left->tree, &right->tree, avl_seq_update);
+}
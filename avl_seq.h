@@ -0,0 +1,91 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Sequences indexed by position
+ * =============================
+ */
+
+#ifndef _AVL_SEQ_H
+#define _AVL_SEQ_H
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Node in a sequence.  Embed this in some other data structure.  */
+struct avl_seq_node {
+	struct avl_tree_node node;
+
+	/* Number of items in the subtree rooted here  */
+	size_t size;
+};
+
+/* A sequence.  Its tree may be walked in order with the functions of
+ * avl_traversal.h, but only changed with the functions below.  */
+struct avl_seq_root {
+	struct avl_tree_root tree;
+};
+
+#define AVL_SEQ_ROOT  (struct avl_seq_root) {{NULL, }}
+
+/* Cast a node of a sequence, given as a `struct avl_tree_node', to the
+ * containing data structure.  */
+#define avl_seq_entry(entry, type, member) \
+	avl_tree_entry(avl_tree_entry(entry, struct avl_seq_node, node), \
+		       type, member)
+
+/* Returns the number of items in @root, in O(1) time.  */
+static AVL_INLINE size_t
+avl_seq_size(const struct avl_seq_root *root)
+{
+	const struct avl_tree_node *node = root->tree.avl_tree_node;
+
+	return node ? avl_tree_entry(node, struct avl_seq_node, node)->size : 0;
+}
+
+struct avl_seq_node *
+avl_seq_get(const struct avl_seq_root *root, size_t index);
+
+size_t
+avl_seq_index(const struct avl_seq_node *item);
+
+int
+avl_seq_insert_at(struct avl_seq_root *root, size_t index,
+                  struct avl_seq_node *item);
+
+void
+avl_seq_remove(struct avl_seq_root *root, struct avl_seq_node *item);
+
+struct avl_seq_node *
+avl_seq_remove_at(struct avl_seq_root *root, size_t index);
+
+void
+avl_seq_concat(struct avl_seq_root *root, struct avl_seq_root *left,
+               struct avl_seq_root *right);
+
+void
+avl_seq_split(struct avl_seq_root *root, size_t index,
+              struct avl_seq_root *left, struct avl_seq_root *right);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_SEQ_H */
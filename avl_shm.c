@@ -0,0 +1,554 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree in memory shared between processes
+ * ===========================================
+ *
+ * The tree and its items live in one segment, typically a shm_open() or
+ * memfd_create() file descriptor, which each process maps wherever its
+ * address space has room.  Links are therefore stored as offsets from the link
+ * field itself rather than as pointers.
+ *
+ * One writer at a time holds the segment's mutex, which is process-shared and
+ * robust: if its owner dies, the next avl_shm_lock() notices, and the tree is
+ * only given up on (marked broken) if the owner died in the middle of a
+ * change.  Readers take no lock at all.  Like seqlock readers, they check a
+ * sequence counter that is odd while a change is in progress, and search
+ * again if it moved; after a few failed attempts they wait for the mutex.
+ *
+ * Items are allocated from the segment by bumping an offset and are never
+ * freed, not even when removed from the tree.  This is what makes lock-free
+ * readers safe, since a reader may still be looking at a removed item, and it
+ * suits indexes that are mostly read and grow over time.  Sizing the segment
+ * is up to the creator.
+ *
+ * Rebalancing works as in avl_lite.c: nodes have no parent links, so
+ * insertion and removal keep the search path on a stack.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_shm.h"
+
+#define AVL_SHM_MAGIC			0x4d485341	/* "ASHM"  */
+
+/* Alignment of every allocation  */
+#define AVL_SHM_ALIGN			16
+
+/* Optimistic attempts before a lookup falls back to taking the mutex.  */
+#define AVL_SHM_OPTIMISTIC_TRIES	8
+
+/* Returns what the link at @link points to, or NULL.  */
+static AVL_INLINE struct avl_shm_node *
+avl_shm_deref(const int64_t *link)
+{
+	const int64_t off = __atomic_load_n(link, __ATOMIC_RELAXED);
+
+	return off ? (struct avl_shm_node *)((char *)link + off) : NULL;
+}
+
+/* Makes the link at @link point to @node, which may be NULL.  */
+static AVL_INLINE void
+avl_shm_point(int64_t *link, const struct avl_shm_node *node)
+{
+	__atomic_store_n(link, node ? (int64_t)((const char *)node -
+						(const char *)link) : 0,
+			 __ATOMIC_RELAXED);
+}
+
+/* Returns the link to the left child (sign < 0) or the right child (sign > 0)
+ * of @node.  */
+static AVL_INLINE int64_t *
+avl_shm_child_link(struct avl_shm_node *node, int sign)
+{
+	return sign < 0 ? &node->left : &node->right;
+}
+
+static AVL_INLINE struct avl_shm_node *
+avl_shm_get_child(struct avl_shm_node *node, int sign)
+{
+	return avl_shm_deref(avl_shm_child_link(node, sign));
+}
+
+static AVL_INLINE void
+avl_shm_set_child(struct avl_shm_node *node, int sign,
+		  struct avl_shm_node *child)
+{
+	avl_shm_point(avl_shm_child_link(node, sign), child);
+}
+
+/* Links @child in place of the subtree at depth @i of the search path.  */
+static AVL_INLINE void
+avl_shm_replace(struct avl_shm_segment *seg,
+		struct avl_shm_node * const *path, const signed char *dirs,
+		int i, struct avl_shm_node *child)
+{
+	if (i > 0)
+		avl_shm_set_child(path[i - 1], dirs[i - 1], child);
+	else
+		avl_shm_point(&seg->root.node, child);
+}
+
+/* Single rotation lifting the child of @A on side @sign; see
+ * avl_lite_lift().  */
+static AVL_INLINE struct avl_shm_node *
+avl_shm_lift(struct avl_shm_node * const A, const int sign)
+{
+	struct avl_shm_node * const B = avl_shm_get_child(A, sign);
+
+	/* Tell the compiler, which would otherwise warn about the NULL case
+	 * of avl_shm_deref(), that the child exists.  */
+	if (!B)
+		__builtin_unreachable();
+	avl_shm_set_child(A, sign, avl_shm_get_child(B, -sign));
+	avl_shm_set_child(B, -sign, A);
+	return B;
+}
+
+/* Double rotation lifting the grandchild of @A on sides @sign, -@sign; see
+ * avl_lite_double_lift().  */
+static AVL_INLINE struct avl_shm_node *
+avl_shm_double_lift(struct avl_shm_node * const A, const int sign)
+{
+	struct avl_shm_node * const B = avl_shm_get_child(A, sign);
+	struct avl_shm_node * const E = avl_shm_get_child(B, -sign);
+	const int e = E->balance;
+
+	avl_shm_set_child(A, sign, avl_shm_lift(B, -sign));
+	avl_shm_lift(A, sign);
+
+	A->balance = (e == sign) ? -sign : 0;
+	B->balance = (e == -sign) ? sign : 0;
+	E->balance = 0;
+	return E;
+}
+
+/* Handles the growth of the subtree of @node on side @sign after an
+ * insertion; see avl_lite_grow().  */
+static AVL_INLINE bool
+avl_shm_grow(struct avl_shm_node *node, const int sign,
+	     struct avl_shm_node **subtree_ret)
+{
+	struct avl_shm_node *child;
+
+	if (node->balance == 0) {
+		node->balance = sign;
+		return false;
+	}
+	if (node->balance == -sign) {
+		node->balance = 0;
+		return true;
+	}
+
+	child = avl_shm_get_child(node, sign);
+	if (child->balance == sign) {
+		*subtree_ret = avl_shm_lift(node, sign);
+		node->balance = 0;
+		child->balance = 0;
+	} else {
+		*subtree_ret = avl_shm_double_lift(node, sign);
+	}
+	return true;
+}
+
+/* Handles the shrinkage of the subtree of @node on side @sign after a
+ * removal; see avl_lite_shrink().  */
+static AVL_INLINE bool
+avl_shm_shrink(struct avl_shm_node *node, const int sign,
+	       struct avl_shm_node **subtree_ret)
+{
+	struct avl_shm_node *child;
+
+	if (node->balance == sign) {
+		node->balance = 0;
+		return false;
+	}
+	if (node->balance == 0) {
+		node->balance = -sign;
+		return true;
+	}
+
+	child = avl_shm_get_child(node, -sign);
+	switch (child->balance * -sign) {
+	case 1:
+		*subtree_ret = avl_shm_lift(node, -sign);
+		node->balance = 0;
+		child->balance = 0;
+		return false;
+	case 0:
+		*subtree_ret = avl_shm_lift(node, -sign);
+		node->balance = -sign;
+		child->balance = sign;
+		return true;
+	default:
+		*subtree_ret = avl_shm_double_lift(node, -sign);
+		return false;
+	}
+}
+
+/* Starts a change to the tree; the mutex must be held.  */
+static AVL_INLINE void
+avl_shm_write_begin(struct avl_shm_segment *seg)
+{
+	const uint64_t seq = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* Ends a change to the tree started by avl_shm_write_begin().  */
+static AVL_INLINE void
+avl_shm_write_end(struct avl_shm_segment *seg)
+{
+	const uint64_t seq = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Creates an empty shared tree in the file @fd refers to, which is resized to
+ * @size bytes, and maps it.  Returns the segment, or NULL with errno set.
+ */
+struct avl_shm_segment *
+avl_shm_create(int fd, size_t size)
+{
+	struct avl_shm_segment *seg;
+	pthread_mutexattr_t attr;
+	int err;
+
+	if (size < sizeof(*seg)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (ftruncate(fd, size))
+		return NULL;
+	seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg == MAP_FAILED)
+		return NULL;
+
+	seg->broken = 0;
+	seg->size = size;
+	seg->used = (sizeof(*seg) + AVL_SHM_ALIGN - 1) &
+		    ~(uint64_t)(AVL_SHM_ALIGN - 1);
+	seg->count = 0;
+	seg->seq = 0;
+	seg->root.node = 0;
+
+	err = pthread_mutexattr_init(&attr);
+	if (!err) {
+		err = pthread_mutexattr_setpshared(&attr,
+						   PTHREAD_PROCESS_SHARED);
+		if (!err)
+			err = pthread_mutexattr_setrobust(&attr,
+							  PTHREAD_MUTEX_ROBUST);
+		if (!err)
+			err = pthread_mutex_init(&seg->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	if (err) {
+		munmap(seg, size);
+		errno = err;
+		return NULL;
+	}
+
+	/* Publish the segment only once it is complete.  */
+	__atomic_store_n(&seg->magic, AVL_SHM_MAGIC, __ATOMIC_RELEASE);
+	return seg;
+}
+
+/* Maps a shared tree made by avl_shm_create() in another process (or in this
+ * one).  Returns the segment, or NULL with errno set.  */
+struct avl_shm_segment *
+avl_shm_attach(int fd)
+{
+	struct avl_shm_segment *seg;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return NULL;
+	if ((uint64_t)st.st_size < sizeof(*seg)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	seg = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg == MAP_FAILED)
+		return NULL;
+	if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != AVL_SHM_MAGIC ||
+	    seg->size != (uint64_t)st.st_size) {
+		munmap(seg, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return seg;
+}
+
+/* Unmaps a segment.  The tree stays in the file for other processes.  */
+void
+avl_shm_detach(struct avl_shm_segment *seg)
+{
+	munmap(seg, seg->size);
+}
+
+/*
+ * Takes the writer mutex of a shared tree.  Returns 0, or -1 if the tree is
+ * broken, because a previous writer died while changing it; the mutex is not
+ * held then.
+ */
+int
+avl_shm_lock(struct avl_shm_segment *seg)
+{
+	int err = pthread_mutex_lock(&seg->lock);
+
+	if (err == EOWNERDEAD) {
+		/* The tree is intact unless the dead writer was in the middle
+		 * of a change.  */
+		if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) & 1)
+			__atomic_store_n(&seg->broken, 1, __ATOMIC_RELAXED);
+		pthread_mutex_consistent(&seg->lock);
+		err = 0;
+	}
+	if (err)
+		return -1;
+	if (__atomic_load_n(&seg->broken, __ATOMIC_RELAXED)) {
+		pthread_mutex_unlock(&seg->lock);
+		return -1;
+	}
+	return 0;
+}
+
+void
+avl_shm_unlock(struct avl_shm_segment *seg)
+{
+	pthread_mutex_unlock(&seg->lock);
+}
+
+/* Returns @size bytes of the segment, aligned to 16 bytes, or NULL if it is
+ * full.  The mutex must be held.  */
+void *
+avl_shm_alloc(struct avl_shm_segment *seg, size_t size)
+{
+	const uint64_t used = seg->used;
+
+	if (size > seg->size - used)
+		return NULL;
+	size = (size + AVL_SHM_ALIGN - 1) & ~(size_t)(AVL_SHM_ALIGN - 1);
+	if (size > seg->size - used)
+		size = seg->size - used;
+	__atomic_store_n(&seg->used, used + size, __ATOMIC_RELEASE);
+	return (char *)seg + used;
+}
+
+/*
+ * Inserts an item, allocated with avl_shm_alloc(), into a shared tree, as
+ * avl_tree_insert() does.  The mutex must be held.
+ *
+ * Returns NULL if the item was inserted, otherwise the node of the item
+ * already in the tree which compares equal to @item.
+ */
+struct avl_shm_node *
+avl_shm_insert(struct avl_shm_segment *seg, struct avl_shm_node *item,
+	       int (*cmp)(const struct avl_shm_node *,
+			  const struct avl_shm_node *))
+{
+	struct avl_shm_node *path[AVL_TREE_MAX_HEIGHT];
+	signed char dirs[AVL_TREE_MAX_HEIGHT];
+	struct avl_shm_node *cur = avl_shm_deref(&seg->root.node);
+	int depth = 0;
+
+	while (cur) {
+		const int res = (*cmp)(item, cur);
+
+		if (res == 0)
+			return cur;
+		path[depth] = cur;
+		dirs[depth] = res < 0 ? -1 : +1;
+		cur = avl_shm_get_child(cur, dirs[depth]);
+		depth++;
+	}
+
+	item->left = 0;
+	item->right = 0;
+	item->balance = 0;
+
+	avl_shm_write_begin(seg);
+	avl_shm_replace(seg, path, dirs, depth, item);
+	for (int i = depth - 1; i >= 0; i--) {
+		struct avl_shm_node *subtree = NULL;
+		bool done;
+
+		if (dirs[i] < 0)
+			done = avl_shm_grow(path[i], -1, &subtree);
+		else
+			done = avl_shm_grow(path[i], +1, &subtree);
+
+		if (subtree)
+			avl_shm_replace(seg, path, dirs, i, subtree);
+		if (done)
+			break;
+	}
+	seg->count++;
+	avl_shm_write_end(seg);
+	return NULL;
+}
+
+/*
+ * Removes the item which compares equal to @cmp_ctx from a shared tree.  The
+ * mutex must be held.
+ *
+ * Returns the node of the removed item, or NULL if there was none.  The item's
+ * memory stays allocated; see the top of this file.
+ */
+struct avl_shm_node *
+avl_shm_remove(struct avl_shm_segment *seg,
+	       const void *cmp_ctx,
+	       int (*cmp)(const void *, const struct avl_shm_node *))
+{
+	struct avl_shm_node *path[AVL_TREE_MAX_HEIGHT];
+	signed char dirs[AVL_TREE_MAX_HEIGHT];
+	struct avl_shm_node *node = avl_shm_deref(&seg->root.node);
+	struct avl_shm_node *left, *right;
+	int depth = 0;
+
+	while (node) {
+		const int res = (*cmp)(cmp_ctx, node);
+
+		if (res == 0)
+			break;
+		path[depth] = node;
+		dirs[depth] = res < 0 ? -1 : +1;
+		node = avl_shm_get_child(node, dirs[depth]);
+		depth++;
+	}
+	if (!node)
+		return NULL;
+
+	avl_shm_write_begin(seg);
+	left = avl_shm_get_child(node, -1);
+	right = avl_shm_get_child(node, +1);
+	if (left && right) {
+		/* Move the in-order successor into @node's place.  */
+		const int k = depth;
+		struct avl_shm_node *succ;
+
+		path[depth] = node;
+		dirs[depth++] = +1;
+		for (succ = right; avl_shm_get_child(succ, -1);
+		     succ = avl_shm_get_child(succ, -1)) {
+			path[depth] = succ;
+			dirs[depth++] = -1;
+		}
+
+		avl_shm_set_child(path[depth - 1], dirs[depth - 1],
+				  avl_shm_get_child(succ, +1));
+		avl_shm_set_child(succ, -1, left);
+		avl_shm_set_child(succ, +1, avl_shm_get_child(node, +1));
+		succ->balance = node->balance;
+		path[k] = succ;
+		avl_shm_replace(seg, path, dirs, k, succ);
+	} else {
+		avl_shm_replace(seg, path, dirs, depth, left ? left : right);
+	}
+
+	for (int i = depth - 1; i >= 0; i--) {
+		struct avl_shm_node *subtree = NULL;
+		bool done;
+
+		if (dirs[i] < 0)
+			done = avl_shm_shrink(path[i], -1, &subtree);
+		else
+			done = avl_shm_shrink(path[i], +1, &subtree);
+
+		if (subtree)
+			avl_shm_replace(seg, path, dirs, i, subtree);
+		if (done)
+			break;
+	}
+	seg->count--;
+	avl_shm_write_end(seg);
+	return node;
+}
+
+/* Searches the tree without locking.  Returns false if a writer changed the
+ * tree meanwhile, or if a link leads outside the allocated part of the
+ * segment, which can only be seen in a search racing with a writer.  */
+static AVL_INLINE bool
+avl_shm_try_lookup(struct avl_shm_segment *seg,
+		   const void *cmp_ctx,
+		   int (*cmp)(const void *, const struct avl_shm_node *),
+		   struct avl_shm_node **found)
+{
+	const uint64_t seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+	const char *end = (const char *)seg +
+			  __atomic_load_n(&seg->used, __ATOMIC_ACQUIRE);
+	struct avl_shm_node *cur;
+	int depth = 0;
+
+	if (seq & 1)
+		return false;
+
+	cur = avl_shm_deref(&seg->root.node);
+	while (cur) {
+		int res;
+
+		if ((const char *)cur < (const char *)(seg + 1) ||
+		    (const char *)(cur + 1) > end ||
+		    ++depth > AVL_TREE_MAX_HEIGHT)
+			return false;
+		res = (*cmp)(cmp_ctx, cur);
+		if (res == 0)
+			break;
+		cur = avl_shm_get_child(cur, res);
+	}
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) != seq)
+		return false;
+	*found = cur;
+	return true;
+}
+
+/*
+ * Looks up an item in a shared tree, as avl_tree_lookup() does.  This needs no
+ * lock and may run in any process while a writer changes the tree; @cmp must
+ * cope with being called on an item that is being removed.
+ *
+ * Returns the node of the item, or NULL if it was not found or the tree is
+ * broken.
+ */
+struct avl_shm_node *
+avl_shm_lookup(struct avl_shm_segment *seg,
+	       const void *cmp_ctx,
+	       int (*cmp)(const void *, const struct avl_shm_node *))
+{
+	struct avl_shm_node *found = NULL;
+
+	for (int tries = 0; tries < AVL_SHM_OPTIMISTIC_TRIES; tries++)
+		if (avl_shm_try_lookup(seg, cmp_ctx, cmp, &found))
+			return found;
+
+	if (avl_shm_lock(seg))
+		return NULL;
+	avl_shm_try_lookup(seg, cmp_ctx, cmp, &found);
+	avl_shm_unlock(seg);
+	return found;
+}
@@ -0,0 +1,113 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree in memory shared between processes
+ * ===========================================
+ */
+
+#ifndef _AVL_SHM_H
+#define _AVL_SHM_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __GNUC__
+#  error "avl_shm requires GCC-compatible __atomic builtins"
+#endif
+
+/* Node in a shared AVL tree.  Embed this in an item allocated with
+ * avl_shm_alloc().  The links are offsets from the link fields themselves, so
+ * they hold in every mapping of the segment; 0 stands for no child.  */
+struct avl_shm_node {
+	int64_t left;
+	int64_t right;
+	int balance;
+};
+
+struct avl_shm_root {
+	int64_t node;
+};
+
+/* Header at the start of a shared segment.  The rest of the segment holds the
+ * items, allocated upwards.  */
+struct avl_shm_segment {
+	uint32_t magic;
+
+	/* Set if a writer died in the middle of a change  */
+	uint32_t broken;
+
+	uint64_t size;			/* of the whole segment  */
+	uint64_t used;			/* bytes allocated, header included  */
+	uint64_t count;
+
+	/* Even while the tree is stable, odd while a writer is changing it  */
+	uint64_t seq;
+
+	struct avl_shm_root root;
+
+	/* Process-shared, robust; held by the writer  */
+	pthread_mutex_t lock;
+};
+
+#define avl_shm_entry(entry, type, member) \
+	avl_tree_entry(entry, type, member)
+
+struct avl_shm_segment *
+avl_shm_create(int fd, size_t size);
+
+struct avl_shm_segment *
+avl_shm_attach(int fd);
+
+void
+avl_shm_detach(struct avl_shm_segment *seg);
+
+int
+avl_shm_lock(struct avl_shm_segment *seg);
+
+void
+avl_shm_unlock(struct avl_shm_segment *seg);
+
+void *
+avl_shm_alloc(struct avl_shm_segment *seg, size_t size);
+
+struct avl_shm_node *
+avl_shm_insert(struct avl_shm_segment *seg, struct avl_shm_node *item,
+               int (*cmp)(const struct avl_shm_node *,
+                          const struct avl_shm_node *));
+
+struct avl_shm_node *
+avl_shm_remove(struct avl_shm_segment *seg,
+               const void *cmp_ctx,
+               int (*cmp)(const void *, const struct avl_shm_node *));
+
+struct avl_shm_node *
+avl_shm_lookup(struct avl_shm_segment *seg,
+               const void *cmp_ctx,
+               int (*cmp)(const void *, const struct avl_shm_node *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_SHM_H */
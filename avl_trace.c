@@ -0,0 +1,281 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree operation traces
+ * =========================
+ *
+ * Synthetic benchmarks rarely have the key distribution of real traffic.
+ * When the library is compiled with -DAVL_TRACE, avl_tree_lookup(),
+ * avl_tree_lookup_node(), avl_tree_insert(), avl_tree_insert_multi(),
+ * avl_tree_upsert(), avl_tree_remove_key(), avl_tree_link_node() and
+ * avl_tree_remove() report each call here, and between avl_trace_start() and
+ * avl_trace_stop() the operation and its key are appended to a trace file.
+ * The `replay' program runs a trace against the tree variants of the library
+ * and reports throughput and latencies.
+ *
+ * Each call is reported once, by the entry point the application called, and
+ * only for nodes of its own items: the structures built on these functions
+ * (avl_hash, avl_radix, avl_fc, avl_changelog, avl_cursor, avl_tree.hpp)
+ * report their items' insertions and removals, but nodes internal to the
+ * library, such as the blocks of avl_block and the entries of avl_memtable,
+ * are never passed to the callbacks.  Bulk operations (building, joining,
+ * splitting, range removal and relaxed balancing) and augmented trees are not
+ * traced, so a trace replays to the same set of items only for programs which
+ * change their trees one item at a time.
+ *
+ * The library does not know what keys are, so the application passes
+ * callbacks that turn a node, or the context of a lookup by key, into an
+ * `unsigned long'.  Lookups by context are only traced if it passes the
+ * second one.  Keys may be recorded as hashes, which keeps equality (and so
+ * hit rates and the working set) but not order.
+ *
+ * File layout:
+ *
+ *	header		u32 magic, u32 flags (little-endian)
+ *	records		u8 operation (AVL_TRACE_*), then the difference from
+ *			the previous key, zigzag and LEB128 encoded
+ *
+ * Records are written under a mutex, so one trace can be fed from several
+ * threads; their operations end up in some interleaving.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "avl_trace.h"
+
+#define AVL_TRACE_MAGIC		0x54524c41	/* "ALRT"  */
+
+/* Buffer for the trace file  */
+#define AVL_TRACE_BUF_SIZE	(1 << 20)
+
+static struct {
+	pthread_mutex_t lock;
+	FILE *file;
+	bool active;
+	unsigned int flags;
+	unsigned long prev;
+	unsigned long (*node_key)(const struct avl_tree_node *);
+	unsigned long (*ctx_key)(const void *);
+} avl_trace = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+avl_trace_put_u32(unsigned char *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = v >> (8 * i);
+}
+
+static uint32_t
+avl_trace_get_u32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+/* Mixes the bits of a key, so that recorded keys do not reveal it.  */
+static unsigned long
+avl_trace_hash(unsigned long key)
+{
+	unsigned long long x = key;
+
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return (unsigned long)x;
+}
+
+/*
+ * Starts recording a trace to the file @path, which is truncated.
+ *
+ * @node_key
+ *	Returns the key of the item containing a node.
+ *
+ * @ctx_key
+ *	Returns the key a lookup context stands for, or NULL to leave lookups
+ *	and removals by context out of the trace.
+ *
+ * @flags
+ *	Bitwise OR of AVL_TRACE_* flags.
+ *
+ * Returns 0, or -1 if the file could not be created or a trace is already
+ * being recorded.
+ */
+int
+avl_trace_start(const char *path,
+		unsigned long (*node_key)(const struct avl_tree_node *),
+		unsigned long (*ctx_key)(const void *),
+		unsigned int flags)
+{
+	unsigned char header[8];
+	int ret = -1;
+
+	pthread_mutex_lock(&avl_trace.lock);
+	if (avl_trace.file)
+		goto out;
+	avl_trace.file = fopen(path, "wb");
+	if (!avl_trace.file)
+		goto out;
+	setvbuf(avl_trace.file, NULL, _IOFBF, AVL_TRACE_BUF_SIZE);
+
+	avl_trace_put_u32(header, AVL_TRACE_MAGIC);
+	avl_trace_put_u32(header + 4, flags);
+	fwrite(header, 1, sizeof(header), avl_trace.file);
+
+	avl_trace.flags = flags;
+	avl_trace.prev = 0;
+	avl_trace.node_key = node_key;
+	avl_trace.ctx_key = ctx_key;
+	__atomic_store_n(&avl_trace.active, true, __ATOMIC_RELEASE);
+	ret = 0;
+out:
+	pthread_mutex_unlock(&avl_trace.lock);
+	return ret;
+}
+
+/* Stops recording and closes the trace file.  Returns 0, or -1 if writing the
+ * trace failed at some point.  */
+int
+avl_trace_stop(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&avl_trace.lock);
+	__atomic_store_n(&avl_trace.active, false, __ATOMIC_RELAXED);
+	if (avl_trace.file) {
+		if (ferror(avl_trace.file))
+			ret = -1;
+		if (fclose(avl_trace.file))
+			ret = -1;
+		avl_trace.file = NULL;
+	}
+	pthread_mutex_unlock(&avl_trace.lock);
+	return ret;
+}
+
+/* Appends an operation on @key to the trace, if one is being recorded.  */
+void
+avl_trace_record(int op, unsigned long key)
+{
+	unsigned char buf[1 + 10];
+	unsigned long delta, zigzag;
+	size_t len = 0;
+
+	if (!__atomic_load_n(&avl_trace.active, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&avl_trace.lock);
+	if (!avl_trace.file)
+		goto out;
+	if (avl_trace.flags & AVL_TRACE_HASH_KEYS)
+		key = avl_trace_hash(key);
+
+	/* Small negative differences get small codes too.  */
+	delta = key - avl_trace.prev;
+	zigzag = (delta << 1) ^ (0UL - (delta >> (8 * sizeof(delta) - 1)));
+	avl_trace.prev = key;
+
+	buf[len++] = op;
+	do {
+		buf[len] = zigzag & 0x7f;
+		zigzag >>= 7;
+		if (zigzag)
+			buf[len] |= 0x80;
+		len++;
+	} while (zigzag);
+	fwrite(buf, 1, len, avl_trace.file);
+out:
+	pthread_mutex_unlock(&avl_trace.lock);
+}
+
+/* Records an operation on the item containing @node.  */
+void
+avl_trace_node(int op, const struct avl_tree_node *node)
+{
+	if (__atomic_load_n(&avl_trace.active, __ATOMIC_ACQUIRE))
+		avl_trace_record(op, (*avl_trace.node_key)(node));
+}
+
+/* Records an operation on the key @cmp_ctx stands for.  */
+void
+avl_trace_ctx(int op, const void *cmp_ctx)
+{
+	if (__atomic_load_n(&avl_trace.active, __ATOMIC_ACQUIRE) &&
+	    avl_trace.ctx_key)
+		avl_trace_record(op, (*avl_trace.ctx_key)(cmp_ctx));
+}
+
+/* Opens a trace for reading.  Returns 0, or -1 if it cannot be opened or is
+ * not a trace.  */
+int
+avl_trace_open(struct avl_trace_reader *reader, const char *path)
+{
+	unsigned char header[8];
+
+	reader->file = fopen(path, "rb");
+	if (!reader->file)
+		return -1;
+	if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+	    avl_trace_get_u32(header) != AVL_TRACE_MAGIC) {
+		fclose(reader->file);
+		return -1;
+	}
+	reader->flags = avl_trace_get_u32(header + 4);
+	reader->prev = 0;
+	return 0;
+}
+
+/* Reads the next record.  Returns 1, 0 at the end of the trace, or -1 if the
+ * trace is damaged.  */
+int
+avl_trace_read(struct avl_trace_reader *reader, int *op_ret,
+	       unsigned long *key_ret)
+{
+	unsigned long zigzag = 0;
+	unsigned int shift = 0;
+	int op, c;
+
+	op = getc(reader->file);
+	if (op == EOF)
+		return 0;
+	if (op < AVL_TRACE_LOOKUP || op > AVL_TRACE_REMOVE)
+		return -1;
+	do {
+		c = getc(reader->file);
+		if (c == EOF || shift >= 8 * sizeof(zigzag))
+			return -1;
+		zigzag |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	reader->prev += (zigzag >> 1) ^ (0UL - (zigzag & 1));
+	*op_ret = op;
+	*key_ret = reader->prev;
+	return 1;
+}
+
+void
+avl_trace_close(struct avl_trace_reader *reader)
+{
+	fclose(reader->file);
+}
@@ -0,0 +1,92 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree)
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * AVL tree operation traces
+ * =========================
+ */
+
+#ifndef _AVL_TRACE_H
+#define _AVL_TRACE_H
+
+#include <stdio.h>
+
+#include "avl_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum avl_trace_op {
+	AVL_TRACE_LOOKUP = 1,
+	AVL_TRACE_INSERT,
+	AVL_TRACE_REMOVE,
+};
+
+/* Flags for avl_trace_start()  */
+#define AVL_TRACE_HASH_KEYS	0x1	/* record a hash of each key instead
+					   of the key itself  */
+
+/* Reads back a trace written by avl_trace_start() and avl_trace_stop().  */
+struct avl_trace_reader {
+	FILE *file;
+	unsigned int flags;
+	unsigned long prev;
+};
+
+int
+avl_trace_start(const char *path,
+                unsigned long (*node_key)(const struct avl_tree_node *),
+                unsigned long (*ctx_key)(const void *),
+                unsigned int flags);
+
+int
+avl_trace_stop(void);
+
+void
+avl_trace_record(int op, unsigned long key);
+
+void
+avl_trace_node(int op, const struct avl_tree_node *node);
+
+void
+avl_trace_ctx(int op, const void *cmp_ctx);
+
+int
+avl_trace_open(struct avl_trace_reader *reader, const char *path);
+
+int
+avl_trace_read(struct avl_trace_reader *reader, int *op_ret,
+               unsigned long *key_ret);
+
+void
+avl_trace_close(struct avl_trace_reader *reader);
+
+/* Hooks in the library's entry points, compiled in with -DAVL_TRACE.  */
+#ifdef AVL_TRACE
+#  define AVL_TRACE_NODE(op, node)	avl_trace_node(op, node)
+#  define AVL_TRACE_CTX(op, cmp_ctx)	avl_trace_ctx(op, cmp_ctx)
+#else
+#  define AVL_TRACE_NODE(op, node)	((void)0)
+#  define AVL_TRACE_CTX(op, cmp_ctx)	((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_TRACE_H */
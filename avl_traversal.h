@@ -27,6 +27,10 @@
 
 #include "avl_tree.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct avl_tree_node *
 avl_tree_first_in_order(const struct avl_tree_root *root);
 
@@ -46,4 +50,8 @@ struct avl_tree_node *
 avl_tree_next_in_postorder(const struct avl_tree_node *prev,
                            const struct avl_tree_node *prev_parent);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _AVL_TRAVERSAL_H */
@@ -18,6 +18,7 @@
  */
 
 #include "avl_tree.h"
+#include "avl_trace.h"
 
 /* Returns the left child (sign < 0) or the right child (sign > 0) of the
  * specified AVL tree node.
@@ -120,11 +121,14 @@ avl_replace_child(struct avl_tree_root *root,
  *            / \       / \
  *           E?  D?    C?  E?
  *
- * This updates pointers but not balance factors!
+ * This updates pointers but not balance factors!  If @update is not NULL, it
+ * is called on A, then on B, to recompute what they cache about their
+ * subtrees; see avl_tree_rebalance_after_insert_augmented().
  */
 static AVL_INLINE void
 avl_rotate(struct avl_tree_root * const root,
-	   struct avl_tree_node * const A, const int sign)
+	   struct avl_tree_node * const A, const int sign,
+	   void (* const update)(struct avl_tree_node *))
 {
 	struct avl_tree_node * const B = avl_get_child(A, -sign);
 	struct avl_tree_node * const E = avl_get_child(B, +sign);
@@ -140,6 +144,11 @@ avl_rotate(struct avl_tree_root * const root,
 		avl_set_parent(E, A);
 
 	avl_replace_child(root, P, A, B);
+
+	if (update) {
+		(*update)(A);
+		(*update)(B);
+	}
 }
 
 /*
@@ -175,8 +184,8 @@ avl_rotate(struct avl_tree_root * const root,
  *
  * Returns a pointer to E and updates balance factors.  Except for those
  * two things, this function is equivalent to:
- *	avl_rotate(root, B, -sign);
- *	avl_rotate(root, A, +sign);
+ *	avl_rotate(root, B, -sign, update);
+ *	avl_rotate(root, A, +sign, update);
  *
  * See comment in avl_handle_subtree_growth() for explanation of balance
  * factor updates.
@@ -184,7 +193,8 @@ avl_rotate(struct avl_tree_root * const root,
 static AVL_INLINE struct avl_tree_node *
 avl_do_double_rotate(struct avl_tree_root * const root,
 		     struct avl_tree_node * const B,
-		     struct avl_tree_node * const A, const int sign)
+		     struct avl_tree_node * const A, const int sign,
+		     void (* const update)(struct avl_tree_node *))
 {
 	struct avl_tree_node * const E = avl_get_child(B, +sign);
 	struct avl_tree_node * const F = avl_get_child(E, -sign);
@@ -210,6 +220,11 @@ avl_do_double_rotate(struct avl_tree_root * const root,
 
 	avl_replace_child(root, P, A, E);
 
+	if (update) {
+		(*update)(A);
+		(*update)(B);
+		(*update)(E);
+	}
 	return E;
 }
 
@@ -229,6 +244,9 @@ avl_do_double_rotate(struct avl_tree_root * const root,
  *	-1 if @node is the left child of @parent;
  *	+1 if @node is the right child of @parent.
  *
+ * @update
+ *	NULL, or the callback of an augmented tree, passed to the rotations.
+ *
  * This function will adjust @parent's balance factor, then do a (single
  * or double) rotation if necessary.  The return value will be %true if
  * the full AVL tree is now adequately balanced, or %false if the subtree
@@ -243,7 +261,8 @@ static AVL_INLINE bool
 avl_handle_subtree_growth(struct avl_tree_root * const root,
 			  struct avl_tree_node * const node,
 			  struct avl_tree_node * const parent,
-			  const int sign)
+			  const int sign,
+			  void (* const update)(struct avl_tree_node *))
 {
 	int old_balance_factor, new_balance_factor;
 
@@ -312,7 +331,7 @@ avl_handle_subtree_growth(struct avl_tree_root * const root,
 		 *	balance(B) = 0
 		 *	balance(A) = 0
 		 */
-		avl_rotate(root, parent, -sign);
+		avl_rotate(root, parent, -sign, update);
 
 		/* Equivalent to setting @parent's balance factor to 0.  */
 		avl_adjust_balance_factor(parent, -sign); /* A */
@@ -359,17 +378,19 @@ avl_handle_subtree_growth(struct avl_tree_root * const root,
 		 *	height(E) = x + 2
 		 *	balance(E) = 0
 		 */
-		avl_do_double_rotate(root, node, parent, -sign);
+		avl_do_double_rotate(root, node, parent, -sign, update);
 	}
 
 	/* Height after rotation is unchanged; nothing more to do.  */
 	return true;
 }
 
-/* Rebalance the tree after insertion of the specified node.  */
-void
-avl_tree_rebalance_after_insert(struct avl_tree_root *root,
-				struct avl_tree_node *inserted)
+/* Template for rebalancing the tree after insertion of the specified node,
+ * with @update NULL or the callback of an augmented tree.  */
+static AVL_INLINE void
+avl_rebalance_after_insert_template(struct avl_tree_root *root,
+				    struct avl_tree_node *inserted,
+				    void (* const update)(struct avl_tree_node *))
 {
 	struct avl_tree_node *node, *parent;
 	bool done;
@@ -377,6 +398,10 @@ avl_tree_rebalance_after_insert(struct avl_tree_root *root,
 	inserted->left = NULL;
 	inserted->right = NULL;
 
+	if (update)
+		for (node = inserted; node; node = avl_get_parent(node))
+			(*update)(node);
+
 	node = inserted;
 
 	/* Adjust balance factor of new node's parent.
@@ -408,16 +433,53 @@ avl_tree_rebalance_after_insert(struct avl_tree_root *root,
 		/* The subtree rooted at @node has increased in height by 1.  */
 		if (node == parent->left)
 			done = avl_handle_subtree_growth(root, node,
-							 parent, -1);
+							 parent, -1, update);
 		else
 			done = avl_handle_subtree_growth(root, node,
-							 parent, +1);
+							 parent, +1, update);
 	} while (!done);
 }
 
+/* Rebalance the tree after insertion of the specified node.  */
+void
+avl_tree_rebalance_after_insert(struct avl_tree_root *root,
+				struct avl_tree_node *inserted)
+{
+	avl_rebalance_after_insert_template(root, inserted, NULL);
+}
+
+/*
+ * Same as avl_tree_rebalance_after_insert(), but for an augmented tree, whose
+ * nodes cache something about their subtrees, such as its size.
+ *
+ * @update
+ *	Recomputes what the node passed to it caches from the node itself and
+ *	its children, whose caches are up to date when it is called.
+ *
+ * @update is called on @inserted and each of its ancestors, bottom-up, and
+ * then on the nodes involved in each rotation.  Takes O(log n) time.
+ */
+void
+avl_tree_rebalance_after_insert_augmented(struct avl_tree_root *root,
+					  struct avl_tree_node *inserted,
+					  void (*update)(struct avl_tree_node *))
+{
+	avl_rebalance_after_insert_template(root, inserted, update);
+}
+
 void
 avl_tree_link_node(struct avl_tree_root *root, struct avl_tree_link *link,
                    struct avl_tree_node *node)
+{
+	AVL_TRACE_NODE(AVL_TRACE_INSERT, node);
+
+	avl_tree_link_node_untraced(root, link, node);
+}
+
+void
+avl_tree_link_node_untraced(struct avl_tree_root *root,
+			    struct avl_tree_link *link,
+			    struct avl_tree_node *node)
 {
 	node->parent = link->parent;
 	node->balance = 0;
@@ -445,6 +507,9 @@ avl_tree_link_node(struct avl_tree_root *root, struct avl_tree_link *link,
  *	+1 if the left subtree of @parent has decreased in height by 1;
  *	-1 if the right subtree of @parent has decreased in height by 1.
  *
+ * @update
+ *	NULL, or the callback of an augmented tree, passed to the rotations.
+ *
  * @left_deleted_ret
  *	If the return value is not NULL, this will be set to %true if the
  *	left subtree of the returned node has decreased in height by 1,
@@ -462,6 +527,7 @@ static AVL_INLINE struct avl_tree_node *
 avl_handle_subtree_shrink(struct avl_tree_root * const root,
 			  struct avl_tree_node *parent,
 			  const int sign,
+			  void (* const update)(struct avl_tree_node *),
 			  bool * const left_deleted_ret)
 {
 	struct avl_tree_node *node;
@@ -502,7 +568,7 @@ avl_handle_subtree_shrink(struct avl_tree_root * const root,
 
 		if (sign * avl_get_balance_factor(node) >= 0) {
 
-			avl_rotate(root, parent, -sign);
+			avl_rotate(root, parent, -sign, update);
 
 			if (avl_get_balance_factor(node) == 0) {
 				/*
@@ -560,7 +626,7 @@ avl_handle_subtree_shrink(struct avl_tree_root * const root,
 			}
 		} else {
 			node = avl_do_double_rotate(root, node,
-						    parent, -sign);
+						    parent, -sign, update);
 		}
 	}
 	parent = avl_get_parent(node);
@@ -638,27 +704,15 @@ avl_tree_swap_with_successor(struct avl_tree_root *root,
 	return ret;
 }
 
-/*
- * Removes an item from the specified AVL tree.
- *
- * @root
- *	Location of the AVL tree's root pointer.  Indirection is needed
- *	because the root node may change if the tree needed to be rebalanced
- *	because of the deletion or if @node was the root node.
- *
- * @node
- *	Pointer to the `struct avl_tree_node' embedded in the item to
- *	remove from the tree.
- *
- * Note: This function *only* removes the node and rebalances the tree.
- * It does not free any memory, nor does it do the equivalent of
- * avl_tree_node_set_unlinked().
- */
-void
-avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node)
+/* Unlinks @node from the tree without rebalancing.  Returns the node at which
+ * rebalancing must start, with *left_deleted_ret telling which of its
+ * subtrees has shrunk, or NULL if @node was the root (in which case the tree is
+ * still balanced).  */
+static AVL_INLINE struct avl_tree_node *
+avl_tree_unlink(struct avl_tree_root *root, struct avl_tree_node *node,
+		bool *left_deleted_ret)
 {
 	struct avl_tree_node *parent;
-	bool left_deleted = false;
 
 	if (node->left && node->right) {
 		/* @node is fully internal, with two children.  Swap it
@@ -666,18 +720,18 @@ avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node)
 		 * right subtree of @node and can have, at most, a right
 		 * child), then unlink @node.  */
 		parent = avl_tree_swap_with_successor(root, node,
-						      &left_deleted);
+						      left_deleted_ret);
 		/* @parent is now the parent of what was @node's in-order
 		 * successor.  It cannot be NULL, since @node itself was
 		 * an ancestor of its in-order successor.
-		 * @left_deleted has been set to %true if @node's
+		 * *left_deleted_ret has been set to %true if @node's
 		 * in-order successor was the left child of @parent,
 		 * otherwise %false.  */
 	} else {
 		struct avl_tree_node *child;
 
 		/* @node is missing at least one child.  Unlink it.  Set
-		 * @parent to @node's parent, and set @left_deleted to
+		 * @parent to @node's parent, and set *left_deleted_ret to
 		 * reflect which child of @parent @node was.  Or, if
 		 * @node was the root node, simply update the root node
 		 * and return.  */
@@ -686,10 +740,10 @@ avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node)
 		if (parent) {
 			if (node == parent->left) {
 				parent->left = child;
-				left_deleted = true;
+				*left_deleted_ret = true;
 			} else {
 				parent->right = child;
-				left_deleted = false;
+				*left_deleted_ret = false;
 			}
 			if (child)
 				avl_set_parent(child, parent);
@@ -697,17 +751,531 @@ avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node)
 			if (child)
 				avl_set_parent(child, parent);
 			root->avl_tree_node = child;
-			return;
 		}
 	}
 
+	return parent;
+}
+
+/* Template for removing an item from the tree, with @update NULL or the
+ * callback of an augmented tree.  */
+static AVL_INLINE void
+avl_remove_template(struct avl_tree_root *root, struct avl_tree_node *node,
+		    void (* const update)(struct avl_tree_node *))
+{
+	struct avl_tree_node *parent, *cur;
+	bool left_deleted = false;
+
+	parent = avl_tree_unlink(root, node, &left_deleted);
+
+	/* If @node was swapped with its successor, the successor took its
+	 * place on this path, so the path covers every changed subtree.  */
+	if (update)
+		for (cur = parent; cur; cur = avl_get_parent(cur))
+			(*update)(cur);
+
 	/* Rebalance the tree.  */
-	do {
+	while (parent) {
 		if (left_deleted)
-			parent = avl_handle_subtree_shrink(root, parent,
-							   +1, &left_deleted);
+			parent = avl_handle_subtree_shrink(root, parent, +1,
+							   update,
+							   &left_deleted);
 		else
-			parent = avl_handle_subtree_shrink(root, parent,
-							   -1, &left_deleted);
-	} while (parent);
+			parent = avl_handle_subtree_shrink(root, parent, -1,
+							   update,
+							   &left_deleted);
+	}
+}
+
+/*
+ * Removes an item from the specified AVL tree.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.  Indirection is needed
+ *	because the root node may change if the tree needed to be rebalanced
+ *	because of the deletion or if @node was the root node.
+ *
+ * @node
+ *	Pointer to the `struct avl_tree_node' embedded in the item to
+ *	remove from the tree.
+ *
+ * Note: This function *only* removes the node and rebalances the tree.
+ * It does not free any memory, nor does it do the equivalent of
+ * avl_tree_node_set_unlinked().
+ */
+void
+avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node)
+{
+	AVL_TRACE_NODE(AVL_TRACE_REMOVE, node);
+
+	avl_remove_template(root, node, NULL);
+}
+
+void
+avl_tree_remove_untraced(struct avl_tree_root *root, struct avl_tree_node *node)
+{
+	avl_remove_template(root, node, NULL);
+}
+
+/* Same as avl_tree_remove(), but for an augmented tree; see
+ * avl_tree_rebalance_after_insert_augmented().  @update is called on each
+ * node left on the path from the root to where a node was unlinked,
+ * bottom-up, and then on the nodes involved in each rotation.  */
+void
+avl_tree_remove_augmented(struct avl_tree_root *root,
+			  struct avl_tree_node *node,
+			  void (*update)(struct avl_tree_node *))
+{
+	avl_remove_template(root, node, update);
+}
+
+/*
+ * Replaces an item in the specified AVL tree with another one, in place.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.
+ *
+ * @old_node
+ *	Pointer to the `struct avl_tree_node' embedded in the item currently in
+ *	the tree.
+ *
+ * @new_node
+ *	Pointer to the `struct avl_tree_node' embedded in the item to put in
+ *	its place.  It must compare equal to @old_node, or at least sort
+ *	between @old_node's in-order neighbours.
+ *
+ * @new_node takes over @old_node's parent, children and balance factor, so
+ * this is O(1) and no rebalancing is done.  As with avl_tree_remove(),
+ * @old_node is not freed nor marked unlinked.
+ */
+void
+avl_tree_replace(struct avl_tree_root *root, struct avl_tree_node *old_node,
+		 struct avl_tree_node *new_node)
+{
+	struct avl_tree_node *parent = avl_get_parent(old_node);
+
+	*new_node = *old_node;
+
+	if (new_node->left)
+		avl_set_parent(new_node->left, new_node);
+	if (new_node->right)
+		avl_set_parent(new_node->right, new_node);
+
+	avl_replace_child(root, parent, old_node, new_node);
+}
+
+/*
+ * Joining and splitting
+ * =====================
+ *
+ * avl_tree_join() links two trees and a node which sorts between them into
+ * one tree, and avl_tree_split() cuts a tree in two at a key.  The join walks
+ * down the side of the taller tree to a subtree as high as the shorter one,
+ * puts the node there with the two as its children, and rebalances upwards as
+ * for an insertion, in O(1 + |difference of heights|) time.  A split rejoins
+ * the subtrees hanging off the search path bottom-up; the costs of those
+ * joins add up to O(log n).
+ *
+ * Heights are not stored in the nodes, but follow from the balance factors on
+ * any path downwards.
+ */
+
+/* Returns the height of the subtree rooted at @node, in O(log n) time.  */
+static int
+avl_height(const struct avl_tree_node *node)
+{
+	int height = 0;
+
+	while (node) {
+		height++;
+		node = avl_get_balance_factor(node) < 0 ? node->left :
+							  node->right;
+	}
+	return height;
+}
+
+/* Returns the height of the child of @node in direction @sign, given the
+ * height of @node.  */
+static AVL_INLINE int
+avl_child_height(const struct avl_tree_node *node, int height, const int sign)
+{
+	return height - (sign * avl_get_balance_factor(node) < 0 ? 2 : 1);
+}
+
+/*
+ * Template for joining two subtrees with a middle node, where @tall is at
+ * least as high as @other ---
+ *
+ * sign > 0:  @tall holds the smaller keys; walk down its right side.
+ * sign < 0:  @tall holds the larger keys; walk down its left side.
+ *
+ * @tall and @other must not have parents.  Returns the root of the joined
+ * tree and stores its height in *height_ret.  If @update is not NULL, it is
+ * called on @mid and the nodes above it, which are those the walk went
+ * through, before rebalancing.
+ */
+static AVL_INLINE struct avl_tree_node *
+avl_join_template(struct avl_tree_node *tall, int tall_height,
+		  struct avl_tree_node *mid,
+		  struct avl_tree_node *other, int other_height,
+		  int *height_ret, const int sign,
+		  void (* const update)(struct avl_tree_node *))
+{
+	struct avl_tree_root root = { .avl_tree_node = tall };
+	struct avl_tree_node *parent = NULL, *sub = tall, *node;
+	int sub_height = tall_height;
+
+	/* Find the first subtree on the side of @tall no more than one level
+	 * higher than @other.  Balance factors limit it to one level higher
+	 * or the same height.  */
+	while (sub_height > other_height + 1) {
+		sub_height = avl_child_height(sub, sub_height, sign);
+		parent = sub;
+		sub = avl_get_child(sub, sign);
+	}
+
+	avl_set_child(mid, -sign, sub);
+	avl_set_child(mid, +sign, other);
+	avl_set_parent_balance(mid, parent, sign * (other_height - sub_height));
+	if (sub)
+		avl_set_parent(sub, mid);
+	if (other)
+		avl_set_parent(other, mid);
+
+	if (!parent) {
+		if (update)
+			(*update)(mid);
+		*height_ret = sub_height + 1;
+		return mid;
+	}
+
+	avl_set_child(parent, sign, mid);
+	if (update)
+		for (node = mid; node; node = avl_get_parent(node))
+			(*update)(node);
+
+	/* @mid is one level higher than @sub, the subtree it replaces, and has
+	 * a balance factor of 0 only if its parent is heavy towards the other
+	 * side.  So the tree can be rebalanced as after an insertion.  */
+	node = mid;
+	*height_ret = tall_height;
+	while (!avl_handle_subtree_growth(&root, node, parent, sign, update)) {
+		node = parent;
+		parent = avl_get_parent(node);
+		if (!parent) {
+			(*height_ret)++;
+			break;
+		}
+	}
+	return root.avl_tree_node;
+}
+
+/* Joins subtrees @left and @right of heights @left_height and @right_height
+ * with @mid, and returns the root of the result.  */
+static struct avl_tree_node *
+avl_join(struct avl_tree_node *left, int left_height,
+	 struct avl_tree_node *mid,
+	 struct avl_tree_node *right, int right_height, int *height_ret,
+	 void (*update)(struct avl_tree_node *))
+{
+	if (left)
+		avl_set_parent(left, NULL);
+	if (right)
+		avl_set_parent(right, NULL);
+
+	if (left_height >= right_height)
+		return avl_join_template(left, left_height, mid,
+					 right, right_height, height_ret, +1,
+					 update);
+	else
+		return avl_join_template(right, right_height, mid,
+					 left, left_height, height_ret, -1,
+					 update);
+}
+
+/*
+ * Joins two AVL trees and a node into one tree.
+ *
+ * @root
+ *	Location of the root pointer of the result.  May be @left or @right.
+ *
+ * @left, @right
+ *	The trees to join.  Every item of @left must sort before @mid, and
+ *	every item of @right after it.  Both are empty on return, unless they
+ *	are @root.
+ *
+ * @mid
+ *	Pointer to the `struct avl_tree_node' embedded in an item which is in
+ *	neither tree.
+ *
+ * Takes O(log n) time.
+ */
+void
+avl_tree_join(struct avl_tree_root *root, struct avl_tree_root *left,
+	      struct avl_tree_node *mid, struct avl_tree_root *right)
+{
+	struct avl_tree_node *l = left->avl_tree_node;
+	struct avl_tree_node *r = right->avl_tree_node;
+	int height;
+
+	left->avl_tree_node = NULL;
+	right->avl_tree_node = NULL;
+	root->avl_tree_node = avl_join(l, avl_height(l), mid,
+				       r, avl_height(r), &height, NULL);
+}
+
+/* Same as avl_tree_join(), but for an augmented tree; see
+ * avl_tree_rebalance_after_insert_augmented().  */
+void
+avl_tree_join_augmented(struct avl_tree_root *root, struct avl_tree_root *left,
+			struct avl_tree_node *mid, struct avl_tree_root *right,
+			void (*update)(struct avl_tree_node *))
+{
+	struct avl_tree_node *l = left->avl_tree_node;
+	struct avl_tree_node *r = right->avl_tree_node;
+	int height;
+
+	left->avl_tree_node = NULL;
+	right->avl_tree_node = NULL;
+	root->avl_tree_node = avl_join(l, avl_height(l), mid,
+				       r, avl_height(r), &height, update);
+}
+
+/* Splits the tree at @root as for avl_tree_split(), with @update NULL or the
+ * callback of an augmented tree.  */
+static void
+avl_split(struct avl_tree_root *root,
+	  const void *cmp_ctx,
+	  int (*cmp)(const void *, const struct avl_tree_node *),
+	  struct avl_tree_root *left, struct avl_tree_root *right,
+	  void (*update)(struct avl_tree_node *))
+{
+	struct avl_tree_node *cur = root->avl_tree_node, *last = NULL;
+	struct avl_tree_node *l = NULL, *r = NULL, *child = NULL;
+	int l_height = 0, r_height = 0, child_height = 0;
+	bool to_left = false;
+
+	root->avl_tree_node = NULL;
+
+	while (cur) {
+		last = cur;
+		to_left = (*cmp)(cmp_ctx, cur) > 0;
+		cur = to_left ? cur->right : cur->left;
+	}
+
+	/* Walk back up the search path.  Each node, with its subtree on the
+	 * side the path did not take, is joined onto the part it belongs
+	 * to.  */
+	for (cur = last; cur; ) {
+		struct avl_tree_node *parent = avl_get_parent(cur);
+		int height;
+
+		if (child)
+			to_left = (child == cur->right);
+
+		if (to_left) {
+			height = child_height +
+				 (avl_get_balance_factor(cur) < 0 ? 2 : 1);
+			l = avl_join(cur->left,
+				     avl_child_height(cur, height, -1),
+				     cur, l, l_height, &l_height, update);
+		} else {
+			height = child_height +
+				 (avl_get_balance_factor(cur) > 0 ? 2 : 1);
+			r = avl_join(r, r_height, cur, cur->right,
+				     avl_child_height(cur, height, +1),
+				     &r_height, update);
+		}
+
+		child = cur;
+		child_height = height;
+		cur = parent;
+	}
+
+	left->avl_tree_node = l;
+	right->avl_tree_node = r;
+}
+
+/*
+ * Splits an AVL tree in two at a key.
+ *
+ * @root
+ *	Location of the AVL tree's root pointer.  The tree is empty on return,
+ *	unless it is @left or @right.
+ *
+ * @cmp_ctx, @cmp
+ *	The key to split at, as for avl_tree_lookup().
+ *
+ * @left
+ *	Location of the root pointer which receives the items that sort before
+ *	the key, that is those for which @cmp returns a positive value.
+ *
+ * @right
+ *	Location of the root pointer which receives the other items, equal to
+ *	or after the key.
+ *
+ * Takes O(log n) time.
+ */
+void
+avl_tree_split(struct avl_tree_root *root,
+	       const void *cmp_ctx,
+	       int (*cmp)(const void *, const struct avl_tree_node *),
+	       struct avl_tree_root *left, struct avl_tree_root *right)
+{
+	avl_split(root, cmp_ctx, cmp, left, right, NULL);
+}
+
+/* Same as avl_tree_split(), but for an augmented tree; see
+ * avl_tree_rebalance_after_insert_augmented().  @cmp is called exactly once
+ * on each node of the search path, from the root down, so it may keep track
+ * of where it is through @cmp_ctx, for example to split at a position.  */
+void
+avl_tree_split_augmented(struct avl_tree_root *root,
+			 const void *cmp_ctx,
+			 int (*cmp)(const void *, const struct avl_tree_node *),
+			 struct avl_tree_root *left, struct avl_tree_root *right,
+			 void (*update)(struct avl_tree_node *))
+{
+	avl_split(root, cmp_ctx, cmp, left, right, update);
+}
+
+/*
+ * Relaxed balancing
+ * =================
+ *
+ * During bursts of updates it can be cheaper to skip rebalancing and restore
+ * the balance once afterwards.  avl_tree_link_node_relaxed() and
+ * avl_tree_remove_relaxed() link and unlink nodes without rebalancing.  Until
+ * avl_tree_rebalance_pending() is called the tree must only be searched,
+ * walked with the parent-pointer traversals of avl_traversal.h, or changed
+ * with these two functions.  Anything which keeps a path on a bounded stack,
+ * such as the stack cursors of avl_cursor.h, assumes an AVL height.
+ *
+ * How deep the tree gets meanwhile depends on the order of the updates:
+ * random keys keep it within a small factor of log2(n), but keys arriving in
+ * sorted order degrade it to a list.
+ *
+ * Each change records where the balance may be off by setting the balance
+ * field of the nodes above it to AVL_PENDING, stopping at the first one which
+ * already holds it.  The pending nodes thus form a subtree at the top of the
+ * tree, and every subtree hanging off it is unchanged since the last
+ * rebalancing, so it is still an AVL tree with valid balance factors.  Marking
+ * costs one step per node newly made pending.
+ *
+ * avl_tree_rebalance_pending() visits the pending nodes only, bottom-up, and
+ * joins each with its two subtrees, already rebalanced, as avl_tree_join()
+ * does.  With m pending nodes, at most the number of changes times the height
+ * of the tree, that takes O(m log n) time and no extra memory, and the result
+ * is an AVL tree again.
+ */
+
+/* Balance field of a node whose balance factor is stale.  Not a valid balance
+ * factor, and not a height stashed by avl_tree_rebalance_pending() either,
+ * since those are at least 4.  */
+#define AVL_PENDING  2
+
+/* Marks @node and the nodes above it as pending, up to the first one which
+ * already is.  */
+static AVL_INLINE void
+avl_mark_pending(struct avl_tree_node *node)
+{
+	while (node && node->balance != AVL_PENDING) {
+		node->balance = AVL_PENDING;
+		node = avl_get_parent(node);
+	}
+}
+
+/* Same as avl_tree_link_node(), but does not rebalance the tree.  */
+void
+avl_tree_link_node_relaxed(struct avl_tree_link *link,
+			   struct avl_tree_node *node)
+{
+	node->parent = link->parent;
+	node->balance = 0;
+	node->left = NULL;
+	node->right = NULL;
+
+	*link->node = node;
+	avl_mark_pending(link->parent);
+}
+
+/* Same as avl_tree_remove(), but does not rebalance the tree.  */
+void
+avl_tree_remove_relaxed(struct avl_tree_root *root, struct avl_tree_node *node)
+{
+	bool left_deleted;
+
+	avl_mark_pending(avl_tree_unlink(root, node, &left_deleted));
+}
+
+/* Returns the first node in postorder among the pending nodes of the subtree
+ * rooted at @node, which must be pending.  */
+static AVL_INLINE struct avl_tree_node *
+avl_pending_first(struct avl_tree_node *node)
+{
+	for (;;) {
+		if (node->left && node->left->balance == AVL_PENDING)
+			node = node->left;
+		else if (node->right && node->right->balance == AVL_PENDING)
+			node = node->right;
+		else
+			return node;
+	}
+}
+
+/* Returns the height of @node, a child of the pending node being rebalanced.
+ * If @node was pending itself, its height was stashed in its balance field as
+ * (height << 2) | (balance factor + 1); the balance factor is restored.  */
+static AVL_INLINE int
+avl_pending_height(struct avl_tree_node *node)
+{
+	int height;
+
+	if (!node || node->balance <= 1)
+		return avl_height(node);
+
+	height = node->balance >> 2;
+	node->balance = (node->balance & 3) - 1;
+	return height;
+}
+
+/* Restores the AVL balance of a tree changed with avl_tree_link_node_relaxed()
+ * or avl_tree_remove_relaxed().  Only the nodes above the changes are
+ * visited.  */
+void
+avl_tree_rebalance_pending(struct avl_tree_root *root)
+{
+	struct avl_tree_node *node = root->avl_tree_node;
+
+	if (!node || node->balance != AVL_PENDING)
+		return;
+
+	node = avl_pending_first(node);
+	for (;;) {
+		struct avl_tree_node *parent = avl_get_parent(node);
+		struct avl_tree_node **link = &root->avl_tree_node;
+		int left_height = avl_pending_height(node->left);
+		int right_height = avl_pending_height(node->right);
+		int height;
+
+		if (parent)
+			link = (node == parent->left) ? &parent->left :
+							&parent->right;
+
+		*link = avl_join(node->left, left_height, node,
+				 node->right, right_height, &height, NULL);
+		if (!parent)
+			break;
+
+		/* Stash the height of the new subtree for @parent.  */
+		node = *link;
+		avl_set_parent(node, parent);
+		node->balance = (height << 2) | (node->balance + 1);
+
+		if (link == &parent->left && parent->right &&
+		    parent->right->balance == AVL_PENDING)
+			node = avl_pending_first(parent->right);
+		else
+			node = parent;
+	}
 }
@@ -23,6 +23,10 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifdef __GNUC__
 #  define AVL_INLINE inline __attribute__((always_inline))
 #else
@@ -44,6 +48,11 @@ struct avl_tree_node {
 	int balance;
 };
 
+/* Upper bound on the height of any AVL tree in memory: a tree of height h has
+ * at least F(h + 2) - 1 nodes (F being the Fibonacci numbers), which is more
+ * than 2^64 for h = 92.  */
+#define AVL_TREE_MAX_HEIGHT  92
+
 struct avl_tree_root {
 	struct avl_tree_node *avl_tree_node;
 };
@@ -102,4 +111,74 @@ avl_tree_link_node(struct avl_tree_root *root, struct avl_tree_link *link,
 extern void
 avl_tree_remove(struct avl_tree_root *root, struct avl_tree_node *node);
 
+/* (Internal use only) avl_tree_link_node() and avl_tree_remove() without the
+ * trace hooks of avl_trace.h, for callers which trace the operation
+ * themselves or whose nodes are not items of the application.  */
+extern void
+avl_tree_link_node_untraced(struct avl_tree_root *root,
+			    struct avl_tree_link *link,
+			    struct avl_tree_node *node);
+
+extern void
+avl_tree_remove_untraced(struct avl_tree_root *root,
+			 struct avl_tree_node *node);
+
+/* Relaxed balancing: link and unlink without rebalancing, then restore the
+ * balance of the changed part of the tree at once.  See implementation for
+ * details.  */
+extern void
+avl_tree_link_node_relaxed(struct avl_tree_link *link,
+			   struct avl_tree_node *node);
+
+extern void
+avl_tree_remove_relaxed(struct avl_tree_root *root, struct avl_tree_node *node);
+
+extern void
+avl_tree_rebalance_pending(struct avl_tree_root *root);
+
+/* Puts @new_node in the place of @old_node without rebalancing.
+ * See implementation for details.  */
+extern void
+avl_tree_replace(struct avl_tree_root *root, struct avl_tree_node *old_node,
+		 struct avl_tree_node *new_node);
+
+/* Joining and splitting whole trees.  See implementation for details.  */
+extern void
+avl_tree_join(struct avl_tree_root *root, struct avl_tree_root *left,
+	      struct avl_tree_node *mid, struct avl_tree_root *right);
+
+extern void
+avl_tree_split(struct avl_tree_root *root,
+	       const void *cmp_ctx,
+	       int (*cmp)(const void *, const struct avl_tree_node *),
+	       struct avl_tree_root *left, struct avl_tree_root *right);
+
+/* The same for augmented trees, whose nodes cache something about their
+ * subtrees, kept up to date by @update.  See implementation for details.  */
+extern void
+avl_tree_rebalance_after_insert_augmented(struct avl_tree_root *root,
+					  struct avl_tree_node *inserted,
+					  void (*update)(struct avl_tree_node *));
+
+extern void
+avl_tree_remove_augmented(struct avl_tree_root *root,
+			  struct avl_tree_node *node,
+			  void (*update)(struct avl_tree_node *));
+
+extern void
+avl_tree_join_augmented(struct avl_tree_root *root, struct avl_tree_root *left,
+			struct avl_tree_node *mid, struct avl_tree_root *right,
+			void (*update)(struct avl_tree_node *));
+
+extern void
+avl_tree_split_augmented(struct avl_tree_root *root,
+			 const void *cmp_ctx,
+			 int (*cmp)(const void *, const struct avl_tree_node *),
+			 struct avl_tree_root *left, struct avl_tree_root *right,
+			 void (*update)(struct avl_tree_node *));
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _AVL_TREE_H_ */
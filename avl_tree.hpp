@@ -0,0 +1,519 @@
+/*
+ * intrusive, nonrecursive AVL tree data structure (self-balancing
+ * binary search tree), C++ interface
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Header-only C++ templates over the C implementation
+ * ===================================================
+ *
+ * avl::intrusive_set<T, offsetof(T, node), Compare> and friends wrap a
+ * `struct avl_tree_root' whose items are objects of type T with an embedded
+ * `struct avl_tree_node' member.  T must be a standard-layout type, for which
+ * offsetof() is defined, and items are found from their nodes by subtracting
+ * the offset, as avl_tree_entry() does in C.  The searches are templates, so
+ * the comparator and key extractor are inlined instead of being called
+ * through function pointers; linking, unlinking and rebalancing use
+ * avl_tree.c, and iterators step with avl_traversal.c.  As with the C
+ * interface, the containers never allocate, copy or free items.
+ *
+ * Iterators are bidirectional and the containers are std::ranges ranges, so
+ * standard algorithms work on them directly:
+ *
+ * struct item {
+ *	int key;
+ *	avl_tree_node node;
+ *	bool operator<(const item &o) const { return key < o.key; }
+ * };
+ *
+ * avl::intrusive_set<item, offsetof(item, node)> set;
+ * set.insert(a);
+ * auto n = std::ranges::count_if(set, [](const item &i) { return i.key & 1; });
+ *
+ * With a key extractor, lookups take keys rather than whole items:
+ *
+ * struct key_of { int operator()(const item &i) const { return i.key; } };
+ * avl::intrusive_multimap<item, offsetof(item, node), key_of> map;
+ * auto [first, last] = map.equal_range(42);
+ *
+ * Requires C++20.
+ */
+
+#ifndef _AVL_TREE_HPP
+#define _AVL_TREE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "avl_tree.h"
+#include "avl_traversal.h"
+
+namespace avl {
+
+/* Key extractor for sets: the item is its own key.  */
+struct identity {
+	template <class T>
+	constexpr const T &operator()(const T &item) const noexcept
+	{
+		return item;
+	}
+};
+
+template <class T, std::size_t Offset, class KeyOf, class Compare,
+	  bool Multi>
+class intrusive_tree {
+	static_assert(std::is_standard_layout_v<T>,
+		      "offsetof() is only defined for standard-layout types");
+	static_assert(Offset + sizeof(avl_tree_node) <= sizeof(T),
+		      "the node must be a member of the item");
+
+public:
+	using value_type = T;
+	using key_type = std::remove_cvref_t<
+		std::invoke_result_t<const KeyOf &, const T &>>;
+	using key_compare = Compare;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T &;
+	using const_reference = const T &;
+
+private:
+	/* Converts between items and their embedded nodes.  */
+	static avl_tree_node *to_node(T &item) noexcept
+	{
+		return reinterpret_cast<avl_tree_node *>(
+			reinterpret_cast<char *>(std::addressof(item)) +
+			Offset);
+	}
+
+	static T *to_item(const avl_tree_node *node) noexcept
+	{
+		return reinterpret_cast<T *>(
+			const_cast<char *>(
+				reinterpret_cast<const char *>(node)) - Offset);
+	}
+
+	template <bool Const>
+	class basic_iterator {
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using iterator_concept = std::bidirectional_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<Const, const T *, T *>;
+		using reference = std::conditional_t<Const, const T &, T &>;
+
+		basic_iterator() noexcept = default;
+
+		/* iterator converts to const_iterator.  */
+		template <bool C = Const, class = std::enable_if_t<C>>
+		basic_iterator(const basic_iterator<false> &other) noexcept
+			: root_(other.root_), node_(other.node_)
+		{
+		}
+
+		reference operator*() const noexcept
+		{
+			return *to_item(node_);
+		}
+
+		pointer operator->() const noexcept
+		{
+			return to_item(node_);
+		}
+
+		basic_iterator &operator++() noexcept
+		{
+			node_ = avl_tree_next_in_order(node_);
+			return *this;
+		}
+
+		basic_iterator operator++(int) noexcept
+		{
+			basic_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		/* Decrementing end() gives the last item.  */
+		basic_iterator &operator--() noexcept
+		{
+			node_ = node_ ? avl_tree_prev_in_order(node_)
+				      : avl_tree_last_in_order(root_);
+			return *this;
+		}
+
+		basic_iterator operator--(int) noexcept
+		{
+			basic_iterator old = *this;
+			--*this;
+			return old;
+		}
+
+		friend bool operator==(const basic_iterator &a,
+				       const basic_iterator &b) noexcept
+		{
+			return a.node_ == b.node_;
+		}
+
+	private:
+		friend class intrusive_tree;
+		friend class basic_iterator<!Const>;
+
+		basic_iterator(const avl_tree_root *root,
+			       avl_tree_node *node) noexcept
+			: root_(root), node_(node)
+		{
+		}
+
+		const avl_tree_root *root_ = nullptr;
+		avl_tree_node *node_ = nullptr;
+	};
+
+public:
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	/* insert() returns an iterator for multisets and maps, and an
+	 * (iterator, inserted) pair otherwise, as the standard containers do. */
+	using insert_return_type =
+		std::conditional_t<Multi, iterator, std::pair<iterator, bool>>;
+
+	intrusive_tree() noexcept(
+		std::is_nothrow_default_constructible_v<Compare>) = default;
+
+	explicit intrusive_tree(const Compare &comp) : comp_(comp)
+	{
+	}
+
+	/* Items can only be in one tree, so the containers can be moved but
+	 * not copied.  Moving is O(1) since only the root pointer moves.  */
+	intrusive_tree(const intrusive_tree &) = delete;
+	intrusive_tree &operator=(const intrusive_tree &) = delete;
+
+	intrusive_tree(intrusive_tree &&other) noexcept
+		: root_(other.root_), size_(other.size_),
+		  comp_(std::move(other.comp_))
+	{
+		other.root_.avl_tree_node = nullptr;
+		other.size_ = 0;
+	}
+
+	intrusive_tree &operator=(intrusive_tree &&other) noexcept
+	{
+		std::swap(root_, other.root_);
+		std::swap(size_, other.size_);
+		std::swap(comp_, other.comp_);
+		return *this;
+	}
+
+	iterator begin() noexcept
+	{
+		return iterator(&root_, avl_tree_first_in_order(&root_));
+	}
+
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(&root_, avl_tree_first_in_order(&root_));
+	}
+
+	iterator end() noexcept
+	{
+		return iterator(&root_, nullptr);
+	}
+
+	const_iterator end() const noexcept
+	{
+		return const_iterator(&root_, nullptr);
+	}
+
+	const_iterator cbegin() const noexcept { return begin(); }
+	const_iterator cend() const noexcept { return end(); }
+
+	reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+	reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+
+	const_reverse_iterator rbegin() const noexcept
+	{
+		return const_reverse_iterator(end());
+	}
+
+	const_reverse_iterator rend() const noexcept
+	{
+		return const_reverse_iterator(begin());
+	}
+
+	const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+	const_reverse_iterator crend() const noexcept { return rend(); }
+
+	bool empty() const noexcept
+	{
+		return root_.avl_tree_node == nullptr;
+	}
+
+	size_type size() const noexcept
+	{
+		return size_;
+	}
+
+	key_compare key_comp() const
+	{
+		return comp_;
+	}
+
+	/* Returns an iterator pointing at @item, which must be in the tree,
+	 * in O(1).  */
+	iterator iterator_to(T &item) noexcept
+	{
+		return iterator(&root_, to_node(item));
+	}
+
+	const_iterator iterator_to(const T &item) const noexcept
+	{
+		return const_iterator(&root_,
+				      to_node(const_cast<T &>(item)));
+	}
+
+	/* Links @item into the tree.  For unique containers nothing is done
+	 * if an equal item is already present; its position is returned with
+	 * false.  Duplicates are inserted after their equals, as with
+	 * avl_tree_insert_multi().  */
+	insert_return_type insert(T &item)
+	{
+		const auto &key = KeyOf()(item);
+		avl_tree_link link;
+		avl_tree_node **current = &root_.avl_tree_node;
+
+		tree_search_for_each (&link, current) {
+			if (comp_(key, KeyOf()(*to_item(*current)))) {
+				current = &(*current)->left;
+			} else if (Multi ||
+				   comp_(KeyOf()(*to_item(*current)), key)) {
+				current = &(*current)->right;
+			} else {
+				if constexpr (!Multi)
+					return { iterator(&root_, *current),
+						 false };
+			}
+		}
+
+		avl_tree_link_node(&root_, &link, to_node(item));
+		size_++;
+		if constexpr (Multi)
+			return iterator(&root_, to_node(item));
+		else
+			return { iterator(&root_, to_node(item)), true };
+	}
+
+	/* Unlinks the item at @pos and returns an iterator to the next one.
+	 * The item itself is left alone.  */
+	iterator erase(const_iterator pos) noexcept
+	{
+		avl_tree_node *next = avl_tree_next_in_order(pos.node_);
+
+		avl_tree_remove(&root_, pos.node_);
+		size_--;
+		return iterator(&root_, next);
+	}
+
+	iterator erase(const_iterator first, const_iterator last) noexcept
+	{
+		while (first != last)
+			first = erase(first);
+		return iterator(&root_, last.node_);
+	}
+
+	/* Unlinks @item, which must be in the tree.  */
+	void erase(T &item) noexcept
+	{
+		avl_tree_remove(&root_, to_node(item));
+		size_--;
+	}
+
+	/* Unlinks all items equal to @key and returns how many there were.  */
+	template <class K>
+	size_type erase_key(const K &key)
+	{
+		auto [first, last] = equal_range(key);
+		size_type n = 0;
+
+		while (first != last) {
+			first = erase(first);
+			n++;
+		}
+		return n;
+	}
+
+	/* Forgets all items in O(1).  Their nodes are left as they are.  */
+	void clear() noexcept
+	{
+		root_.avl_tree_node = nullptr;
+		size_ = 0;
+	}
+
+	/* Lookups accept any type the comparator can compare against keys
+	 * (a heterogeneous lookup, with e.g. std::less<>).  */
+
+	template <class K>
+	iterator find(const K &key)
+	{
+		return iterator(&root_, find_node(key));
+	}
+
+	template <class K>
+	const_iterator find(const K &key) const
+	{
+		return const_iterator(&root_, find_node(key));
+	}
+
+	template <class K>
+	bool contains(const K &key) const
+	{
+		return find_node(key) != nullptr;
+	}
+
+	template <class K>
+	size_type count(const K &key) const
+	{
+		if constexpr (!Multi)
+			return contains(key);
+
+		auto [first, last] = equal_range(key);
+		return std::distance(first, last);
+	}
+
+	template <class K>
+	iterator lower_bound(const K &key)
+	{
+		return iterator(&root_, bound_node<false>(key));
+	}
+
+	template <class K>
+	const_iterator lower_bound(const K &key) const
+	{
+		return const_iterator(&root_, bound_node<false>(key));
+	}
+
+	template <class K>
+	iterator upper_bound(const K &key)
+	{
+		return iterator(&root_, bound_node<true>(key));
+	}
+
+	template <class K>
+	const_iterator upper_bound(const K &key) const
+	{
+		return const_iterator(&root_, bound_node<true>(key));
+	}
+
+	template <class K>
+	std::pair<iterator, iterator> equal_range(const K &key)
+	{
+		return { lower_bound(key), upper_bound(key) };
+	}
+
+	template <class K>
+	std::pair<const_iterator, const_iterator>
+	equal_range(const K &key) const
+	{
+		return { lower_bound(key), upper_bound(key) };
+	}
+
+	/* The underlying C tree, for use with the C functions.  */
+	avl_tree_root *c_root() noexcept
+	{
+		return &root_;
+	}
+
+	const avl_tree_root *c_root() const noexcept
+	{
+		return &root_;
+	}
+
+private:
+	template <class K>
+	avl_tree_node *find_node(const K &key) const
+	{
+		avl_tree_node *cur = root_.avl_tree_node;
+
+		while (cur) {
+			const auto &cur_key = KeyOf()(*to_item(cur));
+
+			if (comp_(key, cur_key))
+				cur = cur->left;
+			else if (comp_(cur_key, key))
+				cur = cur->right;
+			else
+				break;
+		}
+		return cur;
+	}
+
+	/* First node whose key is greater than @key (Upper) or not less than
+	 * @key (!Upper).  */
+	template <bool Upper, class K>
+	avl_tree_node *bound_node(const K &key) const
+	{
+		avl_tree_node *cur = root_.avl_tree_node;
+		avl_tree_node *result = nullptr;
+
+		while (cur) {
+			const auto &cur_key = KeyOf()(*to_item(cur));
+			bool go_left;
+
+			if constexpr (Upper)
+				go_left = comp_(key, cur_key);
+			else
+				go_left = !comp_(cur_key, key);
+
+			if (go_left) {
+				result = cur;
+				cur = cur->left;
+			} else {
+				cur = cur->right;
+			}
+		}
+		return result;
+	}
+
+	avl_tree_root root_ = { nullptr };
+	size_type size_ = 0;
+	[[no_unique_address]] Compare comp_ = Compare();
+};
+
+template <class T, std::size_t Offset, class Compare = std::less<T>>
+using intrusive_set = intrusive_tree<T, Offset, identity, Compare, false>;
+
+template <class T, std::size_t Offset, class Compare = std::less<T>>
+using intrusive_multiset = intrusive_tree<T, Offset, identity, Compare, true>;
+
+template <class T, std::size_t Offset, class KeyOf,
+	  class Compare = std::less<>>
+using intrusive_map = intrusive_tree<T, Offset, KeyOf, Compare, false>;
+
+template <class T, std::size_t Offset, class KeyOf,
+	  class Compare = std::less<>>
+using intrusive_multimap = intrusive_tree<T, Offset, KeyOf, Compare, true>;
+
+} /* namespace avl */
+
+#endif /* _AVL_TREE_HPP */
@@ -0,0 +1,558 @@
+/*
+ * replay.c - runs an operation trace against the AVL tree variants
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Usage: replay [-v VARIANT] [-r REPEAT] [-p] [-s] TRACE
+ *
+ * Reads a trace recorded with avl_trace_start() (see avl_trace.c) and replays
+ * its operations, in order, against one tree variant:
+ *
+ *	tree	struct avl_tree_node with avl_tree_insert(), avl_tree_lookup()
+ *		and avl_tree_remove_key() (the default)
+ *	lite	struct avl_lite_node, without parent pointers
+ *	radix	avl_radix_tree, its table indexed by the high bits of the
+ *		range of keys in the trace
+ *
+ * The whole trace is run REPEAT times (default 1) from an empty tree, each
+ * repetition timed as a whole, for throughput.  After the last one, one more
+ * run times each operation, for the latency histogram, which has a bucket per
+ * power of two nanoseconds.  Latencies include the cost of reading the clock,
+ * some tens of nanoseconds.
+ *
+ * With -p, hardware performance counters (cycles, instructions, branch
+ * misses, L1 data cache, last level cache and data TLB read misses) are also
+ * read around the operations of each repetition, but not of the latency run,
+ * with perf_event_open(), and reported per operation.  Like the timing, they
+ * leave out resetting the trees between repetitions and printing the results.
+ * This tells whether a change to the node layout or to the descent saved
+ * cache or TLB misses or mispredicted branches rather than just time.
+ * Counters the CPU or the kernel does not offer (for instance with
+ * perf_event_paranoid above 2) are left out; kernel code is not counted.
+ *
+ * With -s and the tree variant, a full in-order scan of the tree left at the
+ * end is timed twice: following parent pointers with avl_tree_next_in_order(),
+ * then with a `struct avl_tree_stack_cursor'.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "avl_cursor.h"
+#include "avl_generic.h"
+#include "avl_lite.h"
+#include "avl_radix.h"
+#include "avl_trace.h"
+#include "avl_traversal.h"
+
+#define LATENCY_BUCKETS	40
+
+struct replay_op {
+	int op;
+	unsigned long key;
+};
+
+struct replay_item {
+	struct avl_tree_node node;
+	struct avl_lite_node lite;
+	unsigned long key;
+};
+
+/* State of one replay: the trees and the items inserted into them  */
+struct replay {
+	const struct replay_op *ops;
+	size_t nops;
+	struct replay_item *items;
+	size_t nitems;
+
+	struct avl_tree_root root;
+	struct avl_lite_root lite_root;
+	struct avl_radix_tree radix;
+
+	unsigned long long latency[LATENCY_BUCKETS];
+	size_t hits;
+
+	/* Whether to read the performance counters around untimed runs  */
+	bool counters;
+};
+
+static int
+cmp_tree_items(const struct avl_tree_node *node1,
+	       const struct avl_tree_node *node2)
+{
+	const unsigned long k1 =
+		avl_tree_entry(node1, struct replay_item, node)->key;
+	const unsigned long k2 =
+		avl_tree_entry(node2, struct replay_item, node)->key;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static int
+cmp_key_to_tree_item(const void *key, const struct avl_tree_node *node)
+{
+	const unsigned long k1 = *(const unsigned long *)key;
+	const unsigned long k2 =
+		avl_tree_entry(node, struct replay_item, node)->key;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static int
+cmp_lite_items(const struct avl_lite_node *node1,
+	       const struct avl_lite_node *node2)
+{
+	const unsigned long k1 =
+		avl_lite_entry(node1, struct replay_item, lite)->key;
+	const unsigned long k2 =
+		avl_lite_entry(node2, struct replay_item, lite)->key;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static int
+cmp_key_to_lite_item(const void *key, const struct avl_lite_node *node)
+{
+	const unsigned long k1 = *(const unsigned long *)key;
+	const unsigned long k2 =
+		avl_lite_entry(node, struct replay_item, lite)->key;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef __linux__
+
+#define HW_CACHE_READ_MISSES(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} counter_defs[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "L1d-misses", PERF_TYPE_HW_CACHE,
+	  HW_CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+	{ "LLC-misses", PERF_TYPE_HW_CACHE,
+	  HW_CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_LL) },
+	{ "dTLB-misses", PERF_TYPE_HW_CACHE,
+	  HW_CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+#define NUM_COUNTERS	(sizeof(counter_defs) / sizeof(counter_defs[0]))
+
+/* File descriptors of the counters, -1 for those not available  */
+static int counter_fds[NUM_COUNTERS];
+
+/* Opens the counters for this thread.  Returns how many could be opened.  */
+static int
+counters_open(void)
+{
+	int n = 0;
+
+	for (size_t c = 0; c < NUM_COUNTERS; c++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_defs[c].type;
+		attr.config = counter_defs[c].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		/* To scale the counts if the counters had to be multiplexed  */
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		counter_fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+					 0);
+		n += counter_fds[c] >= 0;
+	}
+	return n;
+}
+
+static void
+counters_start(void)
+{
+	for (size_t c = 0; c < NUM_COUNTERS; c++) {
+		if (counter_fds[c] < 0)
+			continue;
+		ioctl(counter_fds[c], PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/* Counts of the last run, scaled if the counters had to be multiplexed  */
+static uint64_t counter_values[NUM_COUNTERS];
+static bool counter_scaled[NUM_COUNTERS];
+
+/* Stops the counters and reads their counts.  */
+static void
+counters_stop(void)
+{
+	for (size_t c = 0; c < NUM_COUNTERS; c++)
+		if (counter_fds[c] >= 0)
+			ioctl(counter_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+
+	for (size_t c = 0; c < NUM_COUNTERS; c++) {
+		uint64_t v[3];	/* value, time enabled, time running  */
+
+		counter_values[c] = 0;
+		counter_scaled[c] = false;
+		if (counter_fds[c] < 0 ||
+		    read(counter_fds[c], v, sizeof(v)) != sizeof(v))
+			continue;
+		if (v[2] && v[2] < v[1])
+			v[0] = (uint64_t)((double)v[0] * v[1] / v[2]);
+		counter_values[c] = v[0];
+		counter_scaled[c] = v[2] < v[1];
+	}
+}
+
+/* Prints the counts of the last run divided by @nops.  */
+static void
+counters_print(size_t nops)
+{
+	for (size_t c = 0; c < NUM_COUNTERS; c++) {
+		if (counter_fds[c] < 0)
+			continue;
+		printf("  %-14s %10.2f /op%s\n", counter_defs[c].name,
+		       nops ? (double)counter_values[c] / nops : 0.0,
+		       counter_scaled[c] ? " (scaled)" : "");
+	}
+}
+
+static void
+counters_close(void)
+{
+	for (size_t c = 0; c < NUM_COUNTERS; c++)
+		if (counter_fds[c] >= 0)
+			close(counter_fds[c]);
+}
+
+#else /* __linux__ */
+
+static int counters_open(void) { return 0; }
+static void counters_start(void) { }
+static void counters_stop(void) { }
+static void counters_print(size_t nops) { }
+static void counters_close(void) { }
+
+#endif /* !__linux__ */
+
+/* Template for running operation @i against variant @variant.  Returns 1 on a
+ * hit: the item was found, inserted or removed.  */
+static AVL_INLINE int
+replay_op(struct replay *r, size_t i, const char variant)
+{
+	const struct replay_op *op = &r->ops[i];
+	struct replay_item *item;
+	struct avl_tree_node *node;
+
+	switch (op->op) {
+	case AVL_TRACE_LOOKUP:
+		if (variant == 't')
+			return !!avl_tree_lookup(&r->root, &op->key,
+						 cmp_key_to_tree_item);
+		if (variant == 'l')
+			return !!avl_lite_lookup(&r->lite_root, &op->key,
+						 cmp_key_to_lite_item);
+		return !!avl_radix_tree_lookup(&r->radix, op->key);
+	case AVL_TRACE_INSERT:
+		item = &r->items[r->nitems++];
+		item->key = op->key;
+		if (variant == 't')
+			return !avl_tree_insert(&r->root, &item->node,
+						cmp_tree_items);
+		if (variant == 'l')
+			return !avl_lite_insert(&r->lite_root, &item->lite,
+						cmp_lite_items);
+		return avl_radix_tree_insert(&r->radix, &item->node,
+					     NULL) == 0;
+	default:
+		if (variant == 't')
+			return !!avl_tree_remove_key(&r->root, &op->key,
+						     cmp_key_to_tree_item);
+		if (variant == 'l')
+			return !!avl_lite_remove(&r->lite_root, &op->key,
+						 cmp_key_to_lite_item);
+		node = avl_radix_tree_lookup(&r->radix, op->key);
+		if (!node)
+			return 0;
+		avl_radix_tree_remove(&r->radix, node);
+		return 1;
+	}
+}
+
+static void
+replay_reset(struct replay *r)
+{
+	r->nitems = 0;
+	r->root = AVL_ROOT;
+	r->lite_root = AVL_LITE_ROOT;
+	avl_radix_tree_destroy(&r->radix);
+}
+
+/* Runs the whole trace, timing it as a whole or, if @timed, each operation.
+ * Returns the elapsed time.  Unless @timed, the performance counters are read
+ * around the operations if @r->counters is set.  Resetting the trees before
+ * the run is neither timed nor counted.  */
+static AVL_INLINE unsigned long long
+replay_run(struct replay *r, const char variant, bool timed)
+{
+	unsigned long long start, ns;
+
+	replay_reset(r);
+	r->hits = 0;
+	if (r->counters && !timed)
+		counters_start();
+	start = now_ns();
+	for (size_t i = 0; i < r->nops; i++) {
+		if (timed) {
+			const unsigned long long t = now_ns();
+			unsigned long long ns;
+			int b = 0;
+
+			r->hits += replay_op(r, i, variant);
+			for (ns = now_ns() - t;
+			     ns > 1 && b < LATENCY_BUCKETS - 1; ns >>= 1)
+				b++;
+			r->latency[b]++;
+		} else {
+			r->hits += replay_op(r, i, variant);
+		}
+	}
+	ns = now_ns() - start;
+	if (r->counters && !timed)
+		counters_stop();
+	return ns;
+}
+
+static unsigned long long
+replay_variant(struct replay *r, char variant, bool timed)
+{
+	/* One instance of the template per variant  */
+	switch (variant) {
+	case 't':
+		return replay_run(r, 't', timed);
+	case 'l':
+		return replay_run(r, 'l', timed);
+	default:
+		return replay_run(r, 'r', timed);
+	}
+}
+
+/* Prints the latency histogram and some percentiles.  */
+static void
+print_latencies(const struct replay *r)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned long long total = 0, sum = 0;
+	size_t q = 0;
+
+	for (int b = 0; b < LATENCY_BUCKETS; b++)
+		total += r->latency[b];
+
+	printf("latency (ns)        ops\n");
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		if (!r->latency[b])
+			continue;
+		printf("  < %-12llu %12llu\n", 2ULL << b, r->latency[b]);
+	}
+	for (int b = 0; b < LATENCY_BUCKETS && q < 4; b++) {
+		sum += r->latency[b];
+		while (q < 4 && sum >= quantiles[q] * total)
+			printf("p%-6g < %llu ns\n", quantiles[q++] * 100,
+			       2ULL << b);
+	}
+}
+
+/* Times a full in-order scan of the tree left by the last run, first with
+ * avl_tree_next_in_order(), then with a stack cursor.  */
+static void
+time_scans(const struct replay *r)
+{
+	struct avl_tree_stack_cursor cursor;
+	const struct avl_tree_node *node;
+	unsigned long long start, ns[2];
+	unsigned long sum[2] = { 0, 0 };
+	size_t n = 0;
+
+	start = now_ns();
+	for (node = avl_tree_first_in_order(&r->root); node;
+	     node = avl_tree_next_in_order(node)) {
+		sum[0] += avl_tree_entry(node, struct replay_item, node)->key;
+		n++;
+	}
+	ns[0] = now_ns() - start;
+
+	start = now_ns();
+	for (node = avl_tree_stack_cursor_first(&cursor, &r->root); node;
+	     node = avl_tree_stack_cursor_next(&cursor))
+		sum[1] += avl_tree_entry(node, struct replay_item, node)->key;
+	ns[1] = now_ns() - start;
+
+	printf("scan of %zu items: %.3f s in order, %.3f s with a stack "
+	       "cursor%s\n", n, ns[0] / 1e9, ns[1] / 1e9,
+	       sum[0] == sum[1] ? "" : " (MISMATCH)");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: replay [-v tree|lite|radix] [-r REPEAT] [-p] "
+			"[-s] TRACE\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct avl_trace_reader reader;
+	struct replay_op *ops = NULL;
+	size_t nops = 0, capacity = 0, ninserts = 0;
+	unsigned long max_key = 0;
+	unsigned int key_bits = 0;
+	struct replay r;
+	char variant = 't';
+	long repeat = 1;
+	bool counters = false, scans = false;
+	int opt, res;
+
+	while ((opt = getopt(argc, argv, "v:r:ps")) != -1) {
+		switch (opt) {
+		case 'v':
+			if (strcmp(optarg, "tree") && strcmp(optarg, "lite") &&
+			    strcmp(optarg, "radix"))
+				usage();
+			variant = optarg[0];
+			break;
+		case 'p':
+			counters = true;
+			break;
+		case 's':
+			scans = true;
+			break;
+		case 'r':
+			repeat = atol(optarg);
+			if (repeat < 1)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	if (avl_trace_open(&reader, argv[optind])) {
+		fprintf(stderr, "replay: %s: cannot open trace\n",
+			argv[optind]);
+		return 1;
+	}
+	for (;;) {
+		struct replay_op op;
+
+		res = avl_trace_read(&reader, &op.op, &op.key);
+		if (res <= 0)
+			break;
+		if (nops == capacity) {
+			capacity = capacity ? 2 * capacity : 4096;
+			ops = realloc(ops, capacity * sizeof(ops[0]));
+			if (!ops) {
+				fprintf(stderr, "replay: out of memory\n");
+				return 1;
+			}
+		}
+		ninserts += op.op == AVL_TRACE_INSERT;
+		if (op.key > max_key)
+			max_key = op.key;
+		ops[nops++] = op;
+	}
+	avl_trace_close(&reader);
+	if (res < 0) {
+		fprintf(stderr, "replay: %s: damaged trace\n", argv[optind]);
+		return 1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.ops = ops;
+	r.nops = nops;
+	r.items = malloc((ninserts ? ninserts : 1) * sizeof(r.items[0]));
+	if (!r.items) {
+		fprintf(stderr, "replay: out of memory\n");
+		return 1;
+	}
+	while (key_bits < 8 * sizeof(max_key) && max_key >> key_bits)
+		key_bits++;
+	avl_radix_tree_init(&r.radix,
+			    AVL_RADIX_KEY_OFFSET(struct replay_item, node, key),
+			    key_bits);
+
+	printf("%zu operations (%zu inserts), variant %s%s\n", nops, ninserts,
+	       variant == 't' ? "tree" : variant == 'l' ? "lite" : "radix",
+	       reader.flags & AVL_TRACE_HASH_KEYS ? ", hashed keys" : "");
+
+	if (counters && !counters_open()) {
+		fprintf(stderr, "replay: no performance counters available\n");
+		counters = false;
+	}
+	r.counters = counters;
+
+	for (long i = 0; i < repeat; i++) {
+		unsigned long long ns;
+
+		ns = replay_variant(&r, variant, false);
+		printf("run %ld: %.3f s, %.1f ns/op, %.2f Mops/s, %zu hits\n",
+		       i + 1, ns / 1e9, nops ? (double)ns / nops : 0.0,
+		       ns ? nops * 1e3 / ns : 0.0, r.hits);
+		if (counters)
+			counters_print(nops);
+	}
+	if (counters)
+		counters_close();
+	replay_variant(&r, variant, true);
+	print_latencies(&r);
+	if (scans && variant == 't')
+		time_scans(&r);
+
+	avl_radix_tree_destroy(&r.radix);
+	free(r.items);
+	free(ops);
+	return 0;
+}
@@ -1,8 +1,10 @@
 /*
- * This is a test program for avl_tree.h and avl_tree.c.  Compile with:
+ * This is a test program for avl_tree.h and avl_tree.c, and for the other
+ * modules of the library, all of which it links with.  Build it with:
  *
- *	$ gcc test.c avl_generic.c avl_traversal.c avl_tree.c
- *	      -o test -std=c99 -Wall -O2
+ *	$ make test
+ *
+ * or "make test_trace" for a build with the trace hooks of avl_trace.h.
  *
  * The test strategy isn't very sophisticated; it just relies on repeated random
  * operations to cover as many cases as possible.  Feel free to improve it.
@@ -26,6 +28,24 @@
 
 #include "avl_generic.h"
 #include "avl_traversal.h"
+#include "avl_iteration.h"
+#include "avl_build.h"
+#include "avl_partition.h"
+#include "avl_block.h"
+#include "avl_hash.h"
+#include "avl_concurrent.h"
+#include "avl_fc.h"
+#include "avl_changelog.h"
+#include "avl_diff.h"
+#include "avl_memtable.h"
+#include "avl_cursor.h"
+#include "avl_lite.h"
+#include "avl_arena.h"
+#include "avl_radix.h"
+#include "avl_shm.h"
+#include "avl_trace.h"
+#include "avl_seq.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -66,6 +86,12 @@ cmp_int_nodes(const struct avl_tree_node *node1,
 	return INT_VALUE(node1) - INT_VALUE(node2);
 }
 
+static int
+cmp_int_to_node(const void *intptr, const struct avl_tree_node *nodeptr)
+{
+	return *(const int *)intptr - INT_VALUE(nodeptr);
+}
+
 static void
 insert(int n)
 {
@@ -103,6 +129,29 @@ delete(int n)
 	deletenode(node);
 }
 
+/* Replace the item with value @n by a fresh copy using avl_tree_upsert().  */
+static void
+replace(int n)
+{
+	struct test_node *old = lookup(n);
+	struct test_node *i = &nodes[node_idx++];
+
+	i->n = n;
+	assert(&old->node == avl_tree_upsert(&root, &i->node, cmp_int_nodes));
+	assert(lookup(n) == i);
+}
+
+static void
+shuffle_nodes(struct avl_tree_node *ptrs[], int count)
+{
+	for (int i = count - 1; i > 0; i--) {
+		const int x = rand() % (i + 1);
+		struct avl_tree_node *tmp = ptrs[i];
+		ptrs[i] = ptrs[x];
+		ptrs[x] = tmp;
+	}
+}
+
 #if VERIFY
 static void
 __setheights(struct avl_tree_node *node)
@@ -181,6 +230,22 @@ verify(const int *data, int count)
 	}
 	assert(x == -1);
 
+	/* Check that a partition covers the tree in order.  */
+	{
+		const unsigned int k = count % 5 + 1;
+		struct avl_tree_range ranges[k];
+		unsigned int nranges = avl_tree_partition(&root, ranges, k);
+		struct test_node *i;
+
+		assert(nranges <= k && (nranges > 0) == (count > 0));
+		x = 0;
+		for (unsigned int r = 0; r < nranges; r++)
+			avl_tree_for_each_in_range(i, &ranges[r],
+						   struct test_node, node)
+				assert(i->n == data_sorted[x++]);
+		assert(x == count);
+	}
+
 	/* Check postorder traversal.  */
 	for (cur = avl_tree_first_in_postorder(&root), x = 0;
 	     cur;
@@ -195,79 +260,2323 @@ verify(const int *data, int count)
 	}
 	assert(x == count);
 }
-#endif
 
+
+/* Insert duplicates with avl_tree_insert_multi(), using 'height' to remember
+ * the insertion order, then remove random specific duplicates.  */
 static void
-shuffle(int data[], int count)
+test_multiset(int count)
 {
-	for (int i = 0; i < count; i++) {
-		const int x = rand() % count;
-		const int v0 = data[0];
-		const int vx = data[x];
-		data[0] = vx;
-		data[x] = v0;
+	struct test_node *i;
+	int present = count;
+
+	root = AVL_ROOT;
+	for (int x = 0; x < count; x++) {
+		nodes[x].n = rand() % 8;
+		nodes[x].height = x;
+		nodes[x].reached = 0;
+		avl_tree_insert_multi(&root, &nodes[x].node, cmp_int_nodes);
+	}
+
+	while (present) {
+		const struct avl_tree_node *cur, *prev = NULL;
+		size_t total = 0;
+
+		for (cur = avl_tree_first_in_order(&root); cur;
+		     prev = cur, cur = avl_tree_next_in_order(cur)) {
+			assert(!prev || INT_VALUE(prev) < INT_VALUE(cur) ||
+			       (INT_VALUE(prev) == INT_VALUE(cur) &&
+				TEST_NODE(prev)->height < TEST_NODE(cur)->height));
+		}
+
+		for (int key = 0; key < 8; key++) {
+			size_t n = 0;
+			avl_tree_for_each_equal(i, &root, &key, cmp_int_to_node,
+						struct test_node, node) {
+				assert(i->n == key && !i->reached);
+				n++;
+			}
+			assert(n == avl_tree_count_equal(&root, &key,
+							 cmp_int_to_node));
+			total += n;
+		}
+		assert(total == present);
+
+		do {
+			i = &nodes[rand() % count];
+		} while (i->reached);
+		i->reached = 1;
+		avl_tree_remove(&root, &i->node);
+		present--;
 	}
+	assert(root.avl_tree_node == NULL);
 }
 
 static void
-test(int data[], int count)
+sum_node(struct avl_tree_node *node, void *acc)
 {
-	shuffle(data, count);
-	node_idx = 0;
+	*(long *)acc += INT_VALUE(node);
+}
 
-	/* Insert the data, checking the AVL tree invariants after each step.  */
-	for (int i = 0; i < count; i++) {
-		insert(data[i]);
-	#if VERIFY
-		setheights();
-		checktree();
-		verify(data, i + 1);
-	#endif
+static void
+add_sums(void *acc, const void *next)
+{
+	*(long *)acc += *(const long *)next;
+}
+
+/* Random operations on a block tree, checked against a plain array.  */
+static void
+test_block(int num_ops, int max_key)
+{
+	struct avl_block_tree tree = AVL_BLOCK_TREE;
+	char *present = calloc(max_key, 1);
+	size_t count = 0;
+
+	for (int op = 0; op < num_ops; op++) {
+		const unsigned long key = rand() % max_key;
+		void *value;
+
+		/* Insert more often at first, then remove more often.  */
+		if (rand() % num_ops > op) {
+			int ret = avl_block_insert(&tree, key, (void *)key);
+			assert(ret == present[key]);
+			count += !present[key];
+			present[key] = 1;
+		} else if (avl_block_remove(&tree, key, &value)) {
+			assert(present[key] && value == (void *)key);
+			present[key] = 0;
+			count--;
+		} else {
+			assert(!present[key]);
+		}
+		assert(tree.count == count);
+		assert(!avl_block_lookup(&tree, key) == !present[key]);
+
+		if (op % 1000 == 0) {
+			struct avl_block_cursor cursor;
+			const struct avl_tree_node *cur;
+			size_t seen = 0;
+			long prev = -1;
+
+			for (bool ok = avl_block_first(&tree, &cursor); ok;
+			     ok = avl_block_next(&cursor), seen++) {
+				assert((long)avl_block_cursor_key(&cursor) > prev);
+				prev = avl_block_cursor_key(&cursor);
+				assert(present[prev]);
+			}
+			assert(seen == count);
+
+			for (cur = avl_tree_first_in_order(&tree.root); cur;
+			     cur = avl_tree_next_in_order(cur)) {
+				const struct avl_block *b =
+					avl_tree_entry(cur, struct avl_block,
+						       node);
+				assert(b->count > 0 && b->count <= AVL_BLOCK_KEYS);
+				for (int x = b->count; x < AVL_BLOCK_KEYS; x++)
+					assert(b->keys[x] == ULONG_MAX);
+			}
+
+			if (avl_block_seek(&tree, key, &cursor))
+				assert(avl_block_cursor_key(&cursor) >= key);
+		}
 	}
 
-	/* Delete the data in random order, checking the AVL tree invariants
-	 * after each step.  */
-	shuffle(data, count);
-	for (int i = 0; i < count; i++) {
-		delete(data[i]);
-	#if VERIFY
-		setheights();
-		checktree();
-		verify(data + (i + 1), count - (i + 1));
-	#endif
+	avl_block_destroy(&tree);
+	free(present);
+}
+
+static unsigned long
+hash_int_node(const struct avl_tree_node *node)
+{
+	/* Deliberately poor, to exercise collisions.  */
+	return INT_VALUE(node) & ~7;
+}
+
+/* Random operations on a hash-indexed tree, checked against a plain array.  */
+static void
+test_hash(int num_ops, int max_key)
+{
+	struct test_node *items = calloc(max_key, sizeof(items[0]));
+	struct avl_hash_tree tree;
+	size_t count = 0;
+
+	avl_hash_tree_init(&tree, hash_int_node, cmp_int_nodes);
+
+	for (int op = 0; op < num_ops; op++) {
+		const int key = rand() % max_key;
+		struct test_node *i = &items[key];
+		struct avl_tree_node *dup, *found;
+
+		if (rand() % 2) {
+			i->n = key;
+			assert(avl_hash_tree_insert(&tree, &i->node, &dup) ==
+			       i->reached);
+			assert(!i->reached || dup == &i->node);
+			count += !i->reached;
+			i->reached = 1;
+		} else if (i->reached) {
+			avl_hash_tree_remove(&tree, &i->node);
+			i->reached = 0;
+			count--;
+		}
+		assert(tree.count == count);
+
+		found = avl_hash_tree_lookup(&tree, key & ~7, &key,
+					     cmp_int_to_node);
+		assert(found == (i->reached ? &i->node : NULL));
+		assert(avl_tree_lookup(&tree.root, &key, cmp_int_to_node) ==
+		       found);
+	}
+
+	for (int key = 0; key < max_key; key++) {
+		struct test_node query = { .n = key };
+
+		assert(!avl_hash_tree_lookup_node(&tree, &query.node) ==
+		       !items[key].reached);
 	}
+
+	avl_hash_tree_destroy(&tree);
+	free(items);
 }
 
-int
-main(void)
+struct lite_test_node {
+	struct avl_lite_node node;
+	int n;
+	bool present;
+};
+
+#define LITE_INT_VALUE(__node) \
+	avl_lite_entry(__node, struct lite_test_node, node)->n
+
+static int
+cmp_lite_nodes(const struct avl_lite_node *node1,
+	       const struct avl_lite_node *node2)
 {
-	const int num_iterations = 100000;
-	const int max_node_count = 50;
-	int data[max_node_count];
+	return LITE_INT_VALUE(node1) - LITE_INT_VALUE(node2);
+}
 
-	for (int i = 0; i < max_node_count; i++)
-		data[i] = i;
+static int
+cmp_int_to_lite_node(const void *intptr, const struct avl_lite_node *node)
+{
+	return *(const int *)intptr - LITE_INT_VALUE(node);
+}
 
-	nodes = malloc(max_node_count * sizeof(nodes[0]));
+/* Returns the height of a lite subtree, checking ordering and balance.  */
+static int
+check_lite_subtree(const struct avl_lite_node *node, int lo, int hi)
+{
+	int left_height, right_height;
 
-	printf("Using max_node_count=%d\n", max_node_count);
+	if (!node)
+		return 0;
+	assert(LITE_INT_VALUE(node) > lo && LITE_INT_VALUE(node) < hi);
+	left_height = check_lite_subtree(avl_lite_left(node), lo,
+					 LITE_INT_VALUE(node));
+	right_height = check_lite_subtree(avl_lite_right(node),
+					  LITE_INT_VALUE(node), hi);
+	assert((int)(node->right & 1) - (int)(node->left & 1) ==
+	       right_height - left_height);
+	return 1 + max(left_height, right_height);
+}
 
-	for (int i = 0; i < num_iterations; i++) {
+/* Random operations on a tree without parent pointers, checked against a
+ * plain array.  */
+static void
+test_lite(int num_ops, int max_key)
+{
+	struct lite_test_node *items = calloc(max_key, sizeof(items[0]));
+	struct avl_lite_root root = AVL_LITE_ROOT;
+	struct avl_lite_cursor cursor;
+	struct avl_lite_node *cur;
+	int count = 0, prev = -1, seen = 0;
 
-		if (i % 1024 == 0)
-			printf("Iteration %d/%d\n", i, num_iterations);
+	for (int op = 0; op < num_ops; op++) {
+		const int key = rand() % max_key;
+		struct lite_test_node *i = &items[key];
 
-		/* Reset the tree.  */
-		root = AVL_ROOT;
+		if (rand() % 2) {
+			i->n = key;
+			cur = avl_lite_insert(&root, &i->node, cmp_lite_nodes);
+			assert(cur == (i->present ? &i->node : NULL));
+			count += !i->present;
+			i->present = true;
+		} else {
+			cur = avl_lite_remove(&root, &key, cmp_int_to_lite_node);
+			assert(cur == (i->present ? &i->node : NULL));
+			count -= i->present;
+			i->present = false;
+		}
+		assert(avl_lite_lookup(&root, &key, cmp_int_to_lite_node) ==
+		       (i->present ? &i->node : NULL));
+		if (op % 1024 == 0)
+			check_lite_subtree(root.node, -1, max_key);
+	}
+	check_lite_subtree(root.node, -1, max_key);
 
-		/* Do the test with a random number of nodes, up to the
-		 * 'max_node_count'.  */
-		test(data, rand() % max_node_count);
+	for (cur = avl_lite_cursor_first(&cursor, &root); cur;
+	     cur = avl_lite_cursor_next(&cursor)) {
+		assert(LITE_INT_VALUE(cur) > prev);
+		assert(items[LITE_INT_VALUE(cur)].present);
+		prev = LITE_INT_VALUE(cur);
+		seen++;
+	}
+	assert(seen == count);
 
-		/* Shuffle the array.  */
-		shuffle(data, max_node_count);
+	avl_lite_destroy(&root, NULL);
+	assert(!root.node);
+	free(items);
+}
+
+struct radix_test_node {
+	struct avl_tree_node node;
+	unsigned long key;
+	bool present;
+};
+
+/* Random operations on a radix-directed tree, checked against a plain array.
+ * Keys are spread over @key_bits bits.  */
+static void
+test_radix(int num_ops, int max_key, unsigned int key_bits)
+{
+	struct radix_test_node *items = calloc(max_key, sizeof(items[0]));
+	const unsigned int shift = key_bits > 24 ? key_bits - 24 : 0;
+	struct avl_radix_tree tree;
+	const struct avl_tree_node *cur;
+	size_t count = 0, seen = 0;
+	unsigned long prev = 0;
+
+	avl_radix_tree_init(&tree,
+			    AVL_RADIX_KEY_OFFSET(struct radix_test_node,
+						 node, key),
+			    key_bits);
+
+	for (int op = 0; op < num_ops; op++) {
+		const int x = rand() % max_key;
+		struct radix_test_node *i = &items[x];
+		struct avl_tree_node *dup;
+
+		i->key = (unsigned long)x << shift;
+		if (rand() % 4) {
+			assert(avl_radix_tree_insert(&tree, &i->node, &dup) ==
+			       i->present);
+			assert(!i->present || dup == &i->node);
+			count += !i->present;
+			i->present = true;
+		} else if (i->present) {
+			avl_radix_tree_remove(&tree, &i->node);
+			i->present = false;
+			count--;
+		}
+		assert(tree.count == count);
+		assert(avl_radix_tree_lookup(&tree, i->key) ==
+		       (i->present ? &i->node : NULL));
+	}
+	assert(tree.bits > 4);
+
+	for (cur = avl_radix_tree_first(&tree); cur;
+	     cur = avl_radix_tree_next(&tree, cur)) {
+		const struct radix_test_node *i =
+			avl_tree_entry(cur, struct radix_test_node, node);
+
+		assert(i->present);
+		assert(seen == 0 || i->key > prev);
+		prev = i->key;
+		seen++;
+	}
+	assert(seen == count);
+
+	avl_radix_tree_destroy(&tree);
+	free(items);
+}
+
+struct seq_test_node {
+	struct avl_seq_node node;
+	int id;
+};
+
+#define SEQ_ID(n) avl_seq_entry(n, struct seq_test_node, node)->id
+
+/* Returns the height of a subtree of a sequence, checking parents, balance
+ * and sizes.  */
+static int
+check_seq_subtree(const struct avl_tree_node *node,
+		  const struct avl_tree_node *parent, size_t *size_ret)
+{
+	size_t left_size, right_size;
+	int left_height, right_height;
+
+	*size_ret = 0;
+	if (!node)
+		return 0;
+	assert(avl_get_parent(node) == parent);
+	left_height = check_seq_subtree(node->left, node, &left_size);
+	right_height = check_seq_subtree(node->right, node, &right_size);
+	assert(node->balance == right_height - left_height);
+	*size_ret = 1 + left_size + right_size;
+	assert(avl_tree_entry(node, struct avl_seq_node, node)->size ==
+	       *size_ret);
+	return 1 + max(left_height, right_height);
+}
+
+/* Checks a sequence against the ids in @ids.  */
+static void
+check_seq(const struct avl_seq_root *root, const int ids[], size_t count)
+{
+	const struct avl_tree_node *cur;
+	size_t size, i = 0;
+
+	check_seq_subtree(root->tree.avl_tree_node, NULL, &size);
+	assert(size == count && avl_seq_size(root) == count);
+	for (cur = avl_tree_first_in_order(&root->tree); cur;
+	     cur = avl_tree_next_in_order(cur))
+		assert(SEQ_ID(cur) == ids[i++]);
+	assert(i == count);
+}
+
+/* Random operations on a sequence, checked against a plain array.  */
+static void
+test_seq(int num_ops, int max_len)
+{
+	struct seq_test_node *items = calloc(max_len, sizeof(items[0]));
+	int *ids = malloc(max_len * sizeof(ids[0]));
+	int *free_ids = malloc(max_len * sizeof(free_ids[0]));
+	int *tmp = malloc(max_len * sizeof(tmp[0]));
+	struct avl_seq_root root = AVL_SEQ_ROOT, left, right;
+	struct avl_seq_node *item;
+	size_t count = 0, pos, n;
+	int nfree = 0;
+
+	for (int id = max_len - 1; id >= 0; id--) {
+		items[id].id = id;
+		free_ids[nfree++] = id;
+	}
+	assert(avl_seq_insert_at(&root, 1, &items[0].node) == -1);
+	assert(!avl_seq_get(&root, 0) && !avl_seq_remove_at(&root, 0));
+
+	for (int op = 0; op < num_ops; op++) {
+		switch (rand() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			if (!nfree)
+				break;
+			pos = rand() % (count + 1);
+			item = &items[free_ids[--nfree]].node;
+			assert(avl_seq_insert_at(&root, pos, item) == 0);
+			memmove(&ids[pos + 1], &ids[pos],
+				(count - pos) * sizeof(ids[0]));
+			ids[pos] = free_ids[nfree];
+			count++;
+			assert(avl_seq_index(item) == pos);
+			break;
+		case 3:
+		case 4:
+			pos = rand() % (count + 1);
+			item = avl_seq_remove_at(&root, pos);
+			if (pos == count) {
+				assert(!item);
+				break;
+			}
+			assert(item == &items[ids[pos]].node);
+			free_ids[nfree++] = ids[pos];
+			memmove(&ids[pos], &ids[pos + 1],
+				(count - pos - 1) * sizeof(ids[0]));
+			count--;
+			break;
+		case 5:
+			pos = rand() % (count + 1);
+			item = avl_seq_get(&root, pos);
+			assert(item == (pos < count ? &items[ids[pos]].node :
+					NULL));
+			if (item)
+				assert(avl_seq_index(item) == pos);
+			break;
+		case 6:
+			/* Split, check both parts, and concatenate them again.  */
+			pos = rand() % (count + 2);
+			avl_seq_split(&root, pos, &left, &right);
+			n = pos < count ? pos : count;
+			assert(!root.tree.avl_tree_node);
+			check_seq(&left, ids, n);
+			check_seq(&right, ids + n, count - n);
+			avl_seq_concat(&root, &left, &right);
+			assert(!left.tree.avl_tree_node &&
+			       !right.tree.avl_tree_node);
+			break;
+		case 7:
+			/* Rotate by splitting and concatenating in place, the
+			 * other way round.  */
+			pos = rand() % (count + 1);
+			left = root;
+			avl_seq_split(&left, pos, &left, &root);
+			avl_seq_concat(&root, &root, &left);
+			memcpy(tmp, ids, pos * sizeof(ids[0]));
+			memmove(ids, &ids[pos], (count - pos) * sizeof(ids[0]));
+			memcpy(&ids[count - pos], tmp, pos * sizeof(ids[0]));
+			break;
+		}
+		if (op % 1024 == 0)
+			check_seq(&root, ids, count);
+	}
+	check_seq(&root, ids, count);
+
+	while (count) {
+		count--;
+		assert(avl_seq_remove_at(&root, count) ==
+		       &items[ids[count]].node);
+	}
+	assert(!root.tree.avl_tree_node);
+	free(tmp);
+	free(free_ids);
+	free(ids);
+	free(items);
+}
+
+struct changelog_replica {
+	struct avl_tree_node **items;
+	int last_key;
+};
+
+static void
+apply_change(const struct avl_change *c, void *ctx)
+{
+	struct changelog_replica *replica = ctx;
+	const int key = INT_VALUE(c->node);
+
+	assert(key > replica->last_key);
+	replica->last_key = key;
+
+	switch (c->op) {
+	case AVL_CHANGE_INSERT:
+		assert(!replica->items[key]);
+		replica->items[key] = c->node;
+		break;
+	case AVL_CHANGE_REMOVE:
+		assert(replica->items[key]);
+		replica->items[key] = NULL;
+		break;
+	case AVL_CHANGE_REPLACE:
+		assert(replica->items[key] == c->old);
+		replica->items[key] = c->node;
+		break;
+	}
+}
+
+/* Keeps a replica of a tree's items in sync by applying the deltas from the
+ * change log.  Each key has two items, so that replacements can alternate
+ * between them.  */
+static void
+test_changelog(int num_ops, int max_key)
+{
+	struct test_node *items = calloc(2 * max_key, sizeof(items[0]));
+	struct avl_tree_node **present = calloc(max_key, sizeof(present[0]));
+	struct changelog_replica replica = {
+		.items = calloc(max_key, sizeof(replica.items[0])),
+	};
+	struct avl_changelog log = AVL_CHANGELOG;
+	struct avl_tree_root tree = AVL_ROOT;
+	uint64_t epoch = avl_changelog_advance(&log);
+
+	for (int i = 0; i < 2 * max_key; i++)
+		items[i].n = i % max_key;
+
+	for (int op = 1; op <= num_ops; op++) {
+		const int key = rand() % max_key;
+		struct avl_tree_node *cur = present[key];
+		struct avl_tree_node *spare = cur == &items[key].node ?
+					      &items[key + max_key].node :
+					      &items[key].node;
+
+		if (!cur) {
+			struct avl_tree_link link;
+			struct avl_tree_node **p = &tree.avl_tree_node;
+
+			tree_search_for_each (&link, p)
+				p = key < INT_VALUE(*p) ? &(*p)->left :
+							  &(*p)->right;
+			assert(avl_changelog_link_node(&log, &tree, &link,
+						       spare) == 0);
+			present[key] = spare;
+		} else if (rand() % 2) {
+			assert(avl_changelog_replace(&log, &tree, cur,
+						     spare) == 0);
+			present[key] = spare;
+		} else {
+			assert(avl_changelog_remove(&log, &tree, cur) == 0);
+			present[key] = NULL;
+		}
+
+		if (op % 1000 == 0) {
+			const uint64_t next = avl_changelog_advance(&log);
+
+			replica.last_key = -1;
+			assert(avl_tree_changes_since(&log, epoch,
+						      cmp_int_nodes,
+						      apply_change,
+						      &replica) == 0);
+			avl_changelog_trim(&log, next);
+			assert(log.count == 0);
+			epoch = next;
+
+			assert(memcmp(replica.items, present,
+				      max_key * sizeof(present[0])) == 0);
+		}
+	}
+
+	avl_changelog_destroy(&log);
+	free(replica.items);
+	free(present);
+	free(items);
+}
+
+/* For test_diff(), the `reached' member holds the value of an item and bit i
+ * of diff_marks[key] is set when a difference of kind i is reported.  */
+static unsigned char *diff_marks;
+
+static bool
+equal_int_values(const struct avl_tree_node *a, const struct avl_tree_node *b)
+{
+	return TEST_NODE(a)->reached == TEST_NODE(b)->reached;
+}
+
+static void
+mark_only_a(struct avl_tree_node *a, void *ctx)
+{
+	diff_marks[INT_VALUE(a)] |= 1;
+}
+
+static void
+mark_only_b(struct avl_tree_node *b, void *ctx)
+{
+	diff_marks[INT_VALUE(b)] |= 2;
+}
+
+static void
+mark_changed(struct avl_tree_node *a, struct avl_tree_node *b, void *ctx)
+{
+	assert(INT_VALUE(a) == INT_VALUE(b));
+	diff_marks[INT_VALUE(a)] |= 4;
+}
+
+/* Diffs a tree against a copy with a few keys added, removed or changed.  */
+static void
+test_diff(int count, unsigned int nranges)
+{
+	struct test_node *items = calloc(2 * count, sizeof(items[0]));
+	unsigned char *expected = calloc(count, 1);
+	struct avl_tree_node **a_ptrs = malloc(count * sizeof(a_ptrs[0]));
+	struct avl_tree_node **b_ptrs = malloc(count * sizeof(b_ptrs[0]));
+	struct avl_tree_root a = AVL_ROOT, b = AVL_ROOT;
+	const struct avl_diff_callbacks cb = {
+		.only_a = mark_only_a,
+		.only_b = mark_only_b,
+		.changed = mark_changed,
+	};
+	size_t na = 0, nb = 0, differences = 0;
+
+	diff_marks = calloc(count, 1);
+
+	for (int key = 0; key < count; key++) {
+		struct test_node *x = &items[key], *y = &items[count + key];
+		const int r = rand() % 64;
+
+		x->n = y->n = key;
+		if (r == 0) {
+			a_ptrs[na++] = &x->node;
+			expected[key] = 1;
+		} else if (r == 1) {
+			b_ptrs[nb++] = &y->node;
+			expected[key] = 2;
+		} else {
+			y->reached = r == 2;
+			a_ptrs[na++] = &x->node;
+			b_ptrs[nb++] = &y->node;
+			expected[key] = r == 2 ? 4 : 0;
+		}
+		differences += expected[key] != 0;
+	}
+	avl_tree_build_sorted(&a, a_ptrs, na);
+	avl_tree_build_sorted(&b, b_ptrs, nb);
+
+	assert(avl_tree_diff(&a, &b, cmp_int_nodes, equal_int_values, &cb) ==
+	       differences);
+	assert(memcmp(diff_marks, expected, count) == 0);
+
+	memset(diff_marks, 0, count);
+	assert(avl_tree_diff_parallel(&a, &b, cmp_int_nodes, equal_int_values,
+				      &cb, nranges) == differences);
+	assert(memcmp(diff_marks, expected, count) == 0);
+
+	/* Only keys are compared without an equality callback.  */
+	memset(diff_marks, 0, count);
+	for (int key = 0; key < count; key++)
+		expected[key] &= ~4;
+	assert(avl_tree_diff_parallel(&b, &b, cmp_int_nodes, NULL, &cb,
+				      nranges) == 0);
+	assert(avl_tree_diff(&a, &b, cmp_int_nodes, NULL, &cb) ==
+	       avl_tree_diff_parallel(&a, &b, cmp_int_nodes, NULL, &cb,
+				      nranges));
+	assert(memcmp(diff_marks, expected, count) == 0);
+
+	free(diff_marks);
+	free(b_ptrs);
+	free(a_ptrs);
+	free(expected);
+	free(items);
+}
+
+struct digest_test_node {
+	struct avl_diff_node node;
+	int n;
+	int value;
+};
+
+#define DIGEST_TEST_NODE(__node) \
+	avl_diff_entry(__node, struct digest_test_node, node)
+
+/* Number of calls of cmp_digest_nodes()  */
+static unsigned long digest_cmp_calls;
+
+static int
+cmp_digest_nodes(const struct avl_tree_node *a, const struct avl_tree_node *b)
+{
+	digest_cmp_calls++;
+	return DIGEST_TEST_NODE(a)->n - DIGEST_TEST_NODE(b)->n;
+}
+
+static int
+cmp_int_to_digest_node(const void *intptr, const struct avl_tree_node *node)
+{
+	return *(const int *)intptr - DIGEST_TEST_NODE(node)->n;
+}
+
+static bool
+equal_digest_values(const struct avl_tree_node *a,
+		    const struct avl_tree_node *b)
+{
+	return DIGEST_TEST_NODE(a)->value == DIGEST_TEST_NODE(b)->value;
+}
+
+static uint64_t
+digest_item_hash(const struct digest_test_node *x)
+{
+	uint64_t h = ((uint64_t)x->n << 32) ^ (uint32_t)x->value;
+
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static void
+mark_digest_only_a(struct avl_tree_node *a, void *ctx)
+{
+	diff_marks[DIGEST_TEST_NODE(a)->n] |= 1;
+}
+
+static void
+mark_digest_only_b(struct avl_tree_node *b, void *ctx)
+{
+	diff_marks[DIGEST_TEST_NODE(b)->n] |= 2;
+}
+
+static void
+mark_digest_changed(struct avl_tree_node *a, struct avl_tree_node *b,
+		    void *ctx)
+{
+	assert(DIGEST_TEST_NODE(a)->n == DIGEST_TEST_NODE(b)->n);
+	diff_marks[DIGEST_TEST_NODE(a)->n] |= 4;
+}
+
+static void
+digest_insert(struct avl_tree_root *root, struct digest_test_node *x)
+{
+	struct avl_tree_node **current = &root->avl_tree_node;
+	struct avl_tree_link link;
+
+	x->node.hash = digest_item_hash(x);
+	tree_search_for_each (&link, current) {
+		if (x->n < DIGEST_TEST_NODE(*current)->n)
+			current = &(*current)->left;
+		else
+			current = &(*current)->right;
+	}
+	avl_diff_link_node(root, &link, &x->node);
+}
+
+/* Changes two equal digest trees in a few places, then checks that
+ * avl_tree_diff_digest() finds the differences while looking at a small part
+ * of the trees, and agrees with avl_tree_diff().  */
+static void
+test_diff_digest(int count, int nchanges)
+{
+	struct digest_test_node *items = calloc(2 * count, sizeof(items[0]));
+	unsigned char *expected = calloc(count, 1);
+	bool *in_a = malloc(count * sizeof(in_a[0]));
+	bool *in_b = malloc(count * sizeof(in_b[0]));
+	struct avl_tree_root a = AVL_ROOT, b = AVL_ROOT, left, right;
+	const struct avl_diff_callbacks cb = {
+		.only_a = mark_digest_only_a,
+		.only_b = mark_digest_only_b,
+		.changed = mark_digest_changed,
+	};
+	size_t differences = 0, only = 0;
+	const int mid = count / 2;
+	struct avl_tree_node *first;
+
+	diff_marks = calloc(count, 1);
+
+	for (int key = 0; key < count; key++) {
+		struct digest_test_node *x = &items[key], *y = &items[count + key];
+
+		x->n = y->n = key;
+		x->value = y->value = rand();
+		digest_insert(&a, x);
+		digest_insert(&b, y);
+		in_a[key] = in_b[key] = true;
 	}
 
+	digest_cmp_calls = 0;
+	assert(avl_tree_diff_digest(&a, &b, cmp_digest_nodes,
+				    equal_digest_values, &cb) == 0);
+	assert(digest_cmp_calls == 0);
+
+	for (int i = 0; i < nchanges; i++) {
+		const int key = rand() % count;
+		struct digest_test_node *x = &items[key], *y = &items[count + key];
+
+		switch (rand() % 4) {
+		case 0:
+			if (in_a[key])
+				avl_diff_remove(&a, &x->node);
+			else
+				digest_insert(&a, x);
+			in_a[key] = !in_a[key];
+			break;
+		case 1:
+			if (in_b[key])
+				avl_diff_remove(&b, &y->node);
+			else
+				digest_insert(&b, y);
+			in_b[key] = !in_b[key];
+			break;
+		default:
+			y->value++;
+			avl_diff_set_hash(&y->node, digest_item_hash(y));
+		}
+	}
+
+	/* Split and rejoin one tree, which changes its shape.  */
+	avl_tree_split_augmented(&a, &mid, cmp_int_to_digest_node, &left,
+				 &right, avl_diff_update);
+	first = avl_tree_first_in_order(&right);
+	if (first) {
+		avl_diff_remove(&right, avl_tree_entry(first,
+						       struct avl_diff_node,
+						       node));
+		avl_tree_join_augmented(&a, &left, first, &right,
+					avl_diff_update);
+	} else {
+		a = left;
+	}
+
+	for (int key = 0; key < count; key++) {
+		if (in_a[key] && !in_b[key])
+			expected[key] = 1;
+		else if (!in_a[key] && in_b[key])
+			expected[key] = 2;
+		else if (in_a[key] && items[key].value !=
+					   items[count + key].value)
+			expected[key] = 4;
+		differences += expected[key] != 0;
+		only += (expected[key] & 3) != 0;
+	}
+
+	digest_cmp_calls = 0;
+	assert(avl_tree_diff_digest(&a, &b, cmp_digest_nodes,
+				    equal_digest_values, &cb) == differences);
+	assert(memcmp(diff_marks, expected, count) == 0);
+	assert(digest_cmp_calls < (unsigned long)count / 4);
+
+	memset(diff_marks, 0, count);
+	assert(avl_tree_diff(&a, &b, cmp_digest_nodes, equal_digest_values,
+			     &cb) == differences);
+	assert(memcmp(diff_marks, expected, count) == 0);
+
+	assert(avl_tree_diff_digest(&a, &b, cmp_digest_nodes, NULL, &cb) ==
+	       only);
+	assert(avl_tree_diff_digest(&b, &a, cmp_digest_nodes,
+				    equal_digest_values, &cb) == differences);
+
+	free(diff_marks);
+	free(in_b);
+	free(in_a);
+	free(expected);
+	free(items);
+}
+
+struct memtable_scan {
+	const int *values;
+	int max_key;
+	int next;
+};
+
+/* Checks that the scan visits exactly the live keys, in order.  */
+static int
+check_memtable_scan(const void *key, size_t key_len,
+		    const void *value, size_t value_len, void *ctx)
+{
+	struct memtable_scan *scan = ctx;
+	char buf[16];
+	int k;
+
+	assert(key_len == 7 && value_len < sizeof(buf));
+	memcpy(buf, key, key_len);
+	buf[key_len] = '\0';
+	k = atoi(buf + 1);
+
+	while (scan->next < k)
+		assert(scan->values[scan->next++] < 0);
+	memcpy(buf, value, value_len);
+	buf[value_len] = '\0';
+	assert(atoi(buf) == scan->values[k]);
+	scan->next = k + 1;
+	return 0;
+}
+
+struct memtable_drain {
+	struct avl_lsm *lsm;
+	int *nruns;
+	int live;
+	int count;
+};
+
+/* Deletes each key it visits, and halfway through freezes and flushes the
+ * store under the running scan.  */
+static int
+drain_memtable_scan(const void *key, size_t key_len,
+		    const void *value, size_t value_len, void *ctx)
+{
+	struct memtable_drain *drain = ctx;
+	char path[64];
+
+	(void)value;
+	(void)value_len;
+	assert(avl_lsm_delete(drain->lsm, key, key_len) == 0);
+	if (++drain->count == drain->live / 2) {
+		assert(avl_lsm_freeze(drain->lsm) == 1);
+		do {
+			sprintf(path, "avl_memtable_test_%d.run",
+				*drain->nruns);
+		} while (avl_lsm_flush(drain->lsm, path) == 1 &&
+			 ++*drain->nruns);
+	}
+	return 0;
+}
+
+/* Random puts and deletes on a store, freezing and flushing to run files
+ * along the way, checked against a plain array.  */
+static void
+test_memtable(int num_ops, int max_key)
+{
+	int *values = malloc(max_key * sizeof(values[0]));
+	const int freeze_every = num_ops / 8;
+	struct memtable_scan scan = { values, max_key, 0 };
+	struct memtable_drain drain = { NULL, NULL, 0, 0 };
+	struct avl_lsm lsm;
+	char path[64];
+	int nruns = 0;
+
+	assert(avl_lsm_init(&lsm) == 0);
+	for (int key = 0; key < max_key; key++)
+		values[key] = -1;
+
+	for (int op = 1; op <= num_ops; op++) {
+		const int key = rand() % max_key;
+		char kbuf[16], vbuf[16];
+		const int klen = sprintf(kbuf, "k%06d", key);
+
+		if (rand() % 4) {
+			values[key] = rand() % 100000;
+			assert(avl_lsm_put(&lsm, kbuf, klen, vbuf,
+					   sprintf(vbuf, "%d",
+						   values[key])) == 0);
+		} else {
+			values[key] = -1;
+			assert(avl_lsm_delete(&lsm, kbuf, klen) == 0);
+		}
+		assert(avl_lsm_active_bytes(&lsm) > 0);
+
+		if (op % freeze_every == 0) {
+			assert(avl_lsm_freeze(&lsm) == 1);
+			if (op % (2 * freeze_every) != 0)
+				continue;
+			do {
+				sprintf(path, "avl_memtable_test_%d.run", nruns);
+			} while (avl_lsm_flush(&lsm, path) == 1 && ++nruns);
+		}
+	}
+	assert(nruns == 8 && lsm.current->nruns == 8 &&
+	       !lsm.current->nfrozen);
+
+	/* Leave some data in the active and frozen memtables, too.  */
+	for (int key = 0; key < max_key; key += 7) {
+		char kbuf[16];
+
+		assert(avl_lsm_delete(&lsm, kbuf,
+				      sprintf(kbuf, "k%06d", key)) == 0);
+		values[key] = -1;
+		if (key % 2)
+			assert(avl_lsm_freeze(&lsm) == 1);
+	}
+
+	for (int key = 0; key < max_key; key++) {
+		char kbuf[16], vbuf[16];
+		void *value;
+		size_t value_len;
+		const int res = avl_lsm_get(&lsm, kbuf,
+					    sprintf(kbuf, "k%06d", key),
+					    &value, &value_len);
+
+		assert(res == (values[key] >= 0));
+		if (res == 1) {
+			assert(value_len == (size_t)sprintf(vbuf, "%d",
+							    values[key]));
+			assert(memcmp(value, vbuf, value_len) == 0);
+			free(value);
+		}
+	}
+
+	assert(avl_lsm_scan(&lsm, NULL, 0, check_memtable_scan, &scan) == 0);
+	while (scan.next < max_key)
+		assert(values[scan.next++] < 0);
+
+	scan.next = max_key / 3;
+	sprintf(path, "k%06d", scan.next);
+	assert(avl_lsm_scan(&lsm, path, 7, check_memtable_scan, &scan) == 0);
+
+	/* The scan holds no lock while visiting, so the callback can write to
+	 * the store.  */
+	drain.lsm = &lsm;
+	drain.nruns = &nruns;
+	for (int key = 0; key < max_key; key++)
+		drain.live += values[key] >= 0;
+	assert(avl_lsm_scan(&lsm, NULL, 0, drain_memtable_scan, &drain) == 0);
+	assert(drain.count == drain.live);
+	for (int key = 0; key < max_key; key++)
+		values[key] = -1;
+	scan.next = 0;
+	assert(avl_lsm_scan(&lsm, NULL, 0, check_memtable_scan, &scan) == 0);
+	assert(scan.next == 0);
+
+	assert(avl_lsm_put(&lsm, "k", 1, NULL, 1) == -1);
+	assert(avl_lsm_put(&lsm, "k", 1, NULL, 0) == 0);
+
+	avl_lsm_destroy(&lsm);
+	for (int i = 0; i < nruns; i++) {
+		sprintf(path, "avl_memtable_test_%d.run", i);
+		remove(path);
+	}
+	free(values);
+}
+
+struct lsm_job {
+	struct avl_lsm *lsm;
+	int count;
+	unsigned int seed;
+	int visited;
+	char last[16];
+};
+
+/* Checks that values match their keys, as test_lsm_concurrent() stores them,
+ * and that keys come in increasing order.  Stops after 64 keys.  */
+static int
+check_lsm_entry(const void *key, size_t key_len,
+		const void *value, size_t value_len, void *ctx)
+{
+	struct lsm_job *job = ctx;
+
+	assert(key_len == 7 && value_len == key_len);
+	assert(memcmp(key, value, key_len) == 0);
+	assert(memcmp(job->last, key, key_len) < 0);
+	memcpy(job->last, key, key_len);
+	return ++job->visited == 64;
+}
+
+static void *
+lsm_reader(void *arg)
+{
+	struct lsm_job *job = arg;
+
+	for (int i = 0; i < job->count; i++) {
+		char kbuf[16];
+		const int klen = sprintf(kbuf, "k%06d",
+					 (int)((job->seed = job->seed *
+						1103515245 + 12345) >> 16) %
+					 job->count);
+		void *value;
+		size_t value_len;
+
+		if (i % 256 == 0) {
+			memset(job->last, 0, sizeof(job->last));
+			job->visited = 0;
+			assert(avl_lsm_scan(job->lsm, kbuf, klen,
+					    check_lsm_entry, job) >= 0);
+		}
+		if (avl_lsm_get(job->lsm, kbuf, klen, &value,
+				&value_len) == 1) {
+			assert(value_len == (size_t)klen);
+			assert(memcmp(value, kbuf, klen) == 0);
+			free(value);
+		}
+	}
+	return NULL;
+}
+
+/* One thread writes, freezes and flushes a store while others look keys up
+ * and scan it.  */
+static void
+test_lsm_concurrent(int nreaders, int count)
+{
+	struct lsm_job jobs[nreaders];
+	pthread_t threads[nreaders];
+	struct avl_lsm lsm;
+	char path[64];
+	int nruns = 0;
+
+	assert(avl_lsm_init(&lsm) == 0);
+	for (int t = 0; t < nreaders; t++) {
+		jobs[t] = (struct lsm_job) { &lsm, count, t + 1, 0, { 0 } };
+		assert(pthread_create(&threads[t], NULL, lsm_reader,
+				      &jobs[t]) == 0);
+	}
+
+	for (int op = 1; op <= 4 * count; op++) {
+		char kbuf[16];
+		const int klen = sprintf(kbuf, "k%06d", op * 7919 % count);
+
+		if (op % 5)
+			assert(avl_lsm_put(&lsm, kbuf, klen, kbuf, klen) == 0);
+		else
+			assert(avl_lsm_delete(&lsm, kbuf, klen) == 0);
+		if (op % (count / 2) == 0) {
+			assert(avl_lsm_freeze(&lsm) == 1);
+			sprintf(path, "avl_lsm_test_%d.run", nruns);
+			assert(avl_lsm_flush(&lsm, path) == 1);
+			nruns++;
+		}
+	}
+
+	for (int t = 0; t < nreaders; t++)
+		pthread_join(threads[t], NULL);
+	avl_lsm_destroy(&lsm);
+	for (int i = 0; i < nruns; i++) {
+		sprintf(path, "avl_lsm_test_%d.run", i);
+		remove(path);
+	}
+}
+
+struct ctree_test_node {
+	struct avl_ctree_node node;
+	int n;
+};
+
+#define CTREE_INT_VALUE(__node) \
+	avl_ctree_entry(__node, struct ctree_test_node, node)->n
+
+static int
+cmp_ctree_nodes(const struct avl_ctree_node *node1,
+		const struct avl_ctree_node *node2)
+{
+	return CTREE_INT_VALUE(node1) - CTREE_INT_VALUE(node2);
+}
+
+static int
+cmp_int_to_ctree_node(const void *intptr, const struct avl_ctree_node *node)
+{
+	return *(const int *)intptr - CTREE_INT_VALUE(node);
+}
+
+/* Returns the height of a concurrent subtree, checking ordering, parent
+ * links, heights and balance, and counting the nodes in *@count.  */
+static int
+check_ctree_subtree(const struct avl_ctree_node *node,
+		    const struct avl_ctree_node *parent, int lo, int hi,
+		    int *count)
+{
+	int left_height, right_height;
+
+	if (!node)
+		return 0;
+	assert(node->parent == parent && !node->lock);
+	assert(CTREE_INT_VALUE(node) > lo && CTREE_INT_VALUE(node) < hi);
+	left_height = check_ctree_subtree(node->left, node, lo,
+					  CTREE_INT_VALUE(node), count);
+	right_height = check_ctree_subtree(node->right, node,
+					   CTREE_INT_VALUE(node), hi, count);
+	assert(right_height - left_height >= -1 &&
+	       right_height - left_height <= 1);
+	assert(node->height == 1 + max(left_height, right_height));
+	++*count;
+	return node->height;
+}
+
+struct concurrent_job {
+	struct avl_ctree *tree;
+	struct avl_fc_tree *fc_tree;
+	struct test_node *items;
+	struct ctree_test_node *citems;
+	struct ctree_test_node **live;
+	int first, step, count;
+	unsigned int seed;
+};
+
+/* rand() is not thread-safe.  */
+static int
+concurrent_rand(struct concurrent_job *job)
+{
+	job->seed = job->seed * 1103515245 + 12345;
+	return (job->seed >> 16) & 0x7fff;
+}
+
+static void *
+concurrent_worker(void *arg)
+{
+	struct concurrent_job *job = arg;
+
+	for (int round = 0; round < 20; round++) {
+		for (int k = job->first; k < job->count; k += job->step) {
+			struct ctree_test_node *i = job->live[k];
+			int other = concurrent_rand(job) % job->count;
+
+			if (!i) {
+				/* A fresh node each round: removed nodes may
+				 * still be in use by other threads' searches.  */
+				i = &job->citems[round * job->count + k];
+				i->n = k;
+				assert(!avl_ctree_insert(job->tree, &i->node,
+							 cmp_ctree_nodes));
+				job->live[k] = i;
+			} else if (concurrent_rand(job) % 4 == 0) {
+				avl_ctree_remove(job->tree, &i->node);
+				job->live[k] = NULL;
+			} else if (concurrent_rand(job) % 2) {
+				assert(avl_ctree_remove_key(job->tree, &k,
+						cmp_int_to_ctree_node) ==
+				       &i->node);
+				job->live[k] = NULL;
+			}
+			assert(avl_ctree_lookup(job->tree, &k,
+						cmp_int_to_ctree_node) ==
+			       (job->live[k] ? &job->live[k]->node : NULL));
+			/* Owned by another thread; any answer is fine, as
+			 * long as the search completes.  */
+			avl_ctree_lookup(job->tree, &other,
+					 cmp_int_to_ctree_node);
+		}
+	}
+	return NULL;
+}
+
+/* Several threads insert, remove and look up interleaved keys at once, so
+ * that they keep changing the same parts of the tree.  Nodes are neither freed
+ * nor reused while the threads run, so reclamation is not an issue.  Once
+ * they are done the tree must be strictly balanced again.  */
+static void
+test_concurrent(int nthreads, int count)
+{
+	struct ctree_test_node *items = calloc(20 * count, sizeof(items[0]));
+	struct ctree_test_node **live = calloc(count, sizeof(live[0]));
+	struct concurrent_job jobs[nthreads];
+	pthread_t threads[nthreads];
+	struct avl_ctree tree;
+	int x = 0, seen = 0;
+
+	avl_ctree_init(&tree);
+	for (int t = 0; t < nthreads; t++) {
+		jobs[t] = (struct concurrent_job) {
+			&tree, NULL, NULL, items, live,
+			t, nthreads, count, t + 1,
+		};
+		assert(pthread_create(&threads[t], NULL, concurrent_worker,
+				      &jobs[t]) == 0);
+	}
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	check_ctree_subtree(avl_ctree_root(&tree), &tree.holder, -1, count,
+			    &seen);
+	for (int k = 0; k < count; k++) {
+		x += live[k] != NULL;
+		assert(avl_ctree_lookup(&tree, &k, cmp_int_to_ctree_node) ==
+		       (live[k] ? &live[k]->node : NULL));
+	}
+	assert(seen == x);
+	free(live);
+	free(items);
+}
+
+static void *
+fc_worker(void *arg)
+{
+	struct concurrent_job *job = arg;
+	struct avl_fc_slot *slot = avl_fc_register(job->fc_tree);
+
+	assert(slot);
+	for (int round = 0; round < 20; round++) {
+		for (int k = job->first; k < job->count; k += job->step) {
+			struct test_node *i = &job->items[k];
+			struct test_node query = { .n = k };
+
+			if (!i->reached) {
+				assert(!avl_fc_insert(job->fc_tree, slot,
+						      &i->node));
+				i->reached = 1;
+			} else if (concurrent_rand(job) % 2) {
+				assert(avl_fc_remove(job->fc_tree, slot,
+						     &query.node) == &i->node);
+				i->reached = 0;
+			}
+			assert(!avl_fc_lookup(job->fc_tree, slot,
+					      &query.node) == !i->reached);
+		}
+	}
+	return NULL;
+}
+
+/* Same as test_concurrent(), through the flat-combining front end.  */
+static void
+test_fc(int nthreads, int count)
+{
+	struct test_node *items = calloc(count, sizeof(items[0]));
+	struct concurrent_job jobs[nthreads];
+	pthread_t threads[nthreads];
+	struct avl_fc_tree tree;
+	const struct avl_tree_node *cur = NULL;
+	int x = 0;
+
+	assert(avl_fc_tree_init(&tree, cmp_int_nodes, nthreads) == 0);
+	for (int k = 0; k < count; k++)
+		items[k].n = k;
+
+	for (int t = 0; t < nthreads; t++) {
+		jobs[t] = (struct concurrent_job) {
+			NULL, &tree, items, NULL, NULL,
+			t, nthreads, count, t + 1,
+		};
+		assert(pthread_create(&threads[t], NULL, fc_worker,
+				      &jobs[t]) == 0);
+	}
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	root = tree.root;
+	setheights();
+	checktree();
+	for (int k = 0; k < count; k++) {
+		if (!items[k].reached)
+			continue;
+		cur = cur ? avl_tree_next_in_order(cur)
+			  : avl_tree_first_in_order(&root);
+		assert(cur == &items[k].node);
+		x++;
+	}
+	assert(x == 0 || !avl_tree_next_in_order(cur));
+
+	avl_fc_tree_destroy(&tree);
+	free(items);
+}
+
+struct compact_arena {
+	struct test_node *items;
+	int used;
+};
+
+static struct avl_tree_node *
+relocate_test_node(struct avl_tree_node *node, void *ctx)
+{
+	struct compact_arena *arena = ctx;
+	struct test_node *i = &arena->items[arena->used++];
+
+	*i = *TEST_NODE(node);
+	return &i->node;
+}
+
+static void
+release_test_node(struct avl_tree_node *node, void *ctx)
+{
+	free(TEST_NODE(node));
+}
+
+/* Compacts a tree of separately allocated items into an array.  */
+static void
+test_compact(int count)
+{
+	struct compact_arena arena = {
+		.items = malloc(count * sizeof(arena.items[0])),
+	};
+	const struct avl_tree_node *cur;
+	int x, n = 0;
+
+	root = AVL_ROOT;
+	for (x = 0; x < count; x++) {
+		struct test_node *i = malloc(sizeof(*i));
+
+		i->n = rand() % (2 * count);
+		if (avl_tree_insert(&root, &i->node, cmp_int_nodes))
+			free(i);
+		else
+			n++;
+	}
+
+	avl_tree_compact(&root, relocate_test_node, release_test_node, &arena);
+	assert(arena.used == n);
+	setheights();
+	checktree();
+	for (cur = avl_tree_first_in_order(&root), x = 0; cur;
+	     cur = avl_tree_next_in_order(cur), x++) {
+		assert(TEST_NODE(cur) == &arena.items[x]);
+		assert(!cur->left || cur->left->parent == cur);
+		assert(!cur->right || cur->right->parent == cur);
+	}
+	assert(x == n);
+	assert(!avl_get_parent(root.avl_tree_node));
+
+	root = AVL_ROOT;
+	free(arena.items);
+}
+
+/* Builds a tree of items allocated from an arena, then compacts it into a
+ * second arena.  */
+static void
+test_arena(int count)
+{
+	struct avl_tree_node **ptrs = malloc(count * sizeof(ptrs[0]));
+	struct avl_arena arena, arena2;
+	const struct avl_tree_node *cur;
+	int x;
+
+	/* Small chunks, so that several get mapped.  */
+	avl_arena_init(&arena, 0, -1, 0);
+	for (x = 0; x < count; x++) {
+		struct test_node *i = avl_arena_alloc(&arena, sizeof(*i));
+
+		assert(i && (uintptr_t)i % 16 == 0);
+		i->n = x;
+		ptrs[x] = &i->node;
+	}
+	assert(arena.chunks);
+
+	root = AVL_ROOT;
+	avl_tree_build_sorted(&root, ptrs, count);
+
+	avl_arena_init(&arena2, 0, -1, AVL_ARENA_HUGETLB);
+	AVL_ARENA_ITEMS(&arena2, struct test_node, node);
+	assert(avl_arena_reserve(&arena2,
+				 count * sizeof(struct test_node)) == 0);
+	avl_tree_compact(&root, avl_arena_relocate, NULL, &arena2);
+	avl_arena_destroy(&arena);
+	assert(!arena.chunks);
+
+	setheights();
+	checktree();
+	for (cur = avl_tree_first_in_order(&root), x = 0; cur;
+	     cur = avl_tree_next_in_order(cur), x++) {
+		assert(INT_VALUE(cur) == x);
+		if (x)
+			assert(TEST_NODE(cur) == TEST_NODE(ptrs[0]) + x);
+		else
+			ptrs[0] = (struct avl_tree_node *)cur;
+	}
+	assert(x == count);
+
+	root = AVL_ROOT;
+	avl_arena_destroy(&arena2);
+	free(ptrs);
+}
+
+struct shm_test_item {
+	struct avl_shm_node node;
+	int key;
+};
+
+#define SHM_KEY(__node) avl_shm_entry(__node, struct shm_test_item, node)->key
+
+static int
+cmp_shm_items(const struct avl_shm_node *node1,
+	      const struct avl_shm_node *node2)
+{
+	return SHM_KEY(node1) - SHM_KEY(node2);
+}
+
+static int
+cmp_int_to_shm_item(const void *intptr, const struct avl_shm_node *node)
+{
+	return *(const int *)intptr - SHM_KEY(node);
+}
+
+static const struct avl_shm_node *
+shm_child(const int64_t *link)
+{
+	return *link ? (const struct avl_shm_node *)((const char *)link + *link)
+		     : NULL;
+}
+
+/* Returns the height of a shared subtree, checking ordering and balance.  */
+static int
+check_shm_subtree(const struct avl_shm_node *node, int lo, int hi)
+{
+	int left_height, right_height;
+
+	if (!node)
+		return 0;
+	assert(SHM_KEY(node) > lo && SHM_KEY(node) < hi);
+	left_height = check_shm_subtree(shm_child(&node->left), lo,
+					SHM_KEY(node));
+	right_height = check_shm_subtree(shm_child(&node->right),
+					 SHM_KEY(node), hi);
+	assert(node->balance == right_height - left_height);
+	return 1 + max(left_height, right_height);
+}
+
+struct shm_reader_job {
+	struct avl_shm_segment *seg;
+	int max_key;
+	int stop;
+	unsigned long lookups;
+};
+
+/* Looks up even keys, which are never removed, through its own mapping.  */
+static void *
+shm_reader(void *arg)
+{
+	struct shm_reader_job *job = arg;
+	unsigned int seed = 1;
+
+	while (!__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) {
+		int key;
+		const struct avl_shm_node *found;
+
+		seed = seed * 1103515245 + 12345;
+		key = (seed >> 8) % job->max_key & ~1;
+		found = avl_shm_lookup(job->seg, &key, cmp_int_to_shm_item);
+		assert(found && SHM_KEY(found) == key);
+		job->lookups++;
+	}
+	return NULL;
+}
+
+/* One writer updating a tree in a shared file while a reader searches it
+ * through a second mapping, at another address.  */
+static void
+test_shm(int num_ops, int max_key)
+{
+	FILE *file = tmpfile();
+	struct avl_shm_segment *seg, *seg2;
+	struct shm_test_item **items = calloc(max_key, sizeof(items[0]));
+	struct shm_reader_job job = { .max_key = max_key };
+	pthread_t reader;
+
+	assert(file);
+	seg = avl_shm_create(fileno(file), (size_t)32 << 20);
+	assert(seg);
+	seg2 = avl_shm_attach(fileno(file));
+	assert(seg2 && seg2 != seg);
+
+	assert(avl_shm_lock(seg) == 0);
+	for (int key = 0; key < max_key; key += 2) {
+		items[key] = avl_shm_alloc(seg, sizeof(*items[key]));
+		items[key]->key = key;
+		assert(!avl_shm_insert(seg, &items[key]->node, cmp_shm_items));
+	}
+	avl_shm_unlock(seg);
+
+	job.seg = seg2;
+	assert(pthread_create(&reader, NULL, shm_reader, &job) == 0);
+
+	for (int op = 0; op < num_ops; op++) {
+		const int key = rand() % max_key | 1;
+		struct shm_test_item *i;
+
+		assert(avl_shm_lock(seg) == 0);
+		if (rand() % 2) {
+			i = avl_shm_alloc(seg, sizeof(*i));
+			assert(i);
+			i->key = key;
+			assert(avl_shm_insert(seg, &i->node, cmp_shm_items) ==
+			       (items[key] ? &items[key]->node : NULL));
+			if (!items[key])
+				items[key] = i;
+		} else {
+			assert(avl_shm_remove(seg, &key, cmp_int_to_shm_item) ==
+			       (items[key] ? &items[key]->node : NULL));
+			items[key] = NULL;
+		}
+		avl_shm_unlock(seg);
+	}
+
+	__atomic_store_n(&job.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(reader, NULL);
+	assert(job.lookups > 0);
+
+	check_shm_subtree(shm_child(&seg2->root.node), -1, max_key);
+	for (int key = 0; key < max_key; key++) {
+		const struct avl_shm_node *found =
+			avl_shm_lookup(seg2, &key, cmp_int_to_shm_item);
+
+		assert(!found == !items[key]);
+		assert(!found || (const char *)found - (const char *)seg2 ==
+				 (const char *)items[key] - (const char *)seg);
+	}
+
+	avl_shm_detach(seg2);
+	avl_shm_detach(seg);
+	fclose(file);
+	free(items);
+}
+
+static unsigned long
+trace_node_key(const struct avl_tree_node *node)
+{
+	return INT_VALUE(node);
+}
+
+static unsigned long
+trace_ctx_key(const void *intptr)
+{
+	return *(const int *)intptr;
+}
+
+/* Writes a trace, plain or with hashed keys, and reads it back.  */
+static void
+test_trace(int count, unsigned int flags)
+{
+	static const int ops[3] = {
+		AVL_TRACE_INSERT, AVL_TRACE_LOOKUP, AVL_TRACE_REMOVE,
+	};
+	const char *path = "avl_trace_test.trace";
+	struct test_node *items = malloc(count * sizeof(items[0]));
+	struct avl_trace_reader reader;
+	unsigned long inserted_keys[2];
+	int op;
+	unsigned long key;
+
+	assert(avl_trace_start(path, trace_node_key, trace_ctx_key, flags) == 0);
+	assert(avl_trace_start(path, trace_node_key, NULL, flags) == -1);
+	for (int x = 0; x < count; x++) {
+		/* Inserts alternate between two keys.  */
+		items[x].n = x % 3 ? rand() : x % 6;
+		switch (x % 3) {
+		case 0:
+			avl_trace_node(AVL_TRACE_INSERT, &items[x].node);
+			break;
+		case 1:
+			avl_trace_ctx(AVL_TRACE_LOOKUP, &items[x].n);
+			break;
+		default:
+			avl_trace_record(AVL_TRACE_REMOVE,
+					 (unsigned long)items[x].n);
+		}
+	}
+	assert(avl_trace_stop() == 0);
+
+	/* Not recorded  */
+	avl_trace_record(AVL_TRACE_REMOVE, 0);
+
+	assert(avl_trace_open(&reader, path) == 0);
+	assert(reader.flags == flags);
+	for (int x = 0; x < count; x++) {
+		assert(avl_trace_read(&reader, &op, &key) == 1);
+		assert(op == ops[x % 3]);
+		if (!(flags & AVL_TRACE_HASH_KEYS))
+			assert(key == (unsigned long)items[x].n);
+		else if (x % 3 == 0 && x < 6)
+			inserted_keys[x / 3] = key;
+		else if (x % 3 == 0)
+			assert(key == inserted_keys[x % 6 / 3]);
+	}
+	assert(avl_trace_read(&reader, &op, &key) == 0);
+	avl_trace_close(&reader);
+	if (flags & AVL_TRACE_HASH_KEYS)
+		assert(inserted_keys[0] != inserted_keys[1] &&
+		       inserted_keys[1] != 3);
+
+	remove(path);
+	free(items);
+}
+
+#ifdef AVL_TRACE
+/* With the library built with -DAVL_TRACE (make test_trace): records a
+ * workload going through every traced entry point, next to structures which
+ * use trees internally, then replays the trace into an array of flags and
+ * checks that it ends up with the items left in the tree.  */
+static void
+test_trace_replay(int num_ops, int max_key)
+{
+	const char *path = "avl_trace_replay.trace";
+	struct test_node *items = malloc(max_key * sizeof(items[0]));
+	bool *in_tree = calloc(max_key, sizeof(in_tree[0]));
+	bool *present = calloc(max_key, sizeof(present[0]));
+	struct avl_block_tree blocks = AVL_BLOCK_TREE;
+	struct avl_memtable mt = AVL_MEMTABLE;
+	struct avl_trace_reader reader;
+	struct avl_tree_node *cur;
+	unsigned long key;
+	int op, ret;
+
+	root = AVL_ROOT;
+	for (int k = 0; k < max_key; k++)
+		items[k].n = k;
+
+	assert(avl_trace_start(path, trace_node_key, trace_ctx_key, 0) == 0);
+	for (int i = 0; i < num_ops; i++) {
+		int k = rand() % max_key;
+		struct avl_tree_node *node = &items[k].node;
+		struct avl_tree_node **current = &root.avl_tree_node;
+		struct avl_tree_link link;
+		struct avl_tree_root detached;
+
+		switch (rand() % 8) {
+		case 0:
+			if (!avl_tree_insert(&root, node, cmp_int_nodes))
+				in_tree[k] = true;
+			break;
+		case 1:
+			if (!in_tree[k]) {
+				assert(!avl_tree_upsert(&root, node,
+							cmp_int_nodes));
+				in_tree[k] = true;
+			}
+			break;
+		case 2:
+			tree_search_for_each (&link, current) {
+				if (k == INT_VALUE(*current))
+					break;
+				current = (k < INT_VALUE(*current)) ?
+					  &(*current)->left : &(*current)->right;
+			}
+			if (!*current) {
+				avl_tree_link_node(&root, &link, node);
+				in_tree[k] = true;
+			}
+			break;
+		case 3:
+			assert((avl_tree_remove_key(&root, &k,
+						    cmp_int_to_node) != NULL) ==
+			       in_tree[k]);
+			in_tree[k] = false;
+			break;
+		case 4:
+			if (in_tree[k]) {
+				avl_tree_remove(&root, node);
+				in_tree[k] = false;
+			}
+			break;
+		case 5:
+			assert((lookup(k) != NULL) == in_tree[k]);
+			break;
+		case 6:
+			/* An empty range: nothing leaves the tree.  */
+			avl_tree_remove_range(&root, &k, &k, cmp_int_to_node,
+					      &detached);
+			assert(!detached.avl_tree_node);
+			break;
+		default:
+			/* Splits and merges of blocks, and memtable
+			 * entries, are not items of the trace.  */
+			if (rand() % 2)
+				assert(avl_block_insert(&blocks, k, NULL) >= 0);
+			else
+				avl_block_remove(&blocks, k, NULL);
+			assert(avl_memtable_put(&mt, &k, sizeof(k),
+						&k, sizeof(k)) == 0);
+		}
+	}
+	assert(avl_trace_stop() == 0);
+
+	assert(avl_trace_open(&reader, path) == 0);
+	while ((ret = avl_trace_read(&reader, &op, &key)) == 1) {
+		assert(key < (unsigned long)max_key);
+		if (op == AVL_TRACE_INSERT)
+			present[key] = true;
+		else if (op == AVL_TRACE_REMOVE)
+			present[key] = false;
+	}
+	assert(ret == 0);
+	avl_trace_close(&reader);
+
+	for (cur = avl_tree_first_in_order(&root); cur;
+	     cur = avl_tree_next_in_order(cur)) {
+		assert(present[INT_VALUE(cur)]);
+		present[INT_VALUE(cur)] = false;
+	}
+	for (int k = 0; k < max_key; k++)
+		assert(!present[k]);
+
+	remove(path);
+	avl_block_destroy(&blocks);
+	avl_memtable_destroy(&mt);
+	free(present);
+	free(in_tree);
+	free(items);
+	root = AVL_ROOT;
+}
+#endif
+
+/* Build a large tree from shuffled items with several threads, then sum it
+ * with several threads.  */
+static void
+test_build_parallel(int count, unsigned int nthreads)
+{
+	struct test_node *items = malloc(count * sizeof(items[0]));
+	struct avl_tree_node **ptrs = malloc(count * sizeof(ptrs[0]));
+	const struct avl_tree_node *cur;
+	int x;
+
+	for (x = 0; x < count; x++) {
+		items[x].n = x / 2;
+		ptrs[x] = &items[x].node;
+	}
+	shuffle_nodes(ptrs, count);
+
+	root = AVL_ROOT;
+	assert(avl_tree_build_parallel(&root, ptrs, count, cmp_int_nodes,
+				       nthreads) == (count + 1) / 2);
+	setheights();
+	checktree();
+	for (cur = avl_tree_first_in_order(&root), x = 0; cur;
+	     cur = avl_tree_next_in_order(cur), x++)
+		assert(INT_VALUE(cur) == x);
+	assert(x == (count + 1) / 2);
+
+	long sums[nthreads];
+	memset(sums, 0, sizeof(sums));
+	assert(avl_tree_reduce_parallel(&root, nthreads, sum_node, sums,
+					sizeof(sums[0]), add_sums) == nthreads);
+	assert(sums[0] == (long)x * (x - 1) / 2);
+
+	free(ptrs);
+	free(items);
+}
+#endif
+
+static void
+shuffle(int data[], int count)
+{
+	for (int i = 0; i < count; i++) {
+		const int x = rand() % count;
+		const int v0 = data[0];
+		const int vx = data[x];
+		data[0] = vx;
+		data[x] = v0;
+	}
+}
+
+static void
+test(int data[], int count)
+{
+	shuffle(data, count);
+	node_idx = 0;
+
+	/* Insert the data, checking the AVL tree invariants after each step.  */
+	for (int i = 0; i < count; i++) {
+		insert(data[i]);
+	#if VERIFY
+		setheights();
+		checktree();
+		verify(data, i + 1);
+	#endif
+	}
+
+	/* Rebuild the same tree in one go, with some duplicates mixed in.  */
+	if (count && rand() % 4 == 0) {
+		struct avl_tree_node *ptrs[2 * count];
+		int n = 0;
+
+		for (int i = 0; i < count; i++) {
+			ptrs[n++] = &lookup(data[i])->node;
+			if (rand() % 4 == 0) {
+				struct test_node *dup = &nodes[node_idx++];
+
+				dup->n = data[i];
+				ptrs[n++] = &dup->node;
+			}
+		}
+		shuffle_nodes(ptrs, n);
+		root = AVL_ROOT;
+		assert(count == avl_tree_build_parallel(&root, ptrs, n,
+							cmp_int_nodes, 1));
+		for (int i = 1; i < n; i++)
+			assert(INT_VALUE(ptrs[i - 1]) < INT_VALUE(ptrs[i]) ||
+			       i >= count);
+	#if VERIFY
+		setheights();
+		checktree();
+		verify(data, count);
+	#endif
+	}
+
+	/* Replace some of the data in place.  */
+	for (int i = 0; i < count; i++) {
+		if (rand() % 4 == 0) {
+			replace(data[i]);
+		#if VERIFY
+			setheights();
+			checktree();
+			verify(data, count);
+		#endif
+		}
+	}
+
+	/* Delete the data in random order, checking the AVL tree invariants
+	 * after each step.  */
+	shuffle(data, count);
+	for (int i = 0; i < count; i++) {
+		delete(data[i]);
+	#if VERIFY
+		setheights();
+		checktree();
+		verify(data + (i + 1), count - (i + 1));
+	#endif
+	}
+}
+
+struct filter_ctx {
+	int divisor;
+	int last_dropped;
+	int ndropped;
+};
+
+static bool
+keep_non_multiple(const struct avl_tree_node *node, void *ctx)
+{
+	return INT_VALUE(node) % ((struct filter_ctx *)ctx)->divisor != 0;
+}
+
+static void
+drop_multiple(struct avl_tree_node *node, void *ctx)
+{
+	struct filter_ctx *f = ctx;
+
+	assert(INT_VALUE(node) % f->divisor == 0);
+	assert(INT_VALUE(node) > f->last_dropped);
+	f->last_dropped = INT_VALUE(node);
+	f->ndropped++;
+}
+
+static int num_cleared;
+
+static void
+count_cleared(struct avl_tree_node *node)
+{
+	node->left = node->right = NULL;
+	num_cleared++;
+}
+
+/* Filter a tree by a predicate, then clear it.  */
+static void
+test_filter(int data[], int count)
+{
+	struct filter_ctx f = { .divisor = rand() % 4 + 1, .last_dropped = -1 };
+	int kept[count + 1], nkept = 0;
+
+	shuffle(data, count);
+	node_idx = 0;
+	root = AVL_ROOT;
+
+	for (int i = 0; i < count; i++) {
+		insert(data[i]);
+		if (data[i] % f.divisor)
+			kept[nkept++] = data[i];
+	}
+
+	assert(avl_tree_filter(&root, keep_non_multiple, drop_multiple, &f) ==
+	       nkept);
+	assert(f.ndropped == count - nkept);
+#if VERIFY
+	setheights();
+	checktree();
+	verify(kept, nkept);
+	{
+		int height = 0;
+
+		while ((1 << height) < nkept + 1)
+			height++;
+		assert(HEIGHT(root.avl_tree_node) == height);
+	}
+#endif
+
+	num_cleared = 0;
+	avl_tree_clear(&root, count_cleared);
+	assert(!root.avl_tree_node);
+	assert(num_cleared == nkept);
+}
+
+/* Remove a random range in one go, then split the rest and join it again.  */
+static void
+test_range(int data[], int count)
+{
+	int lo = rand() % (count + 2) - 1, hi = lo + rand() % (count + 2);
+	int kept[count + 1], removed[count + 1], nkept = 0, nremoved = 0;
+	struct avl_tree_root detached, left, right;
+	struct avl_tree_node *mid;
+
+	shuffle(data, count);
+	node_idx = 0;
+	root = AVL_ROOT;
+
+	for (int i = 0; i < count; i++) {
+		insert(data[i]);
+		if (data[i] >= lo && data[i] < hi)
+			removed[nremoved++] = data[i];
+		else
+			kept[nkept++] = data[i];
+	}
+
+	assert(avl_tree_count_range(&root, &lo, &hi, cmp_int_to_node) ==
+	       nremoved);
+	avl_tree_remove_range(&root, &lo, &hi, cmp_int_to_node, &detached);
+	assert(avl_tree_count_range(&root, &lo, &hi, cmp_int_to_node) == 0);
+#if VERIFY
+	setheights();
+	checktree();
+	verify(kept, nkept);
+#endif
+
+	avl_tree_split(&root, &hi, cmp_int_to_node, &left, &right);
+	assert(!root.avl_tree_node);
+	mid = avl_tree_first_in_order(&right);
+	if (mid) {
+		avl_tree_remove(&right, mid);
+		avl_tree_join(&root, &left, mid, &right);
+		assert(!left.avl_tree_node && !right.avl_tree_node);
+	} else {
+		root = left;
+	}
+#if VERIFY
+	setheights();
+	checktree();
+	verify(kept, nkept);
+
+	root = detached;
+	setheights();
+	checktree();
+	verify(removed, nremoved);
+#endif
+}
+
+/* Remove the data by key, in random order, along with keys not in the tree.  */
+static void
+test_remove_key(int data[], int count)
+{
+	shuffle(data, count);
+	node_idx = 0;
+	root = AVL_ROOT;
+
+	for (int i = 0; i < count; i++)
+		insert(data[i]);
+
+	shuffle(data, count);
+	for (int i = 0; i < count; i++) {
+		const int missing = -1 - data[i];
+		struct test_node *node = lookup(data[i]);
+
+		assert(!avl_tree_remove_key(&root, &missing, cmp_int_to_node));
+		assert(&node->node ==
+		       avl_tree_remove_key(&root, &data[i], cmp_int_to_node));
+		assert(!lookup(data[i]));
+	#if VERIFY
+		setheights();
+		checktree();
+		verify(data + (i + 1), count - (i + 1));
+	#endif
+	}
+	assert(!root.avl_tree_node);
+}
+
+/* Check the stack-based cursor, then sweep through the tree with a cursor
+ * from a random key on, removing the multiples of 3 on the way.  */
+static void
+test_cursor(int data[], int count)
+{
+	const int lo = rand() % (count + 1);
+	int kept[count + 1], nkept = 0, seen = 0, prev = INT_MAX;
+	struct avl_tree_cursor cursor;
+	struct avl_tree_node *node;
+
+	shuffle(data, count);
+	node_idx = 0;
+	root = AVL_ROOT;
+
+	for (int i = 0; i < count; i++) {
+		insert(data[i]);
+		if (data[i] < lo || data[i] % 3)
+			kept[nkept++] = data[i];
+	}
+
+	/* The stack-based cursor visits the same nodes as the parent-pointer
+	 * walk, from the start and from @lo.  */
+	{
+		struct avl_tree_stack_cursor stack_cursor;
+		struct avl_tree_node *cur;
+
+		cur = avl_tree_first_in_order(&root);
+		for (node = avl_tree_stack_cursor_first(&stack_cursor, &root);
+		     node; node = avl_tree_stack_cursor_next(&stack_cursor)) {
+			assert(node == cur);
+			assert(node == avl_tree_stack_cursor_node(&stack_cursor));
+			cur = avl_tree_next_in_order(cur);
+		}
+		assert(!cur);
+
+		cur = avl_tree_lower_bound(&root, &lo, cmp_int_to_node);
+		for (node = avl_tree_stack_cursor_seek(&stack_cursor, &root,
+						       &lo, cmp_int_to_node);
+		     node; node = avl_tree_stack_cursor_next(&stack_cursor)) {
+			assert(node == cur);
+			cur = avl_tree_next_in_order(cur);
+		}
+		assert(!cur);
+	}
+
+	avl_tree_cursor_init(&cursor, &root);
+	node = avl_tree_cursor_seek(&cursor, &lo, cmp_int_to_node);
+	assert(!node || !avl_tree_prev_in_order(node) ||
+	       INT_VALUE(avl_tree_prev_in_order(node)) < lo);
+	while (node) {
+		const int n = INT_VALUE(node);
+
+		assert(n >= lo);
+		if (n % 3 == 0) {
+			assert(avl_tree_cursor_remove(&cursor) == node);
+			node = avl_tree_cursor_node(&cursor);
+			assert(!node || INT_VALUE(node) > n);
+		} else {
+			node = avl_tree_cursor_next(&cursor);
+		}
+	}
+	assert(!avl_tree_cursor_remove(&cursor));
+#if VERIFY
+	setheights();
+	checktree();
+	verify(kept, nkept);
+#endif
+
+	/* Walk back from past the end, where the sweep left the cursor.  */
+	for (node = avl_tree_cursor_prev(&cursor); node;
+	     node = avl_tree_cursor_prev(&cursor)) {
+		assert(INT_VALUE(node) < prev);
+		prev = INT_VALUE(node);
+		seen++;
+	}
+	assert(seen == nkept);
+	assert(avl_tree_cursor_first(&cursor) ==
+	       avl_tree_first_in_order(&root));
+	assert(avl_tree_cursor_last(&cursor) ==
+	       avl_tree_last_in_order(&root));
+}
+
+/* Rebalances a tree changed with relaxed balancing and checks that it holds
+ * @data.  */
+static void
+rebalance_relaxed(const int *data, int count)
+{
+	avl_tree_rebalance_pending(&root);
+#if VERIFY
+	setheights();
+	checktree();
+	verify(data, count);
+#endif
+}
+
+/* Insert and delete with relaxed balancing, rebalancing now and then.  Half
+ * of the tree is built with ordinary inserts, so that rebalancing also meets
+ * subtrees which did not change, and the rest sometimes goes in sorted
+ * order.  */
+static void
+test_relaxed(int data[], int count)
+{
+	shuffle(data, count);
+	node_idx = 0;
+	root = AVL_ROOT;
+
+	for (int i = 0; i < count / 2; i++)
+		insert(data[i]);
+	if (rand() % 2)
+		qsort(data + count / 2, count - count / 2, sizeof(data[0]),
+		      cmp_ints);
+
+	for (int i = count / 2; i < count; i++) {
+		struct test_node *item = &nodes[node_idx++];
+		struct avl_tree_node **current = &root.avl_tree_node;
+		struct avl_tree_link link;
+
+		item->n = data[i];
+		tree_search_for_each (&link, current) {
+			if (item->n < INT_VALUE(*current))
+				current = &(*current)->left;
+			else
+				current = &(*current)->right;
+		}
+		avl_tree_link_node_relaxed(&link, &item->node);
+		if (rand() % 8 == 0)
+			rebalance_relaxed(data, i + 1);
+	}
+	rebalance_relaxed(data, count);
+
+	/* Delete half of the data.  */
+	shuffle(data, count);
+	for (int i = 0; i < count / 2; i++) {
+		avl_tree_remove_relaxed(&root, &lookup(data[i])->node);
+		if (rand() % 8 == 0)
+			rebalance_relaxed(data + i + 1, count - i - 1);
+	}
+	rebalance_relaxed(data + count / 2, count - count / 2);
+}
+
+/* Links @items, numbered from 0, into an empty tree in descending order with
+ * relaxed balancing, which makes a list.  */
+static void
+link_descending_relaxed(struct test_node *items, int count)
+{
+	root = AVL_ROOT;
+	for (int i = count - 1; i >= 0; i--) {
+		struct avl_tree_node **current = &root.avl_tree_node;
+		struct avl_tree_link link;
+
+		items[i].n = i;
+		tree_search_for_each (&link, current)
+			current = &(*current)->left;
+		avl_tree_link_node_relaxed(&link, &items[i].node);
+	}
+}
+
+/* Keys linked in descending order with relaxed balancing make a list, longer
+ * than the stack of a stack cursor.  */
+static void
+test_relaxed_deep(int count)
+{
+	struct test_node *items = malloc(count * sizeof(items[0]));
+	struct avl_tree_stack_cursor cursor;
+	struct filter_ctx f = { .divisor = 3, .last_dropped = -1 };
+	struct avl_tree_node *node;
+	const int zero = 0;
+	int k;
+
+	link_descending_relaxed(items, count);
+
+	/* The stack cursor gives up; parent pointers still work.  */
+	assert(count > AVL_TREE_MAX_HEIGHT);
+	assert(!avl_tree_stack_cursor_first(&cursor, &root));
+	assert(!avl_tree_stack_cursor_node(&cursor));
+	assert(!avl_tree_stack_cursor_seek(&cursor, &root, &zero,
+					   cmp_int_to_node));
+	for (node = avl_tree_first_in_order(&root), k = 0; node;
+	     node = avl_tree_next_in_order(node), k++)
+		assert(INT_VALUE(node) == k);
+	assert(k == count);
+
+	avl_tree_rebalance_pending(&root);
+	for (node = avl_tree_stack_cursor_first(&cursor, &root), k = 0; node;
+	     node = avl_tree_stack_cursor_next(&cursor), k++)
+		assert(INT_VALUE(node) == k);
+	assert(k == count);
+
+	/* avl_tree_filter() rebalances the list before walking it.  */
+	link_descending_relaxed(items, count);
+	assert(avl_tree_filter(&root, keep_non_multiple, drop_multiple, &f) ==
+	       count - (count + 2) / 3);
+	assert(f.ndropped == (count + 2) / 3);
+#if VERIFY
+	setheights();
+	checktree();
+#endif
+	k = 0;
+	for (int i = 0; i < count; i++) {
+		if (i % 3 == 0)
+			continue;
+		node = avl_tree_lookup_node(&root, &items[i].node,
+					    cmp_int_nodes);
+		assert(node == &items[i].node);
+		k++;
+	}
+	assert(k == count - f.ndropped);
+
+	free(items);
+	root = AVL_ROOT;
+}
+
+int
+main(void)
+{
+	const int num_iterations = 100000;
+	const int max_node_count = 50;
+	int data[max_node_count];
+
+	for (int i = 0; i < max_node_count; i++)
+		data[i] = i;
+
+	nodes = malloc(3 * max_node_count * sizeof(nodes[0]));
+
+	printf("Using max_node_count=%d\n", max_node_count);
+
+	for (int i = 0; i < num_iterations; i++) {
+
+		if (i % 1024 == 0)
+			printf("Iteration %d/%d\n", i, num_iterations);
+
+		/* Reset the tree.  */
+		root = AVL_ROOT;
+
+		/* Do the test with a random number of nodes, up to the
+		 * 'max_node_count'.  */
+		test(data, rand() % max_node_count);
+
+		if (i % 8 == 0)
+			test_relaxed(data, rand() % max_node_count);
+		if (i % 8 == 2)
+			test_cursor(data, rand() % max_node_count);
+		if (i % 8 == 4)
+			test_range(data, rand() % max_node_count);
+		if (i % 8 == 6)
+			test_filter(data, rand() % max_node_count);
+		if (i % 8 == 7)
+			test_remove_key(data, rand() % max_node_count);
+
+		/* Shuffle the array.  */
+		shuffle(data, max_node_count);
+	}
+
+#if VERIFY
+	for (int i = 0; i < 1000; i++)
+		test_multiset(rand() % max_node_count);
+	test_relaxed_deep(200);
+	test_build_parallel(200000, 4);
+	test_compact(200000);
+	test_arena(200000);
+	test_block(200000, 5000);
+	test_hash(200000, 5000);
+	test_lite(200000, 5000);
+	test_radix(200000, 50000, 16);
+	test_radix(200000, 50000, 64);
+	test_seq(200000, 5000);
+	test_changelog(200000, 2000);
+	test_diff(200000, 4);
+	test_diff_digest(200000, 20);
+	test_memtable(100000, 20000);
+	test_lsm_concurrent(4, 20000);
+	test_concurrent(4, 20000);
+	test_fc(4, 5000);
+	test_shm(200000, 20000);
+	test_trace(100000, 0);
+	test_trace(100000, AVL_TRACE_HASH_KEYS);
+#ifdef AVL_TRACE
+	test_trace_replay(200000, 5000);
+#endif
+#endif
+
 	printf("Done.\n");
 
 	free(nodes);
@@ -0,0 +1,222 @@
+/*
+ * This is a test program for avl_tree.hpp.  Compile with:
+ *
+ *	$ g++ test_cxx.cpp avl_tree.c avl_traversal.c avl_trace.c
+ *	      -o test_cxx -std=c++20 -Wall -O2
+ *
+ * As with test.c, it checks random operations against a reference, here a
+ * std::multiset of the keys.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide via the Creative Commons Zero 1.0 Universal Public Domain
+ * Dedication (the "CC0").
+ *
+ * This software is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the CC0 for more details.
+ *
+ * You should have received a copy of the CC0 along with this software; if not
+ * see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <ranges>
+#include <set>
+#include <vector>
+
+#include "avl_tree.hpp"
+
+struct item {
+	int key;
+	avl_tree_node node;
+	int serial;
+
+	bool operator<(const item &o) const { return key < o.key; }
+};
+
+struct key_of {
+	int operator()(const item &i) const { return i.key; }
+};
+
+using set_type = avl::intrusive_set<item, offsetof(item, node)>;
+using multimap_type =
+	avl::intrusive_multimap<item, offsetof(item, node), key_of>;
+
+static_assert(std::bidirectional_iterator<set_type::iterator>);
+static_assert(std::bidirectional_iterator<set_type::const_iterator>);
+static_assert(std::ranges::bidirectional_range<set_type>);
+static_assert(std::ranges::bidirectional_range<const multimap_type>);
+
+/* Checks @tree against @ref, forwards, backwards and through the reverse
+ * iterators.  */
+template <class Tree>
+static void
+check(const Tree &tree, const std::multiset<int> &ref)
+{
+	assert(tree.size() == ref.size());
+	assert(tree.empty() == ref.empty());
+	assert(std::ranges::equal(tree | std::views::transform(key_of()),
+				  ref));
+	assert(std::ranges::equal(tree | std::views::reverse |
+				  std::views::transform(key_of()),
+				  ref | std::views::reverse));
+	assert(std::equal(tree.rbegin(), tree.rend(), ref.rbegin(), ref.rend(),
+			  [](const item &i, int k) { return i.key == k; }));
+	assert(std::ranges::distance(tree) == (std::ptrdiff_t)ref.size());
+
+	/* Walk back from end() by hand.  */
+	auto it = tree.end();
+	for (auto r = ref.rbegin(); r != ref.rend(); ++r)
+		assert((--it)->key == *r);
+	assert(it == tree.begin());
+}
+
+/* Unique set: insert, find, bounds, erase by position and by item.  */
+static void
+test_set(int num_ops, int max_key)
+{
+	std::vector<item> items(max_key);
+	std::vector<bool> present(max_key);
+	std::multiset<int> ref;
+	set_type set;
+
+	for (int k = 0; k < max_key; k++)
+		items[k].key = k;
+
+	for (int op = 0; op < num_ops; op++) {
+		const int k = rand() % max_key;
+		item probe = { k, {}, 0 };
+
+		switch (rand() % 4) {
+		case 0:
+		case 1: {
+			auto [it, inserted] = set.insert(items[k]);
+			assert(inserted == !present[k]);
+			assert(&*it == &items[k]);
+			if (inserted) {
+				present[k] = true;
+				ref.insert(k);
+			}
+			break;
+		}
+		case 2:
+			if (present[k]) {
+				auto next =
+					set.erase(set.iterator_to(items[k]));
+				assert(next == set.upper_bound(probe));
+				present[k] = false;
+				ref.erase(k);
+			}
+			break;
+		default: {
+			auto it = set.lower_bound(probe);
+			auto r = ref.lower_bound(k);
+
+			assert((it == set.end()) == (r == ref.end()));
+			if (r != ref.end())
+				assert(it->key == *r);
+			assert(set.contains(probe) == present[k]);
+			assert(set.count(probe) == (present[k] ? 1u : 0u));
+			assert((set.find(probe) != set.end()) == present[k]);
+			break;
+		}
+		}
+		if (op % 256 == 0)
+			check(set, ref);
+	}
+	check(set, ref);
+
+	/* Ranges algorithms on the whole set.  */
+	assert(std::ranges::is_sorted(set, {}, &item::key));
+	assert(std::ranges::count_if(set, [](const item &i) {
+		       return i.key % 2;
+	       }) == std::ranges::count_if(ref, [](int k) { return k % 2; }));
+	if (!ref.empty()) {
+		const int k = *std::next(ref.begin(), ref.size() / 2);
+		auto it = std::ranges::find_if(set, [k](const item &i) {
+			return i.key == k;
+		});
+		assert(it != set.end() && it->key == k);
+		assert(std::ranges::max_element(set, {}, &item::key)->key ==
+		       *ref.rbegin());
+	}
+
+	/* Moving takes the items along.  */
+	set_type moved(std::move(set));
+	assert(set.empty() && set.size() == 0);
+	check(moved, ref);
+
+	moved.erase(moved.begin(), moved.end());
+	assert(moved.empty());
+}
+
+/* Multimap with duplicate keys: equal_range, erase_key and range erase.  */
+static void
+test_multimap(int num_items, int max_key)
+{
+	std::vector<item> items(num_items);
+	std::multiset<int> ref;
+	multimap_type map;
+
+	for (int i = 0; i < num_items; i++) {
+		items[i].key = rand() % max_key;
+		items[i].serial = i;
+		map.insert(items[i]);
+		ref.insert(items[i].key);
+	}
+	check(map, ref);
+
+	/* Equal items stay in insertion order.  */
+	for (int k = 0; k < max_key; k++) {
+		auto [first, last] = map.equal_range(k);
+		int prev = -1;
+
+		assert(std::distance(first, last) ==
+		       (std::ptrdiff_t)ref.count(k));
+		assert(map.count(k) == ref.count(k));
+		for (; first != last; ++first) {
+			assert(first->key == k && first->serial > prev);
+			prev = first->serial;
+		}
+	}
+
+	/* Remove some keys entirely, then a range by iterators.  */
+	for (int k = 0; k < max_key; k += 3) {
+		assert(map.erase_key(k) == ref.count(k));
+		ref.erase(k);
+	}
+	check(map, ref);
+
+	const int lo = max_key / 4, hi = max_key / 2;
+	auto last = map.erase(map.lower_bound(lo), map.lower_bound(hi));
+	assert(last == map.lower_bound(hi));
+	ref.erase(ref.lower_bound(lo), ref.lower_bound(hi));
+	check(map, ref);
+
+	/* Erase through reverse iterators, from the back.  */
+	while (!map.empty()) {
+		auto rit = map.rbegin();
+		assert(rit->key == *ref.rbegin());
+		map.erase(std::prev(rit.base()));
+		ref.erase(std::prev(ref.end()));
+	}
+	check(map, ref);
+}
+
+int
+main()
+{
+	srand(0);
+	for (int i = 0; i < 20; i++) {
+		test_set(20000, 2000);
+		test_multimap(5000, 500);
+	}
+	printf("Done.\n");
+	return 0;
+}